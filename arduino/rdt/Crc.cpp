@@ -0,0 +1,61 @@
+
+#include <avr/pgmspace.h>
+#include "Crc.h"
+
+
+// crc of a nibble, reflected polynomials 0x8408 and 0x82F63B78
+static const uint16_t crc16_table[16] PROGMEM = {
+	0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+	0x8408, 0x9489, 0xA50A, 0xB58B, 0xC60C, 0xD68D, 0xE70E, 0xF78F
+};
+
+static const uint32_t crc32c_table[16] PROGMEM = {
+	0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1, 0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+	0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9, 0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75
+};
+
+
+// The negated sum of the bytes.
+uint8_t Crc::sum8(const unsigned char* data, size_t len) {
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += data[i];
+	return ~sum + 1;
+}
+
+
+// Init 0xFFFF, final xor 0xFFFF, low nibble first.
+uint16_t Crc::crc16(const unsigned char* data, size_t len) {
+	uint16_t crc = 0xFFFF;
+
+	while (len-- > 0) {
+		crc = crc ^ *data++;
+		crc = (crc >> 4) ^ pgm_read_word(&crc16_table[crc & 0x0f]);
+		crc = (crc >> 4) ^ pgm_read_word(&crc16_table[crc & 0x0f]);
+	}
+	return ~crc;
+}
+
+
+// Init 0xFFFFFFFF, final xor 0xFFFFFFFF.
+uint32_t Crc::crc32c(const unsigned char* data, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len-- > 0) {
+		crc = crc ^ *data++;
+		crc = (crc >> 4) ^ pgm_read_dword(&crc32c_table[crc & 0x0f]);
+		crc = (crc >> 4) ^ pgm_read_dword(&crc32c_table[crc & 0x0f]);
+	}
+	return ~crc;
+}
+
+
+uint32_t Crc::compute(const unsigned char* data, size_t len) {
+#if CHECK_TYPE == CHECK_CRC32
+	return crc32c(data, len);
+#elif CHECK_TYPE == CHECK_CRC16
+	return crc16(data, len);
+#else
+	return sum8(data, len);
+#endif
+}
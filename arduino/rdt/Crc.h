@@ -0,0 +1,40 @@
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// integrity check of the frames, the PC must use the same (set_check())
+#define CHECK_SUM8		0		// 8 bit additive sum, 1 byte
+#define CHECK_CRC16		1		// CRC-16/X-25, 2 bytes
+#define CHECK_CRC32		2		// CRC-32C, 4 bytes
+
+#ifndef CHECK_TYPE
+#define CHECK_TYPE		CHECK_CRC16
+#endif
+
+#if CHECK_TYPE == CHECK_CRC32
+#define CHECK_SIZE		4
+#elif CHECK_TYPE == CHECK_CRC16
+#define CHECK_SIZE		2
+#else
+#define CHECK_SIZE		1
+#endif
+
+
+// Same CRCs as the PC, with 16 entries tables in flash (one lookup per
+// nibble): 32 and 64 bytes instead of 512 and 1024 for a byte table
+class Crc {
+
+	public:
+		static uint8_t sum8(const unsigned char* data, size_t len);
+		static uint16_t crc16(const unsigned char* data, size_t len);
+		static uint32_t crc32c(const unsigned char* data, size_t len);
+
+		// The check chosen by CHECK_TYPE
+		static uint32_t compute(const unsigned char* data, size_t len);
+};
+
+
+#endif
@@ -0,0 +1,106 @@
+
+#include "FrameParser.h"
+
+
+FrameParser::FrameParser() {
+	reset();
+}
+
+
+/**
+ * Every block starts with a code byte, which is the distance to the next zero
+ * of the message (or 0xFF for a block of 254 bytes without zero).
+ * The zeros are replaced by the code bytes, then the delimiter is appended.
+ */
+unsigned int FrameParser::encode(unsigned char* src, unsigned int len, unsigned char* dst) {
+	unsigned int code_pos = 0;
+	unsigned int out = 1;
+	unsigned char code = 1;
+
+	for (unsigned int i = 0; i < len; i++) {
+		if (src[i] == 0) {
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		} else {
+			dst[out++] = src[i];
+			code++;
+			if (code == 0xFF) {
+				dst[code_pos] = code;
+				code_pos = out++;
+				code = 1;
+			}
+		}
+	}
+
+	dst[code_pos] = code;
+	dst[out++] = FRAME_DELIMITER;
+	return out;
+}
+
+
+/**
+ * Decode on the fly, see the PC version for the details.
+ */
+int FrameParser::push(unsigned char byte) {
+	if (done) {
+		len = 0;
+		done = false;
+	}
+
+	if (byte == FRAME_DELIMITER) {
+		int ret = 0;
+
+		if (!skip && remaining > 0) {
+			ret = -1;
+		} else if (!skip && len > 0) {
+			done = true;
+			ret = len;
+		}
+
+		if (ret <= 0)
+			len = 0;
+		skip = false;
+		remaining = 0;
+		block_zero = false;
+		return ret;
+	}
+
+	if (skip)
+		return 0;
+
+	if (remaining == 0) {
+		if (block_zero) {
+			if (len >= MAX_MESSAGE_SIZE) {
+				skip = true;
+				return -1;
+			}
+			message[len++] = 0;
+		}
+		remaining = byte - 1;
+		block_zero = (byte < 0xFF);
+		return 0;
+	}
+
+	if (len >= MAX_MESSAGE_SIZE) {
+		skip = true;
+		return -1;
+	}
+	message[len++] = byte;
+	remaining--;
+	return 0;
+}
+
+
+unsigned char* FrameParser::get_message() {
+	return message;
+}
+
+
+void FrameParser::reset() {
+	len = 0;
+	remaining = 0;
+	block_zero = false;
+	skip = false;
+	done = false;
+}
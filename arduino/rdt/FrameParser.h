@@ -0,0 +1,43 @@
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include <string.h>
+
+// byte that separates two encoded messages on the wire
+#define FRAME_DELIMITER		0x00
+
+// max size of a decoded message, at least a frame with a full payload
+#ifndef MAX_MESSAGE_SIZE
+#define MAX_MESSAGE_SIZE	16
+#endif
+
+// worst case size of n bytes once encoded (code bytes + delimiter)
+#define COBS_MAX_SIZE(n)	((n) + (n) / 254 + 2)
+
+
+// COBS decoder, one byte at a time: after a damaged message it is aligned
+// again at the next delimiter
+class FrameParser {
+
+	private:
+		unsigned char message[MAX_MESSAGE_SIZE];	// message being decoded
+		unsigned int len;							// bytes decoded so far
+		unsigned int remaining;						// bytes left in the current block
+		bool block_zero;							// a zero follows the current block
+		bool skip;									// drop bytes until next delimiter
+		bool done;									// message returned, clear at next push
+
+	public:
+
+		FrameParser();
+
+		// Encode len bytes of src in dst (COBS_MAX_SIZE(len) bytes), return the encoded size
+		static unsigned int encode(unsigned char* src, unsigned int len, unsigned char* dst);
+		// Return the length of the completed message, 0 if not complete, -1 if dropped
+		int push(unsigned char byte);
+		unsigned char* get_message();
+		void reset();
+};
+
+
+#endif
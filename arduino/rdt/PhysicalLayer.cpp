@@ -27,16 +27,29 @@ int PhysicalLayer::read_bytes(unsigned char* buff, unsigned int len) {
 
 
 /**
- * First we check if there are at least the bytes to compose a frame.
- * If there are read a number of bytes equal or multiple of the size of a frame
- * let's not read anything
+ * Push the available bytes into the parser until a frame is complete.
+ * Connect messages are counted and skipped, messages of wrong size dropped.
+ * A probe means the PC (re)started: answer READY and repeat the connect,
+ * the PC flushed it if it was sent before the port was open.
  */
-int PhysicalLayer::read_frames(unsigned char* buff, unsigned int len) {
-	if (len > 0) {
-		unsigned int bytes = Serial.available();
-		if (bytes >= sizeof(frame)) {
-			bytes = bytes - (bytes % sizeof(frame));
-			return read_bytes(buff, bytes);
+int PhysicalLayer::next_message() {
+	while (Serial.available() > 0) {
+		int len = parser.push(Serial.read());
+
+		if (len == 1 && parser.get_message()[0] == CONNECT) {
+			connects++;
+		} else if (len == 1 && parser.get_message()[0] == PROBE) {
+			send_control(READY);
+			if (connect_pending)
+				send_control(CONNECT);
+		} else if (len >= (int)FRAME_HEADER_SIZE) {
+			// the size must be the one in the header, the payload must fit
+			unsigned short n;
+			memcpy(&n, parser.get_message() + FRAME_HEADER_SIZE - sizeof(n), sizeof(n));
+			if (n <= PKT_SIZE && len == (int)(FRAME_HEADER_SIZE + n + CHECK_SIZE)) {
+				connect_pending = false;
+				return len;
+			}
 		}
 	}
 	return 0;
@@ -44,32 +57,87 @@ int PhysicalLayer::read_frames(unsigned char* buff, unsigned int len) {
 
 
 /**
- * We wait until there is space in the serial TX buffer to write a frame.
- * When the space is available we write a frame 
- * and return the number of bytes written.
+ * Write a one byte control message.
+ */
+int PhysicalLayer::send_control(unsigned char c) {
+	unsigned char encoded[COBS_MAX_SIZE(1)];
+	unsigned int n = FrameParser::encode(&c, 1, encoded);
+	return Serial.write(encoded, n);
+}
+
+
+/**
+ * Read as many frames as possible, any partial frame stays in the parser.
+ */
+int PhysicalLayer::read_frames(unsigned char* buff, unsigned int len) {
+	unsigned int nread = 0;
+	int n;
+
+	while (nread + sizeof(frame) <= len && (n = next_message()) > 0) {
+		from_wire((frame*)(buff + nread), parser.get_message(), n);
+		nread = nread + sizeof(frame);
+	}
+	return nread;
+}
+
+
+/**
+ * The check follows the payload on the wire.
+ */
+void PhysicalLayer::from_wire(frame* f, const unsigned char* message, unsigned int len) {
+	memcpy(FRAME_BYTES(f), message, len - CHECK_SIZE);
+
+	f->checksum = 0;
+	for (unsigned int i = 0; i < CHECK_SIZE; i++)
+		f->checksum = f->checksum | ((uint32_t)message[len - CHECK_SIZE + i] << (8 * i));
+}
+
+
+unsigned int PhysicalLayer::to_wire(frame* f, unsigned char* dst) {
+	unsigned int len = FRAME_SIZE(f);
+
+	memcpy(dst, FRAME_BYTES(f), len);
+	for (unsigned int i = 0; i < CHECK_SIZE; i++)
+		dst[len++] = (f->checksum >> (8 * i)) & 0xff;
+	return len;
+}
+
+
+/**
+ * Every frame is COBS encoded and written with its delimiter,
+ * only the used part of the payload.
  */
 int PhysicalLayer::write_frames(unsigned char* buff, unsigned int len) {
-	if (len > 0) {
-		//while (Serial.availableForWrite() < len);
-		unsigned int i = 0;
-		while (i < len) {
-			Serial.write(buff[i]);
-			i++;
-		}
-		return i;
+	unsigned char wire[sizeof(frame)];
+	unsigned char encoded[COBS_MAX_SIZE(sizeof(frame))];
+	unsigned int i = 0;
+
+	while (i + sizeof(frame) <= len) {
+		unsigned int n = to_wire((frame*)(buff + i), wire);
+		n = FrameParser::encode(wire, n, encoded);
+		Serial.write(encoded, n);
+		i = i + sizeof(frame);
 	}
-	return 0;
+	return i;
 }
 
 
 /**
  * Init the serial connection using HardwareSerial.
- * Set the serial the baudrate given by user and flush
- * the RX serial buffer with a timeout.
+ * Set the serial the baudrate given by user, drop what arrived
+ * during the boot and tell the PC that we are running.
  */
 int PhysicalLayer::init(unsigned long baudrate) {
 	Serial.begin(baudrate);
-	flush(1);
+	connects = 0;
+	connect_pending = false;
+
+	while (Serial.available() > 0)
+		Serial.read();
+	parser.reset();
+
+	send_control(READY);
+
 	if (Serial)
 		return 1;
 	return -1;
@@ -82,17 +150,17 @@ int PhysicalLayer::init(unsigned long baudrate) {
  */
 int PhysicalLayer::connect(char type) {
 	if (type == 's') {
-		if (Serial.available() > 0) {
-			char c = Serial.read();
-			if (c == CONNECT)
-				return 1;
-		}
-		return 0;
+		// frames before the connect message are from the previous transfer
+		while (connects == 0 && next_message() > 0);
+		if (connects == 0)
+			return 0;
+		connects--;
+		return 1;
 	} else if (type == 'r'){
-		//if (Serial.availableForWrite() > 0) {
-		if (Serial.write(CONNECT) > 0)
+		if (send_control(CONNECT) > 0) {
+			connect_pending = true;
 			return 1;
-		//}
+		}
 	}
 	return 0;
 }
@@ -136,4 +204,5 @@ void PhysicalLayer::flush(unsigned long timeout) {
 	while (get_tick() - startTime < timeout);
 
 	read_bytes(trash, sizeof(trash));
+	parser.reset();
 }
@@ -5,36 +5,67 @@
 
 #include <string.h>
 #include "Arduino.h"
+#include "FrameParser.h"
+#include "Crc.h"
 
-// determines packet size in bytes
-#define PKT_SIZE	1
+// max payload of a frame in bytes, one LED command
+#ifndef PKT_SIZE
+#define PKT_SIZE	4
+#endif
 
 #define CONNECT		73
 
+// readiness handshake with the PC: it sends PROBE until we answer READY
+#define PROBE		80
+#define READY		82
+
 
-// packet definition
-typedef struct {
+// packet definition, only the first len bytes of data are used
+typedef struct __attribute__((packed)) {
+	unsigned short len;		// payload length
 	unsigned char data[PKT_SIZE];
 } packet;
 
 
-// frames are transported in this layer
-typedef struct {
+// sequence and ack numbers, 16 bit on the wire
+typedef unsigned short seq_nr;
+
+
+// frames are transported in this layer (packed, as on the PC)
+// on the wire a frame is kind to info.len bytes of payload, then
+// CHECK_SIZE bytes of check, little endian
+typedef struct __attribute__((packed)) {
+	uint32_t checksum;		// check of the frame, sent after the payload
 	unsigned char kind;		// what kind of frame is it?
-	unsigned char seq;		// sequence number
-	unsigned char ack;		// acknowledgement number
+	seq_nr seq;				// sequence number
+	seq_nr ack;				// acknowledgement number
 	packet info;			// the network layer packet
-	unsigned char checksum;
 } frame;
 
+#define FRAME_HEADER_SIZE	(sizeof(frame) - sizeof(uint32_t) - PKT_SIZE)
+#define FRAME_SIZE(f)		(FRAME_HEADER_SIZE + (f)->info.len)
+#define FRAME_BYTES(f)		((unsigned char*)&(f)->kind)
+
+static_assert(FRAME_HEADER_SIZE + PKT_SIZE + CHECK_SIZE <= MAX_MESSAGE_SIZE, "MAX_MESSAGE_SIZE too small for PKT_SIZE");
+
 
 //static bool is_connected __attribute__ ((section (".noinit")));
 
 
+// Frames are COBS encoded on the wire, like on the PC side
 class PhysicalLayer {
 	private:
+		FrameParser parser;					// decoder of the received bytes
+		unsigned int connects;				// connect messages not consumed yet
+		bool connect_pending;				// connect sent, no frame received since
+
+		// Parse the available bytes until a frame is complete, return its size or 0
+		int next_message();
+		int send_control(unsigned char c);
 		int read_bytes(unsigned char* buff, unsigned int len);
 		int read_frames(unsigned char* buff, unsigned int len);
+		void from_wire(frame* f, const unsigned char* message, unsigned int len);
+		unsigned int to_wire(frame* f, unsigned char* dst);
 		int write_frames(unsigned char* buff, unsigned int len);
 
 	public:
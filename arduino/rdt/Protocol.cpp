@@ -6,17 +6,17 @@
 // UTILITY FUNCTION
 // ----------------------------------------------------------------------------
 
-bool Protocol::between(unsigned char a, unsigned char b, unsigned char c) {
+bool Protocol::between(seq_nr a, seq_nr b, seq_nr c) {
 	return ((a <= b) && (b < c)) || ((c < a) && (a <= b)) || ((b < c) && (c < a));
 }
 
 
-void Protocol::set_max_seqnr(unsigned char max_seqnr) {
+void Protocol::set_max_seqnr(seq_nr max_seqnr) {
 	oldest_frame = max_seqnr;
 }
 
 
-unsigned char Protocol::get_timedout_seqnr(void) {
+seq_nr Protocol::get_timedout_seqnr(void) {
 	return oldest_frame;
 }
 
@@ -37,14 +37,14 @@ void Protocol::disable_protocol(void) {
 }
 
 
-void Protocol::set_up(unsigned char max_seqnr, unsigned long timeout, int state) {
+void Protocol::set_up(seq_nr max_seqnr, unsigned long timeout, int state) {
 	if (state == 0)
 		disable_protocol();
 	else
 		enable_protocol();
 	offset = 0;
 	for (int i = 0; i < WINDOW_SIZE; i++) {
-		seqs[i] = MAX_SEQ + 1;
+		seqs[i] = MAX_SEQ;
 		ack_timer[i] = 0;
 		error[i] = false;
 	}
@@ -62,27 +62,35 @@ void Protocol::set_up(unsigned char max_seqnr, unsigned long timeout, int state)
 }
 
 
+/**
+ * Next message of a session: keep the queued frames and the timers.
+ */
+void Protocol::next_message(unsigned long timeout, int state) {
+	if (state == 0)
+		disable_protocol();
+	else
+		enable_protocol();
+	offset = 0;
+
+	set_timeout(timeout);
+	next_pkt_fetch = 0;
+	last_pkt_given = 0;
+}
+
+
 
 // ----------------------------------------------------------------------------
 // CHECKSUM FUNCTION
 // ----------------------------------------------------------------------------
-unsigned char Protocol::compute_checksum(unsigned char data[], unsigned int num_bytes) {
-	unsigned char sum = 0;
-	for (unsigned int i = 0; i < num_bytes; i++) {
-		sum += data[i];
-	}
-	return ~sum + 1;
+// The check covers all the bytes on the wire, acks included.
+uint32_t Protocol::compute_checksum(frame* f) {
+	return Crc::compute(FRAME_BYTES(f), FRAME_SIZE(f));
 }
 
 
 
-unsigned char Protocol::verify_checksum(unsigned char data[], unsigned int num_bytes, unsigned char checksum) {
-	unsigned char sum = 0;
-	for (unsigned int i = 0; i < num_bytes; i++) {
-		sum += data[i];
-	}
-	sum += checksum;
-	return sum;
+int Protocol::verify_checksum(frame* f) {
+	return compute_checksum(f) != f->checksum;
 }
 
 
@@ -178,7 +186,7 @@ event_type Protocol::dequeue(void) {
 	if (last_frame.kind == DATA && error[last_frame.seq] == false) {
 		long r = random(10);
 		if (r % 3 == 0) {
-			for (unsigned int i = 0; i < PKT_SIZE; i++)
+			for (unsigned int i = 0; i < last_frame.info.len; i++)
 				last_frame.info.data[i] += 1;
 
 			error[last_frame.seq] = true;
@@ -189,12 +197,10 @@ event_type Protocol::dequeue(void) {
 	}
 	*/
 	// --------------------------------------------------------------------- //
-	if (last_frame.kind == DATA) {
-		if (verify_checksum(last_frame.info.data, sizeof(last_frame.info.data), last_frame.checksum) != 0)
-			event = cksum_err;
-		else
-			event = frame_arrival;
-	} else if (last_frame.kind == ACK || last_frame.kind == NAK) {
+	// a damaged ack must not move the window
+	if (verify_checksum(&last_frame) != 0) {
+		event = cksum_err;
+	} else if (last_frame.kind == DATA || last_frame.kind == ACK || last_frame.kind == NAK) {
 		event = frame_arrival;
 	} else {
 		event = no_event;
@@ -259,7 +265,7 @@ event_type Protocol::pick_event(void) {
 // ----------------------------------------------------------------------------
 
 // Start a timer for a data frame.
-void Protocol::start_timer(unsigned char seqnr) {
+void Protocol::start_timer(seq_nr seqnr) {
 	unsigned long current_time = physical_layer.get_tick();
 	ack_timer[seqnr % WINDOW_SIZE] = current_time + timeout_interval + offset;
 	offset++;
@@ -269,7 +275,7 @@ void Protocol::start_timer(unsigned char seqnr) {
 
 
 // Stop a data frame timer.
-void Protocol::stop_timer(unsigned char seqnr) {
+void Protocol::stop_timer(seq_nr seqnr) {
 	ack_timer[seqnr % WINDOW_SIZE] = 0;
 	// figure out which timer is now lowest
 	recalc_timers();
@@ -345,17 +351,20 @@ void Protocol::recalc_timers(void) {
 // ----------------------------------------------------------------------------
 
 // Fetch a packet from user for transmission on the channel
-// the user data is split into PKT_SIZE bytes data and send in a frame
-void Protocol::from_application_layer(unsigned char* data, packet* p) {
-	for (unsigned int i = 0; i < sizeof(p->data); i++)
-		p->data[i] = data[next_pkt_fetch++];
+// the user data is split into PKT_SIZE bytes data and send in a frame,
+// the tail in a shorter one
+void Protocol::from_application_layer(unsigned char* data, unsigned int len, packet* p) {
+	unsigned int n = 0;
+	while (n < sizeof(p->data) && next_pkt_fetch < len)
+		p->data[n++] = data[next_pkt_fetch++];
+	p->len = n;
 }
 
 
 // Deliver information from an inbound frame to the user layer.
-// the user receive buffer is filled frame by frame.
-void Protocol::to_application_layer(unsigned char* data, packet* p) {
-	for (unsigned int i = 0; i < sizeof(p->data); i++)
+// the user receive buffer is filled frame by frame, never beyond len.
+void Protocol::to_application_layer(unsigned char* data, unsigned int len, packet* p) {
+	for (unsigned int i = 0; i < p->len && last_pkt_given < len; i++)
 		data[last_pkt_given++] = p->data[i];
 }
 
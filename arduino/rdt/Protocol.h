@@ -4,14 +4,22 @@
 #include "PhysicalLayer.h"
 
 
-// maximum sequence number should be 2^n - 1
+// maximum sequence number should be 2^n - 1, up to 65535
+// The window is fixed at compile time here (RAM), build with e.g.
+// -DMAX_SEQ=31 and call set_window(16, 31) on the PC.
+#ifndef MAX_SEQ
 #define MAX_SEQ			7
+#endif
 
-// sender's/receiver's window size (this should be greater than half the number of sequence numbers)
+// sender's/receiver's window size (this should not be greater than half the number of sequence numbers)
+#ifndef WINDOW_SIZE
 #define WINDOW_SIZE		((MAX_SEQ + 1) / 2)
+#endif
 
 // max number of buffered frames
+#ifndef QUEUE_SIZE
 #define QUEUE_SIZE		(WINDOW_SIZE * 2)
+#endif
 
 // possible frame kind
 #define ACK		1
@@ -50,8 +58,8 @@ class Protocol {
 		unsigned long lowest_timer;						// lowest of the timers
 		unsigned long aux_timer;						// value of the auxiliary timer
 
-		unsigned char seqs[WINDOW_SIZE];				// last sequence number sent per timer
-		unsigned char oldest_frame;						// tells which frame timed out
+		seq_nr seqs[WINDOW_SIZE];						// last sequence number sent per timer
+		seq_nr oldest_frame;							// tells which frame timed out
 
 		// Incoming frames are buffered here for later processing
 		frame queue[QUEUE_SIZE];						// buffered incoming frames
@@ -62,21 +70,23 @@ class Protocol {
 		frame last_frame;								// arrive frames are kept here
 
 		unsigned long timeout_interval;					// timeout interval from user
-		unsigned char next_pkt_fetch;					// seq of next packet from user to fetch
-		unsigned char last_pkt_given;					// seq of last pkt delivered to user
+		unsigned int next_pkt_fetch;					// offset of next packet from user to fetch
+		unsigned int last_pkt_given;					// offset of last pkt delivered to user
 
 	public:
 
-		bool between(unsigned char a, unsigned char b, unsigned char c);
-		void set_max_seqnr(unsigned char max_seqnr);
-		unsigned char get_timedout_seqnr(void);
+		bool between(seq_nr a, seq_nr b, seq_nr c);
+		void set_max_seqnr(seq_nr max_seqnr);
+		seq_nr get_timedout_seqnr(void);
 		void set_timeout(unsigned long timeout);
 		void enable_protocol(void);
 		void disable_protocol(void);
-		void set_up(unsigned char max_seqnr, unsigned long timeout, int state);
+		void set_up(seq_nr max_seqnr, unsigned long timeout, int state);
+		void next_message(unsigned long timeout, int state);
 
-		unsigned char compute_checksum(unsigned char data[], unsigned int num_bytes);
-		unsigned char verify_checksum(unsigned char data[], unsigned int num_bytes, unsigned char checksum);
+		// Check of the whole frame (CHECK_TYPE), header included
+		uint32_t compute_checksum(frame* f);
+		int verify_checksum(frame* f);
 
 		int init(unsigned long baudrate);
 		int connect(char type);
@@ -93,18 +103,18 @@ class Protocol {
 		event_type pick_event(void);
 
 		// Timer function to manage timeout
-		void start_timer(unsigned char seqnr);
-		void stop_timer(unsigned char seqnr);
+		void start_timer(seq_nr seqnr);
+		void stop_timer(seq_nr seqnr);
 		void start_ack_timer(void);
 		void stop_ack_timer(void);
 		int check_timers(void);
 		int check_ack_timer(void);
 		void recalc_timers(void);
 
-		// Take MAX_PKT bytes from data and send it in a frame
-		void from_application_layer(unsigned char* data, packet* p);
-		// Insert inside user buffer a MAX_PKT bytes at time
-		void to_application_layer(unsigned char* data, packet* p);
+		// Take up to PKT_SIZE bytes from data (len bytes) and send it in a frame
+		void from_application_layer(unsigned char* data, unsigned int len, packet* p);
+		// Insert inside user buffer (len bytes) the payload of a frame
+		void to_application_layer(unsigned char* data, unsigned int len, packet* p);
 		// Take last frame extracted by the queue
 		void from_physical_layer(frame* f);
 		// Write on physical file descriptor the frame
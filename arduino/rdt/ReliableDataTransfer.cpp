@@ -6,27 +6,64 @@
 // ------------------------------------------------------------------------- //
 
 void ReliableDataTransfer::set_up(int len) {
-	no_nak = true;
 	this->end = false;
 	not_expected = false;
 
+	length = len > 0 ? len : 0;
+
+	// the last frame carries the tail, an empty message one empty frame
+	if (length == 0)
+		nframes = 1;
+	else
+		nframes = (length + PKT_SIZE - 1) / PKT_SIZE;
+
+	last_frame_recv = 0;
+	last_frame_send = 0;
+}
+
+
+
+/**
+ * Back to sequence number 0, only for the first message of a session.
+ */
+void ReliableDataTransfer::reset_windows() {
+	no_nak = true;
+
 	ack_expected = 0;			// next ack expected on the inbound stream
 	next_frame_to_send = 0;		// number of next outgoing frame
 	frame_expected = 0;			// frame number expected
 	too_far = WINDOW_SIZE;		//receiver's upper window + 1
 
 	nbuffered = 0;				// initially no packets are buffered
+	dup_acks = 0;
+	gone_back = MAX_SEQ + 1;
 
 	for (int i = 0; i < WINDOW_SIZE; i++)
 		arrived[i] = false;
+}
 
-	if (len < PKT_SIZE)
-		nframes = 1;
-	else
-		nframes = len / PKT_SIZE;
 
-	last_frame_recv = 0;
-	last_frame_send = 0;
+
+/**
+ * Pass the in order frames to the user, but not beyond the current message.
+ */
+void ReliableDataTransfer::deliver(unsigned char* buff) {
+	while (receiving && last_frame_recv < nframes && arrived[frame_expected % WINDOW_SIZE]) {
+		///< Pass frames and advance window. 
+		protocol.to_application_layer(buff, length, &in_buf[frame_expected % WINDOW_SIZE]);
+
+		no_nak = true;
+
+		arrived[frame_expected % WINDOW_SIZE] = false;
+		///< advance lower edge of receiver's window
+		inc(frame_expected);
+		///< advance upper edge of receiver's window
+		inc(too_far);
+		///< count total received data frame
+		last_frame_recv = last_frame_recv + 1;
+		///< to see if a separate ack is needed
+		protocol.start_ack_timer();
+	}
 }
 
 
@@ -40,7 +77,7 @@ int ReliableDataTransfer::connect(char type) {
 /**
  * Construct and send a data, ack, or nak frame.
  */
-void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr, unsigned char frame_expected, packet buffer[]) {
+void ReliableDataTransfer::send_frame(unsigned char fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[]) {
 	frame f;
 
 	///< kind == data, ack, or nak
@@ -49,8 +86,12 @@ void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr,
 	f.seq = frame_nr;
 	f.ack = (frame_expected + MAX_SEQ) % (MAX_SEQ + 1);
 
-	f.info = buffer[frame_nr % WINDOW_SIZE];
-	f.checksum = protocol.compute_checksum(f.info.data, sizeof(f.info.data));
+	///< only data frames carry a payload
+	if (fk == DATA)
+		f.info = buffer[frame_nr % WINDOW_SIZE];
+	else
+		f.info.len = 0;
+	f.checksum = protocol.compute_checksum(&f);
 
 	///< one nak per frame, please
 	if (fk == NAK)
@@ -63,6 +104,7 @@ void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr,
 
 	///< no need for separate ack frame
 	protocol.stop_ack_timer();
+	unacked = 0;
 
 }
 
@@ -83,7 +125,7 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 			///< expand the window
 			nbuffered = nbuffered + 1;
 			///< fecth data from user (divide user data in 4 bytes frame)
-			protocol.from_application_layer(buff, &out_buf[next_frame_to_send % WINDOW_SIZE]);
+			protocol.from_application_layer(buff, length, &out_buf[next_frame_to_send % WINDOW_SIZE]);
 			///< transmit the frame
 			send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
 			///< advance upper window edge
@@ -117,22 +159,7 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 					///< insert data into buffer
 					in_buf[r.seq % WINDOW_SIZE] = r.info;
 
-					while (arrived[frame_expected % WINDOW_SIZE]) {
-						///< Pass frames and advance window. 
-						protocol.to_application_layer(buff, &in_buf[frame_expected % WINDOW_SIZE]);
-
-						no_nak = true;
-
-						arrived[frame_expected % WINDOW_SIZE] = false;
-						///< advance lower edge of receiver's window
-						inc(frame_expected);
-						///< advance upper edge of receiver's window
-						inc(too_far);
-						///< count total received data frame
-						last_frame_recv = last_frame_recv + 1;
-						///< to see if a separate ack is needed
-						protocol.start_ack_timer();
-					}
+					deliver(buff);
 				}
 
 				//if (not_expected && last_frame_recv == nframes)
@@ -192,6 +219,24 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 }
 
 
+/**
+ * Send the window again, on a timeout or a nak. Once per position of
+ * the window: the frames already on the way come back as duplicate acks.
+ */
+void ReliableDataTransfer::go_back() {
+	///< start retransmitting here
+	next_frame_to_send = ack_expected;
+	for (unsigned int i = 0; i < nbuffered; i++) {
+		///< resend 1 frame
+		send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
+		///< prepare to send the next one
+		inc(next_frame_to_send);
+	}
+	gone_back = ack_expected;
+	dup_acks = 0;
+}
+
+
 /**
  * Go Back N implementations. Only one window, sender side is needed
  * to realize a reliable data transfer.
@@ -206,7 +251,7 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 			///< expand the sender's window
 			nbuffered = nbuffered + 1;
 			///< fecth data from user (divide user data in 4 bytes frame)
-			protocol.from_application_layer(buff, &out_buf[next_frame_to_send % WINDOW_SIZE]);
+			protocol.from_application_layer(buff, length, &out_buf[next_frame_to_send % WINDOW_SIZE]);
 			///< transmit the frame
 			send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
 			///< advance sender's upper window edge
@@ -220,22 +265,37 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 			///< get incoming frame from physical layer
 			protocol.from_physical_layer(&r);
 
-			///< Frames are accepted only in order
-			if (r.seq == frame_expected) {
+			///< Frames are accepted only in order, and only by the receiver
+			if (receiving && last_frame_recv < nframes && r.kind == DATA && r.seq == frame_expected) {
 				///< insert data into buffer
 				in_buf[r.seq % WINDOW_SIZE] = r.info;
 				///< Pass frames and advance window.
-				protocol.to_application_layer(buff, &in_buf[frame_expected % WINDOW_SIZE]);
+				protocol.to_application_layer(buff, length, &in_buf[frame_expected % WINDOW_SIZE]);
 				///< advance lower edge of receiver's window
 				inc(frame_expected);
 
+				no_nak = true;
 				last_frame_recv = last_frame_recv + 1;
+				unacked = unacked + 1;
 
-				if ((r.seq % WINDOW_SIZE) == WINDOW_SIZE - 1)
+				///< ack every window frames and the tail of the message, the timer acks the rest
+				if (unacked >= WINDOW_SIZE || last_frame_recv == nframes)
 					send_frame(ACK, 0, frame_expected, out_buf);
+				else if (unacked == 1)
+					protocol.start_ack_timer();
+			} else if (receiving && r.kind == DATA) {
+				///< a gap or a copy: nak once, then repeat the ack
+				send_frame(no_nak ? NAK : ACK, 0, frame_expected, out_buf);
 			}
 
 			///< Ack n implies n - 1, n - 2, etc.  Check for this.
+			if (protocol.between(ack_expected, r.ack, next_frame_to_send)) {
+				dup_acks = 0;
+				gone_back = MAX_SEQ + 1;
+			} else if (r.kind == ACK && nbuffered > 0 && r.ack == (ack_expected + MAX_SEQ) % (MAX_SEQ + 1)) {
+				dup_acks = dup_acks + 1;
+			}
+
 			while (protocol.between(ack_expected, r.ack, next_frame_to_send)) {
 				///< Handle piggybacked ack (one frame fewer buffered)
 				nbuffered = nbuffered - 1;
@@ -247,23 +307,29 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 				last_frame_recv = last_frame_recv + 1;
 			}
 
+			///< the receiver lost the frame at ack_expected, do not wait for its timer
+			if (nbuffered > 0 && gone_back != ack_expected
+					&& (r.kind == NAK || (r.kind == ACK && dup_acks >= DUP_ACKS)))
+				go_back();
+
 			if (last_frame_recv == nframes)
 				end = true;
 			break;
 
+		///< damaged frame, for the receiver it was data
 		case cksum_err:
+			if (receiving && no_nak)
+				send_frame(NAK, 0, frame_expected, out_buf);
 			break;
 
 		///< trouble; retransmit all outstanding frames
 		case timeout:
-			///< start retransmitting here
-			next_frame_to_send = ack_expected;
-			for (unsigned int i = 0; i < nbuffered; i++) {
-				///< resend 1 frame
-				send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
-				///< prepare to send the next one
-				inc(next_frame_to_send);
-			}
+			go_back();
+			break;
+
+		///< frames in order still without ack
+		case ack_timeout:
+			send_frame(ACK, 0, frame_expected, out_buf);
 			break;
 
 		default:
@@ -288,9 +354,18 @@ int ReliableDataTransfer::init(const char* prot, unsigned long baudrate) {
 void ReliableDataTransfer::send(unsigned char* buff, int len, unsigned long timeout) {
 
 	this->set_up(len);
-	protocol.set_up((MAX_SEQ + 1), timeout, 1);
+	receiving = false;
+
+	if (session && connected) {
+		protocol.next_message(timeout, 1);
+	} else {
+		reset_windows();
+		protocol.set_up(MAX_SEQ, timeout, 1);
 
-	while (connect('s') < 1);
+		while (connect('s') < 1);
+
+		connected = session;
+	}
 
 	while (end == false) {
 		(this->*run)(buff);
@@ -306,9 +381,19 @@ void ReliableDataTransfer::send(unsigned char* buff, int len, unsigned long time
 void ReliableDataTransfer::recv(unsigned char* buff, int len, unsigned long timeout) {
 
 	this->set_up(len);
-	protocol.set_up((MAX_SEQ + 1), timeout, 0);
+	receiving = true;
+
+	if (session && connected) {
+		protocol.next_message(timeout, 0);
+		deliver(buff);
+	} else {
+		reset_windows();
+		protocol.set_up(MAX_SEQ, timeout, 0);
 
-	while (connect('r') < 1);
+		while (connect('r') < 1);
+
+		connected = session;
+	}
 
 	while (end == false) {
 		(this->*run)(buff);
@@ -319,6 +404,13 @@ void ReliableDataTransfer::recv(unsigned char* buff, int len, unsigned long time
 
 
 
+void ReliableDataTransfer::set_session(bool enable) {
+	session = enable;
+	connected = false;
+}
+
+
+
 int ReliableDataTransfer::close() {
 	return protocol.close();
 }
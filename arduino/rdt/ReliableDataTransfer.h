@@ -4,28 +4,39 @@
 
 #include "Protocol.h"
 
+// Duplicate acks that make go back n send the window again
+#define DUP_ACKS		3
+
 class ReliableDataTransfer {
 
 	private:
 		bool no_nak;						// no nak has been sent yet
 		bool not_expected;
 		bool end;							// To stop send and receive
+		bool receiving;						// true in recv(), false in send()
+
+		bool session = false;				// keep the connection across transfers
+		bool connected = false;				// the session handshake is done
 
-		unsigned char ack_expected;			// lower edge of sender's window
-		unsigned char next_frame_to_send;	// upper edge of sender's window + 1
-		unsigned char frame_expected;		// lower edge of receiver's window
-		unsigned char too_far;				// upper edge of receiver's window + 1
+		seq_nr ack_expected;				// lower edge of sender's window
+		seq_nr next_frame_to_send;			// upper edge of sender's window + 1
+		seq_nr frame_expected;				// lower edge of receiver's window
+		seq_nr too_far;						// upper edge of receiver's window + 1
 
 		frame r;							// scratch variable
 		packet out_buf[WINDOW_SIZE];		// buffers for the outbound stream
 		packet in_buf[WINDOW_SIZE];			// buffers for the inbound stream
 		bool arrived[WINDOW_SIZE];			// inbound bit map
 		unsigned int nbuffered;				// how many output buffers currently used
+		unsigned char dup_acks;				// acks in a row that did not move the window
+		seq_nr gone_back;					// ack_expected of the last go back, MAX_SEQ + 1 if none
+		unsigned char unacked = 0;			// frames in order since the last ack sent
 
 		event_type event;
 
 		Protocol protocol;
 
+		unsigned int length;				// Length of the user data
 		unsigned int nframes;				// Number of frames to send and receive
 		unsigned int last_frame_recv;		// Counter for frame received
 		unsigned int last_frame_send;		// Counter for frame send
@@ -33,9 +44,12 @@ class ReliableDataTransfer {
 		void (ReliableDataTransfer::*run)(unsigned char*);
 
 		void set_up(int len);
+		void reset_windows();
+		void deliver(unsigned char* buff);
 		int connect(char type);
-		void send_frame(unsigned char fk, unsigned char frame_nr, unsigned char frame_expected, packet buff[]);
+		void send_frame(unsigned char fk, seq_nr frame_nr, seq_nr frame_expected, packet buff[]);
 		void selective_repeat(unsigned char* buff);
+		void go_back();
 		void go_back_n(unsigned char* buff);
 
 	public:
@@ -43,6 +57,11 @@ class ReliableDataTransfer {
 		int init(const char* protocol, unsigned long baudrate);
 		void send(unsigned char* data, int len, unsigned long timeout);
 		void recv(unsigned char* data, int len, unsigned long timeout);
+
+		// Handshake only for the first transfer, then the sequence numbers
+		// continue across messages. The PC must enable it too.
+		void set_session(bool enable);
+
 		int close();
 };
 
@@ -48,6 +48,7 @@ void setup() {
 
 	// Init RDT
 	rdt.init(PROTOCOL, BAUDRATE);
+	rdt.set_session(true);
 
 	// Init Neopixel strip.
 	strip.begin();
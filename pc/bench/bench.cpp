@@ -0,0 +1,1682 @@
+
+// LOOPBACK BENCHMARK
+//
+// Runs a sender and a receiver in the same process, connected by one of
+// the loopback transports, and measures how long the transfers take.
+// The rdt prints on stdout, so the report goes on stderr:
+//
+//     ./bench -t socketpair -p "selective repeat" -n 1000 -s 4 > /dev/null
+//
+// Options:
+//     -b bench         transfer (default), goodput, bulk, udp, sack, fast, ack, fec, link, duplex, crc, timers or slip
+//     -t transport     socketpair, pty or udp
+//     -p protocol      "selective repeat" or "go back n"
+//     -n messages      number of messages
+//     -s size          size of a message in bytes (k and M suffixes)
+//     -T timeout       send timeout in us, cap of the retransmission timeout
+//     -R timeout       recv timeout in us
+//     -w mode          block or poll (how the protocol waits for events)
+//     -i idle          sender pause between messages in ms (idle link)
+//     -f framing       cobs or raw
+//     -x capacity      read each end in an RX thread, with a ring of capacity frames
+//     -S               session: one handshake, then sequence numbers continue
+//     -W window        window size in frames (the sequence space follows)
+//     -P payload       max payload of a data frame in bytes
+//     -c check         sum, crc16 or crc32: integrity check of the frames
+//     -L loss          probability that a frame to the receiver is lost
+//     -A               selective acks (selective repeat only)
+//     -F               no fast retransmit, timeouts only (go back n only)
+//     -N frames        ack every n frames in order (default a window)
+//     -D delay         ack delay in us (default half the recv timeout)
+//     -E frames        a parity frame every n data frames (selective repeat only)
+//     -B ber           bit error rate on the wire to the receiver (socketpair only)
+//     -I profile       simulated link to the receiver: clean, loss, burst, ber, delay,
+//                      jitter, reorder, duplicate or noisy (-L overrides the loss)
+//     -l file          write the trace of the frames of both ends in file
+//     -m file          export the link statistics of the sender in file every
+//                      100 ms during the transfer, JSON if file ends in .json,
+//                      else Prometheus text
+//
+// The trace is binary, tools/tracedump prints it:
+//
+//     ./bench -n 10 -l bench.trace > /dev/null; ../tools/tracedump -r bench.trace
+//
+// With the rdt built with TRACE_LEVEL=3 it also has the waits, timers and
+// handshakes, and tracedump -c turns it into a timeline for ui.perfetto.dev:
+//
+//     ../tools/tracedump -c bench.trace > bench.json
+//
+// The latency of a message is the time send() takes, from the handshake
+// (if any) to the last ack. Compare with and without -S:
+//
+//     ./bench -n 1000 > /dev/null; ./bench -n 1000 -S > /dev/null
+//
+// The goodput bench repeats the transfer with payloads from 1 byte to
+// MAX_PKT_SIZE and prints the goodput and the share of the wire bytes
+// that is user data, e.g. for 200 messages of 1 KB:
+//
+//     ./bench -b goodput -n 200 -s 1024 -W 16 > /dev/null
+//
+// The bulk bench moves one large message (16 MB by default) with a single
+// send() and recv(), with a 256 frames window and 512 bytes payloads
+// unless -W and -P say otherwise:
+//
+//     ./bench -b bulk -s 64M > /dev/null
+//
+// The data pattern does not repeat every 256 bytes, so a wrong offset
+// shows up as errors.
+//
+// The udp bench repeats a transfer over udp with the largest
+// payloads, so a batch of frames is a datagram of up to 34 KB, with
+// windows of 8, 64 and 256 frames: 20 messages of 64 KB in a session
+// unless -n, -s, -W and -P say otherwise:
+//
+//     ./bench -b udp > /dev/null
+//
+// The sack bench repeats a selective repeat transfer at loss rates from 0
+// to 10%, without and with selective acks, and compares the time lost to
+// recover: 200 messages of 16 KB in a session, 64 frames window and 256
+// bytes payloads unless -n, -s, -W and -P say otherwise:
+//
+//     ./bench -b sack > /dev/null
+//
+// The fast bench does the same with go back n up to 5%, with timeouts only
+// and with nak and fast retransmit, 50 messages unless -n says otherwise:
+//
+//     ./bench -b fast > /dev/null
+//
+// The ack bench repeats the transfer with the ack policies of the receiver,
+// from one ack per frame to one per window or ack delay, and compares the
+// ack frames per data frame with the time the sender waited with a full
+// window: 100 messages of 64 KB in a session, 64 frames window and 256
+// bytes payloads unless -n, -s, -W and -P say otherwise:
+//
+//     ./bench -b ack -p "go back n" > /dev/null
+//
+// The duplex bench sends -n commands of -s bytes (4 by default) that the
+// peer echoes, in a session: first in ping-pong, send() then recv() as the
+// LED client does, then with exchange() on both sides, the reply to a
+// command coming back with the next one. It prints the round trips per
+// second and the acks that rode on a data frame:
+//
+//     ./bench -b duplex -n 10000 > /dev/null
+//
+// The fec bench repeats a selective repeat transfer over a socketpair that
+// flips bits on the way to the receiver, at bit error rates from 0 to
+// 1e-4, without forward error correction and with a parity frame every 16
+// and 4 data frames, and compares the goodput: 200 messages of 16 KB in a
+// session, 64 frames window and 256 bytes payloads unless -n, -s, -W and
+// -P say otherwise:
+//
+//     ./bench -b fec > /dev/null
+//
+// The link bench repeats the transfer with selective repeat and go back n
+// over each simulated link of -I, and compares the time per message and
+// the tail latency: 200 messages of 4 KB in a session, 32 frames window
+// and 256 bytes payloads unless -n, -s, -W and -P say otherwise:
+//
+//     ./bench -b link > /dev/null
+//
+// The crc bench measures the cost per byte of the frame checks, for
+// buffers from a bare ack (7 bytes) to the largest frame, -n rounds each:
+//
+//     ./bench -b crc -n 100000
+//
+// The timers bench compares the timer wheel of the protocol with the linear
+// scan it replaced, for windows from 4 to 4096 frames, -n steps each. A step
+// acks the oldest frame and sends a new one (cancel, arm, check), then the
+// window times out frame by frame; the protocol row goes through
+// start_timer(), stop_timer() and check_timers() with the real clock:
+//
+//     ./bench -b timers -n 1000000
+//
+// The slip bench does not use any transport: it drops or inserts one byte
+// every -s frames in a stream of -n frames, decodes it with the chosen
+// framing and reports how many frames it takes to find the alignment again.
+
+#include <pthread.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/resource.h>
+
+#include "../rdt/include/ReliableDataTransfer.h"
+
+
+#define UDP_PORT_A			47001
+#define UDP_PORT_B			47002
+
+
+/**
+ * Benchmark parameters, from command line
+ */
+typedef struct {
+	const char* bench;
+	const char* transport;
+	const char* protocol;
+	int messages;
+	unsigned long long size;
+	unsigned long send_timeout;
+	unsigned long recv_timeout;
+	wait_mode mode;
+	int idle;
+	framing_type framing;
+	unsigned int ring;
+	bool session;
+	unsigned int window;
+	unsigned int payload;
+	check_type check;
+	double loss;
+	bool sack;
+	bool fast;
+	unsigned int ack_every;
+	unsigned long ack_delay;
+	unsigned int fec;
+	double ber;
+	const char* link;
+	const char* trace;
+	const char* metrics;
+} bench_args;
+
+
+/**
+ * A simulated link, by name
+ */
+typedef struct {
+	const char* name;
+	impairment_config config;
+} link_profile;
+
+
+/**
+ * The links of -I: loss, burst, ber, duplicate, reorder, delay, jitter, distribution, reorder delay.
+ * A frame held back longer than the sequence space takes to wrap would be
+ * taken for a new one by selective repeat, so the reordering stays short.
+ */
+const link_profile links[] = {
+	{"clean",		{0, 0, 0, 0, 0, 0, 0, jitter_uniform, 0}},
+	{"loss",		{0.01, 0, 0, 0, 0, 0, 0, jitter_uniform, 0}},
+	{"burst",		{0.01, 4, 0, 0, 0, 0, 0, jitter_uniform, 0}},
+	{"ber",			{0, 0, 1e-5, 0, 0, 0, 0, jitter_uniform, 0}},
+	{"delay",		{0, 0, 0, 0, 0, 1000, 200, jitter_uniform, 0}},
+	{"jitter",		{0, 0, 0, 0, 0, 1000, 500, jitter_exponential, 0}},
+	{"reorder",		{0, 0, 0, 0, 0.01, 0, 0, jitter_uniform, 100}},
+	{"duplicate",	{0, 0, 0, 0.01, 0, 0, 0, jitter_uniform, 0}},
+	{"noisy",		{0.005, 2, 1e-6, 0.001, 0.005, 500, 200, jitter_exponential, 100}},
+};
+const unsigned int nlinks = sizeof(links) / sizeof(links[0]);
+
+
+/**
+ * Result of a transfer
+ */
+typedef struct {
+	unsigned long long elapsed;			///< wall time, us
+	unsigned long long cpu;				///< CPU time of the process, us
+	unsigned long long frames;			///< frames sent by the sender
+	unsigned long long wire_bytes;		///< bytes written by both ends
+	double write_size;					///< mean bytes per write of the sender, a datagram on udp
+	unsigned long long bad_frames;		///< frames the receiver could not parse
+	unsigned long long max_latency;		///< slowest message, us
+	unsigned long long p99_latency;		///< 99th percentile of the messages, us
+	unsigned long long timeouts;		///< retransmission timeouts of the sender
+	unsigned long long lost;			///< frames dropped by -L or -I
+	impairment_stats link;				///< what the simulated link did to the frames
+	ack_stats acks;						///< acks of the receiver, stalls of the sender
+	fec_stats fec;						///< parity frames of the sender, frames rebuilt by the receiver
+	int errors;							///< bytes received wrong
+} transfer_result;
+
+
+/**
+ * Receiver side, runs in its own thread
+ */
+typedef struct {
+	ReliableDataTransfer* rdt;
+	bench_args* args;
+	int errors;
+} receiver_args;
+
+
+/**
+ * Monitor of the link statistics, runs in its own thread
+ */
+typedef struct {
+	ReliableDataTransfer* rdt;
+	const char* path;
+	export_format format;
+	std::atomic<bool> running;
+} monitor_args;
+
+
+unsigned long long now_us() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+
+/**
+ * User + system CPU time of the whole process
+ */
+unsigned long long cpu_us() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+
+void print_wait_stats(const char* name, wait_stats stats) {
+	fprintf(stderr, "%s: polls = %llu, waits = %llu (read %llu, timer %llu), blocked = %llu us, "
+		"timer latency avg = %.1f us max = %llu us\n",
+		name, stats.polls, stats.waits, stats.read_wakeups, stats.timer_wakeups, stats.blocked,
+		stats.timer_wakeups ? (double)stats.latency / stats.timer_wakeups : 0.0, stats.max_latency);
+}
+
+
+void print_rtt_stats(const char* name, rtt_stats stats) {
+	fprintf(stderr, "%s: srtt = %llu us, rttvar = %llu us, rto = %llu us, samples = %llu, "
+		"karn = %llu, timeouts = %llu, backoff = %u\n",
+		name, stats.srtt, stats.rttvar, stats.rto, stats.samples, stats.ambiguous, stats.timeouts, stats.backoff);
+}
+
+
+/**
+ * Counters and round trip time histogram of the link
+ */
+void print_link_stats(const char* name, ReliableDataTransfer* rdt) {
+	link_snapshot* s = new link_snapshot;
+
+	rdt->get_link_stats(s);
+	fprintf(stderr, "%s: retransmits = %llu, discarded = %llu, cksum errors = %llu, "
+		"rtt p50 = %llu us, p99 = %llu us, p99.9 = %llu us, max = %llu us\n",
+		name, s->counters[link_retransmits], s->counters[link_data_discarded], s->counters[link_cksum_errors],
+		Histogram::percentile(&s->rtt, 0.5), Histogram::percentile(&s->rtt, 0.99),
+		Histogram::percentile(&s->rtt, 0.999), s->rtt.max);
+	delete s;
+}
+
+
+/**
+ * Control frames of the receiver, stalls of the sender
+ */
+void print_ack_stats(ack_stats receiver, ack_stats sender) {
+	fprintf(stderr, "receiver: data frames = %llu, acks = %llu (%llu delayed), naks = %llu, sacks = %llu, "
+		"%.3f per data frame, %llu piggybacked\n",
+		receiver.data_frames, receiver.acks, receiver.delayed, receiver.naks, receiver.sacks,
+		receiver.data_frames ? (double)(receiver.acks + receiver.naks + receiver.sacks) / receiver.data_frames : 0.0,
+		receiver.piggybacked);
+	fprintf(stderr, "sender: window full %llu times, %llu us\n", sender.stalls, sender.stalled);
+}
+
+
+void print_tx_stats(const char* name, tx_stats stats) {
+	fprintf(stderr, "%s: tx frames = %llu, writes = %llu, %.2f frames/write, %llu bytes\n",
+		name, stats.frames, stats.writes,
+		stats.writes ? (double)stats.frames / stats.writes : 0.0, stats.bytes);
+}
+
+
+void print_rx_stats(const char* name, rx_stats stats) {
+	fprintf(stderr, "%s: rx bytes = %llu, frames = %llu, bad frames = %llu, discarded = %llu bytes\n",
+		name, stats.bytes, stats.frames, stats.bad_frames, stats.discarded);
+}
+
+
+void print_ring_stats(const char* name, ring_stats stats) {
+	fprintf(stderr, "%s: ring capacity = %u, high water = %u, pushed = %llu, popped = %llu, drops = %llu\n",
+		name, stats.capacity, stats.high_water, stats.pushed, stats.popped, stats.drops);
+}
+
+
+int compare_ull(const void* a, const void* b) {
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return (x > y) - (x < y);
+}
+
+
+void print_latency(unsigned long long* latency, int n) {
+	unsigned long long sum = 0;
+
+	qsort(latency, n, sizeof(latency[0]), compare_ull);
+	for (int i = 0; i < n; i++)
+		sum = sum + latency[i];
+
+	fprintf(stderr, "latency: min = %llu us, avg = %.1f us, p50 = %llu us, p99 = %llu us, max = %llu us\n",
+		latency[0], (double)sum / n, latency[n / 2], latency[(n * 99) / 100], latency[n - 1]);
+}
+
+
+/**
+ * Find a link of -I by name
+ */
+const link_profile* find_link(const char* name) {
+	for (unsigned int i = 0; i < nlinks; i++) {
+		if (strcmp(links[i].name, name) == 0)
+			return &links[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * Byte j of message i, the pattern does not repeat with short periods
+ */
+unsigned char pattern(int i, unsigned long long j) {
+	unsigned long long x = (j ^ (j >> 29)) + i;
+	return (unsigned char)((x * 0x9E3779B97F4A7C15ULL) >> 56);
+}
+
+
+/**
+ * Parse a size with an optional k or M suffix
+ */
+unsigned long long parse_size(const char* str) {
+	char* end;
+	unsigned long long size = strtoull(str, &end, 10);
+
+	if (*end == 'k' || *end == 'K')
+		size = size * 1024;
+	else if (*end == 'm' || *end == 'M')
+		size = size * 1024 * 1024;
+	return size;
+}
+
+
+/**
+ * Export the statistics every 100 ms while the transfer goes on
+ */
+void* monitor(void* arg) {
+	monitor_args* m = (monitor_args*)arg;
+
+	while (m->running.load()) {
+		if (m->rdt->export_link_stats(m->path, m->format) < 0)
+			fprintf(stderr, "Error in export link stats\n");
+		usleep(100000);
+	}
+	return NULL;
+}
+
+
+void* receiver(void* arg) {
+	receiver_args* r = (receiver_args*)arg;
+	unsigned char* buffer = (unsigned char*)malloc(r->args->size);
+
+	for (int i = 0; i < r->args->messages; i++) {
+		r->rdt->recv(buffer, r->args->size, r->args->recv_timeout);
+
+		for (unsigned long long j = 0; j < r->args->size; j++) {
+			if (buffer[j] != pattern(i, j))
+				r->errors++;
+		}
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+
+/**
+ * Peer of the ping-pong pattern: receive a command, send it back
+ */
+void* echo_pingpong(void* arg) {
+	receiver_args* r = (receiver_args*)arg;
+	unsigned char* buffer = (unsigned char*)malloc(r->args->size);
+
+	for (int i = 0; i < r->args->messages; i++) {
+		r->rdt->recv(buffer, r->args->size, r->args->recv_timeout);
+
+		for (unsigned long long j = 0; j < r->args->size; j++) {
+			if (buffer[j] != pattern(i, j))
+				r->errors++;
+		}
+
+		r->rdt->send(buffer, r->args->size, r->args->send_timeout);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+
+/**
+ * Peer of the duplex pattern: each exchange receives a command and sends
+ * back the previous one, nothing the first time
+ */
+void* echo_duplex(void* arg) {
+	receiver_args* r = (receiver_args*)arg;
+	unsigned char* command = (unsigned char*)malloc(r->args->size);
+	unsigned char* reply = (unsigned char*)calloc(r->args->size, 1);
+
+	for (int i = 0; i < r->args->messages; i++) {
+		r->rdt->exchange(reply, r->args->size, command, r->args->size, r->args->send_timeout);
+
+		for (unsigned long long j = 0; j < r->args->size; j++) {
+			if (command[j] != pattern(i, j))
+				r->errors++;
+		}
+
+		unsigned char* swap = reply;
+		reply = command;
+		command = swap;
+	}
+
+	free(command);
+	free(reply);
+	return NULL;
+}
+
+
+/**
+ * Socketpair end that flips bits at random in what it writes, a noisy
+ * line. The distance between two errors is drawn from the geometric
+ * distribution, so the cost does not depend on the bit error rate.
+ */
+class NoisyTransport : public SocketPairTransport {
+
+	private:
+		double ber;
+		unsigned int seed = 1;
+		unsigned long long next_error;		///< bits before the next error
+		unsigned char* noisy = NULL;
+		unsigned int size = 0;
+
+		void draw() {
+			double u = (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+			next_error = (unsigned long long)(log(u) / log(1.0 - ber));
+		}
+
+	public:
+		unsigned long long flipped = 0;
+
+		NoisyTransport(double ber) : ber(ber) {
+			draw();
+		}
+
+		~NoisyTransport() {
+			free(noisy);
+		}
+
+		int write(unsigned char* buff, unsigned int len) {
+			if (len > size) {
+				noisy = (unsigned char*)realloc(noisy, len);
+				size = len;
+			}
+			memcpy(noisy, buff, len);
+
+			unsigned long long bits = 8ULL * len;
+			unsigned long long bit = 0;
+			while (next_error < bits - bit) {
+				bit = bit + next_error;
+				noisy[bit / 8] ^= 1 << (bit % 8);
+				flipped++;
+				bit = bit + 1;
+				draw();
+			}
+			next_error = next_error - (bits - bit);
+
+			return SocketPairTransport::write(noisy, len);
+		}
+};
+
+
+/**
+ * Open the two ends of the chosen transport
+ */
+int open_pair(bench_args* args, ReliableDataTransfer* a, ReliableDataTransfer* b) {
+	if (args->ber > 0 && strcmp(args->transport, "socketpair") != 0) {
+		fprintf(stderr, "Bit errors need the socketpair transport\n");
+		return -1;
+	}
+
+	if (strcmp(args->transport, "socketpair") == 0) {
+		SocketPairTransport* ta = args->ber > 0 ? new NoisyTransport(args->ber) : new SocketPairTransport();
+		SocketPairTransport* tb = new SocketPairTransport();
+		if (SocketPairTransport::pair(ta, tb) < 0)
+			return -1;
+		if (a->init(ta, args->protocol) < 0 || b->init(tb, args->protocol) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (strcmp(args->transport, "pty") == 0) {
+		PtyTransport* ta = new PtyTransport();
+		if (a->init(ta, args->protocol) < 0)
+			return -1;
+		PtyTransport* tb = new PtyTransport(ta->get_peer_name());
+		if (b->init(tb, args->protocol) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (strcmp(args->transport, "udp") == 0) {
+		UdpTransport* ta = new UdpTransport(UDP_PORT_A, UDP_PORT_B);
+		UdpTransport* tb = new UdpTransport(UDP_PORT_B, UDP_PORT_A);
+		if (a->init(ta, args->protocol) < 0 || b->init(tb, args->protocol) < 0)
+			return -1;
+		return 0;
+	}
+
+	fprintf(stderr, "Unknown transport: %s\n", args->transport);
+	return -1;
+}
+
+
+/**
+ * Apply the options to both ends, the loss only to b
+ */
+int configure_pair(bench_args* args, ReliableDataTransfer* a, ReliableDataTransfer* b) {
+	a->set_wait_mode(args->mode);
+	b->set_wait_mode(args->mode);
+	a->set_framing(args->framing);
+	b->set_framing(args->framing);
+	a->set_check(args->check);
+	b->set_check(args->check);
+
+	if (args->window > 0 && (a->set_window(args->window) < 0 || b->set_window(args->window) < 0)) {
+		fprintf(stderr, "Error in set window\n");
+		return -1;
+	}
+
+	if (args->payload > 0 && (a->set_payload_size(args->payload) < 0 || b->set_payload_size(args->payload) < 0)) {
+		fprintf(stderr, "Error in set payload size\n");
+		return -1;
+	}
+
+	a->set_session(args->session);
+	b->set_session(args->session);
+	a->set_sack(args->sack);
+	b->set_sack(args->sack);
+	a->set_fast_retransmit(args->fast);
+	b->set_fast_retransmit(args->fast);
+
+	if (a->set_fec(args->fec) < 0 || b->set_fec(args->fec) < 0) {
+		fprintf(stderr, "Error in set fec\n");
+		return -1;
+	}
+
+	a->set_ack_every(args->ack_every);
+	b->set_ack_every(args->ack_every);
+	a->set_ack_delay(args->ack_delay);
+	b->set_ack_delay(args->ack_delay);
+	///< the acks are not lost: nothing would send the last one again
+	if (args->link != NULL) {
+		const link_profile* link = find_link(args->link);
+		if (link == NULL) {
+			fprintf(stderr, "Unknown link %s\n", args->link);
+			return -1;
+		}
+		impairment_config config = link->config;
+		if (args->loss > 0)
+			config.loss = args->loss;
+		b->set_impairment(&config, 1);
+	} else {
+		b->set_loss(args->loss, 1);
+	}
+
+	if (args->ring > 0 && (a->start_rx_thread(args->ring) < 0 || b->start_rx_thread(args->ring) < 0)) {
+		fprintf(stderr, "Error in start RX thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Transfer -n messages of -s bytes from a sender to a receiver thread,
+ * print the full report if asked
+ */
+int run_transfer(bench_args* args, bool report, transfer_result* result) {
+	ReliableDataTransfer sender_rdt;
+	ReliableDataTransfer receiver_rdt;
+
+	if (open_pair(args, &sender_rdt, &receiver_rdt) < 0) {
+		fprintf(stderr, "Error in open rdt\n");
+		return 1;
+	}
+
+	if (configure_pair(args, &sender_rdt, &receiver_rdt) < 0)
+		return 1;
+
+	unsigned char* buffer = (unsigned char*)malloc(args->size);
+	unsigned long long* latency = (unsigned long long*)malloc(args->messages * sizeof(unsigned long long));
+
+	receiver_args r;
+	r.rdt = &receiver_rdt;
+	r.args = args;
+	r.errors = 0;
+
+	monitor_args m;
+	m.rdt = &sender_rdt;
+	m.path = args->metrics;
+	m.format = export_prometheus;
+	if (m.path != NULL && strlen(m.path) > 5 && strcmp(m.path + strlen(m.path) - 5, ".json") == 0)
+		m.format = export_json;
+	m.running = true;
+
+	pthread_t thread;
+	pthread_t monitor_thread;
+	unsigned long long start = now_us();
+	unsigned long long start_cpu = cpu_us();
+
+	pthread_create(&thread, NULL, receiver, &r);
+	if (args->metrics != NULL)
+		pthread_create(&monitor_thread, NULL, monitor, &m);
+
+	for (int i = 0; i < args->messages; i++) {
+		for (unsigned long long j = 0; j < args->size; j++)
+			buffer[j] = pattern(i, j);
+		unsigned long long sent = now_us();
+		sender_rdt.send(buffer, args->size, args->send_timeout);
+		latency[i] = now_us() - sent;
+		if (args->idle > 0)
+			usleep(args->idle * 1000);
+	}
+
+	pthread_join(thread, NULL);
+
+	unsigned long long elapsed = now_us() - start;
+	unsigned long long cpu = cpu_us() - start_cpu;
+
+	///< one more export, with the last message
+	if (args->metrics != NULL) {
+		m.running = false;
+		pthread_join(monitor_thread, NULL);
+		if (sender_rdt.export_link_stats(args->metrics, m.format) < 0)
+			fprintf(stderr, "Error in export link stats\n");
+	}
+
+	result->elapsed = elapsed;
+	result->cpu = cpu;
+	result->frames = sender_rdt.get_tx_stats().frames;
+	result->wire_bytes = sender_rdt.get_tx_stats().bytes + receiver_rdt.get_tx_stats().bytes;
+	result->write_size = sender_rdt.get_tx_stats().writes ?
+		(double)sender_rdt.get_tx_stats().bytes / sender_rdt.get_tx_stats().writes : 0.0;
+	result->bad_frames = receiver_rdt.get_rx_stats().bad_frames;
+	qsort(latency, args->messages, sizeof(latency[0]), compare_ull);
+	result->max_latency = latency[args->messages - 1];
+	result->p99_latency = latency[(args->messages * 99) / 100];
+	result->timeouts = sender_rdt.get_rtt_stats().timeouts;
+	result->lost = receiver_rdt.get_lost();
+	result->link = receiver_rdt.get_impairment_stats();
+	result->acks = receiver_rdt.get_ack_stats();
+	result->acks.stalls = sender_rdt.get_ack_stats().stalls;
+	result->acks.stalled = sender_rdt.get_ack_stats().stalled;
+	result->fec = sender_rdt.get_fec_stats();
+	result->fec.received = receiver_rdt.get_fec_stats().received;
+	result->fec.rebuilt = receiver_rdt.get_fec_stats().rebuilt;
+	result->errors = r.errors;
+
+	sender_rdt.close();
+	receiver_rdt.close();
+	free(buffer);
+
+	if (!report) {
+		free(latency);
+		return r.errors != 0;
+	}
+
+	fprintf(stderr, "transport = %s, protocol = %s, session = %s, window = %u, payload = %u\n",
+		args->transport, args->protocol, args->session ? "yes" : "no", args->window > 0 ? args->window : WINDOW_SIZE,
+		args->payload > 0 ? args->payload : PKT_SIZE);
+	if (args->loss > 0)
+		fprintf(stderr, "loss = %.2f%%, sack = %s, fast retransmit = %s, lost frames = %llu\n",
+			100.0 * args->loss, args->sack ? "yes" : "no", args->fast ? "yes" : "no", result->lost);
+	if (args->link != NULL)
+		fprintf(stderr, "link = %s: frames = %llu, lost = %llu, corrupted = %llu, duplicated = %llu, reordered = %llu, "
+			"overflows = %llu, high water = %u\n", args->link, result->link.frames, result->link.lost,
+			result->link.corrupted, result->link.duplicated, result->link.reordered, result->link.overflows,
+			result->link.high_water);
+	if (args->ber > 0 || args->fec > 0)
+		fprintf(stderr, "ber = %g, fec = %u, parity frames = %llu, received = %llu, rebuilt = %llu\n",
+			args->ber, args->fec, result->fec.parity, result->fec.received, result->fec.rebuilt);
+	fprintf(stderr, "messages = %d, size = %llu bytes, errors = %d\n", args->messages, args->size, r.errors);
+	fprintf(stderr, "elapsed = %llu us, %.1f us/message, %.1f bytes/s\n",
+		elapsed, (double)elapsed / args->messages,
+		(double)args->messages * args->size * 1000000.0 / elapsed);
+	print_latency(latency, args->messages);
+	fprintf(stderr, "wait = %s, cpu = %llu us (%.1f%% of one core)\n",
+		args->mode == wait_poll ? "poll" : "block", cpu, 100.0 * cpu / elapsed);
+	print_wait_stats("sender", sender_rdt.get_wait_stats());
+	print_wait_stats("receiver", receiver_rdt.get_wait_stats());
+	print_rtt_stats("sender", sender_rdt.get_rtt_stats());
+	print_ack_stats(receiver_rdt.get_ack_stats(), sender_rdt.get_ack_stats());
+	print_tx_stats("sender", sender_rdt.get_tx_stats());
+	print_tx_stats("receiver", receiver_rdt.get_tx_stats());
+	print_rx_stats("sender", sender_rdt.get_rx_stats());
+	print_rx_stats("receiver", receiver_rdt.get_rx_stats());
+	print_ring_stats("sender", sender_rdt.get_ring_stats());
+	print_ring_stats("receiver", receiver_rdt.get_ring_stats());
+	print_link_stats("sender", &sender_rdt);
+	print_link_stats("receiver", &receiver_rdt);
+	if (args->trace != NULL) {
+		trace_stats trace = rdt_trace.get_stats();
+		fprintf(stderr, "trace: capacity = %u, recorded = %llu, drops = %llu\n",
+			trace.capacity, trace.recorded, trace.drops);
+	}
+
+	free(latency);
+
+	return r.errors != 0;
+}
+
+
+/**
+ * One transfer with the full report
+ */
+int transfer_bench(bench_args* args) {
+	transfer_result result;
+	return run_transfer(args, true, &result);
+}
+
+
+/**
+ * The same transfer with payloads of 1, 2, 4 ... MAX_PKT_SIZE bytes.
+ * Efficiency is the user data over all the bytes written, acks included.
+ */
+int goodput_bench(bench_args* args) {
+	int ret = 0;
+
+	fprintf(stderr, "transport = %s, protocol = %s, session = %s, window = %u\n",
+		args->transport, args->protocol, args->session ? "yes" : "no", args->window > 0 ? args->window : WINDOW_SIZE);
+	fprintf(stderr, "messages = %d, size = %llu bytes\n", args->messages, args->size);
+	fprintf(stderr, "%8s %10s %12s %12s %14s %10s %7s\n",
+		"payload", "frames", "wire bytes", "elapsed us", "goodput B/s", "efficiency", "errors");
+
+	for (unsigned int payload = 1; payload <= MAX_PKT_SIZE; payload = payload * 2) {
+		transfer_result result;
+
+		args->payload = payload;
+		ret = run_transfer(args, false, &result) || ret;
+
+		double data = (double)args->messages * args->size;
+		fprintf(stderr, "%8u %10llu %12llu %12llu %14.1f %9.1f%% %7d\n",
+			payload, result.frames, result.wire_bytes, result.elapsed,
+			data * 1000000.0 / result.elapsed,
+			result.wire_bytes ? 100.0 * data / result.wire_bytes : 0.0, result.errors);
+	}
+
+	return ret;
+}
+
+
+/**
+ * One message of -s bytes, big window and payload by default.
+ * The full report, plus the throughput in MB/s.
+ */
+int bulk_bench(bench_args* args) {
+	transfer_result result;
+
+	args->messages = 1;
+	if (args->size == 0)
+		args->size = 16 * 1024 * 1024;
+	if (args->window == 0)
+		args->window = 256;
+	if (args->payload == 0)
+		args->payload = MAX_PKT_SIZE;
+
+	int ret = run_transfer(args, true, &result);
+
+	fprintf(stderr, "bulk: %llu bytes in %llu frames, %.2f MB/s, %.1f%% of the wire bytes are data\n",
+		args->size, result.frames, (double)args->size / result.elapsed,
+		result.wire_bytes ? 100.0 * args->size / result.wire_bytes : 0.0);
+	return ret;
+}
+
+
+/**
+ * Large payloads over udp: a flush writes the whole batch as one datagram,
+ * up to TX_BATCH frames, and the receiver must read it in one go. The
+ * windows from 8 frames to 256 make datagrams from a few KB to a full
+ * batch; a datagram cut by the reader shows up as bad frames and
+ * retransmissions.
+ */
+int udp_bench(bench_args* args) {
+	unsigned int windows[] = {8, 64, 256};
+	unsigned int nwindows = sizeof(windows) / sizeof(windows[0]);
+	int ret = 0;
+
+	args->transport = "udp";
+	args->session = true;
+	if (args->messages == 1000)
+		args->messages = 20;
+	if (args->size == 0)
+		args->size = 64 * 1024;
+	if (args->payload == 0)
+		args->payload = MAX_PKT_SIZE;
+	if (args->window > 0) {
+		windows[0] = args->window;
+		nwindows = 1;
+	}
+
+	fprintf(stderr, "transport = %s, protocol = %s, payload = %u, messages = %d of %llu bytes\n",
+		args->transport, args->protocol, args->payload, args->messages, args->size);
+	fprintf(stderr, "%8s %12s %12s %10s %12s %10s %9s %7s\n",
+		"window", "elapsed us", "goodput B/s", "frames", "bytes/write", "bad frames", "timeouts", "errors");
+
+	for (unsigned int i = 0; i < nwindows; i++) {
+		transfer_result result;
+
+		args->window = windows[i];
+		ret = run_transfer(args, false, &result) || ret;
+
+		fprintf(stderr, "%8u %12llu %12.0f %10llu %12.0f %10llu %9llu %7d\n",
+			windows[i], result.elapsed,
+			(double)args->messages * args->size * 1000000.0 / result.elapsed,
+			result.frames, result.write_size,
+			result.bad_frames, result.timeouts, result.errors);
+	}
+	return ret;
+}
+
+
+/**
+ * A protocol at growing loss rates, without and with one of the recovery
+ * options: selective acks for selective repeat, fast retransmit for go
+ * back n. The frames sent beyond the data frames are the retransmissions;
+ * the recovery time is the elapsed time over the one without loss.
+ */
+int loss_bench(bench_args* args) {
+	double rates[] = {0, 0.005, 0.01, 0.02, 0.05, 0.1};
+	unsigned int nrates = sizeof(rates) / sizeof(rates[0]);
+	int ret = 0;
+
+	bool fast = strcmp(args->bench, "fast") == 0;
+	bool* option = fast ? &args->fast : &args->sack;
+
+	///< without a session a late copy of a frame may end in the next message
+	args->protocol = fast ? "go back n" : "selective repeat";
+	args->session = true;
+	if (args->messages == 1000)
+		args->messages = fast ? 50 : 200;
+
+	///< go back n on timeouts alone takes seconds per message at 10%
+	if (fast)
+		nrates--;
+	if (args->size == 0)
+		args->size = 16 * 1024;
+	if (args->window == 0)
+		args->window = 64;
+	if (args->payload == 0)
+		args->payload = 256;
+
+	unsigned long long data_frames = args->messages * ((args->size + args->payload - 1) / args->payload);
+
+	fprintf(stderr, "transport = %s, protocol = %s, window = %u, payload = %u, messages = %d of %llu bytes, %llu data frames\n",
+		args->transport, args->protocol, args->window, args->payload, args->messages, args->size, data_frames);
+	fprintf(stderr, "%6s %5s %12s %10s %12s %12s %9s %9s %7s\n",
+		"loss", fast ? "fast" : "sack", "elapsed us", "recovery", "us/message", "max us", "resent", "timeouts", "errors");
+
+	unsigned long long base[2] = {0, 0};
+	for (unsigned int i = 0; i < nrates; i++) {
+		for (int s = 0; s < 2; s++) {
+			transfer_result result;
+
+			args->loss = rates[i];
+			*option = s;
+			ret = run_transfer(args, false, &result) || ret;
+
+			if (i == 0)
+				base[s] = result.elapsed;
+			fprintf(stderr, "%5.1f%% %5s %12llu %9.2fx %12.1f %12llu %9llu %9llu %7d\n",
+				100.0 * rates[i], s ? "yes" : "no", result.elapsed,
+				base[s] ? (double)result.elapsed / base[s] : 0.0,
+				(double)result.elapsed / args->messages, result.max_latency,
+				result.frames > data_frames ? result.frames - data_frames : 0,
+				result.timeouts, result.errors);
+		}
+	}
+	return ret;
+}
+
+
+/**
+ * The transfer with the ack policies from an ack per frame to an ack per
+ * window, then an ack per window or delay. Fewer acks cost stalls of the
+ * sender, when its window is full and the ack is kept back.
+ */
+int ack_bench(bench_args* args) {
+	unsigned int every[] = {1, 2, 4, 8, 16, 0, 0, 0, 0};
+	unsigned long delay[] = {0, 0, 0, 0, 0, 0, 50, 200, 1000};
+	unsigned int npolicies = sizeof(every) / sizeof(every[0]);
+	int ret = 0;
+
+	///< four windows per message, the sender stalls only if it has more to send
+	args->session = true;
+	if (args->messages == 1000)
+		args->messages = 100;
+	if (args->size == 0)
+		args->size = 64 * 1024;
+	if (args->window == 0)
+		args->window = 64;
+	if (args->payload == 0)
+		args->payload = 256;
+
+	fprintf(stderr, "transport = %s, protocol = %s, window = %u, payload = %u, messages = %d of %llu bytes\n",
+		args->transport, args->protocol, args->window, args->payload, args->messages, args->size);
+	fprintf(stderr, "%6s %9s %12s %12s %10s %8s %12s %9s %7s\n",
+		"every", "delay us", "elapsed us", "us/message", "acks", "per data", "stalled us", "timeouts", "errors");
+
+	for (unsigned int i = 0; i < npolicies; i++) {
+		transfer_result result;
+
+		args->ack_every = every[i];
+		args->ack_delay = delay[i];
+		ret = run_transfer(args, false, &result) || ret;
+
+		char n[16];
+		if (every[i] > 0)
+			snprintf(n, sizeof(n), "%u", every[i]);
+		else
+			snprintf(n, sizeof(n), "window");
+		unsigned long long control = result.acks.acks + result.acks.naks + result.acks.sacks;
+		fprintf(stderr, "%6s %9lu %12llu %12.1f %10llu %8.3f %12llu %9llu %7d\n",
+			n, delay[i], result.elapsed, (double)result.elapsed / args->messages, control,
+			result.acks.data_frames ? (double)control / result.acks.data_frames : 0.0,
+			result.acks.stalled, result.timeouts, result.errors);
+	}
+	return ret;
+}
+
+
+/**
+ * -n commands of -s bytes from a to b, each one echoed by b. In ping-pong
+ * a sends a command and waits for the reply, as the LED client does; in
+ * duplex the reply to command i - 1 comes back while command i goes out,
+ * and the data frames of each side carry the acks of the other.
+ */
+int run_round_trips(bench_args* args, bool duplex, transfer_result* result) {
+	ReliableDataTransfer a;
+	ReliableDataTransfer b;
+
+	if (open_pair(args, &a, &b) < 0) {
+		fprintf(stderr, "Error in open rdt\n");
+		return 1;
+	}
+
+	if (configure_pair(args, &a, &b) < 0)
+		return 1;
+
+	unsigned char* command = (unsigned char*)malloc(args->size);
+	unsigned char* reply = (unsigned char*)malloc(args->size);
+	unsigned long long* latency = (unsigned long long*)malloc(args->messages * sizeof(unsigned long long));
+
+	receiver_args r;
+	r.rdt = &b;
+	r.args = args;
+	r.errors = 0;
+
+	int errors = 0;
+	pthread_t thread;
+	unsigned long long start = now_us();
+
+	pthread_create(&thread, NULL, duplex ? echo_duplex : echo_pingpong, &r);
+
+	for (int i = 0; i < args->messages; i++) {
+		for (unsigned long long j = 0; j < args->size; j++)
+			command[j] = pattern(i, j);
+
+		unsigned long long sent = now_us();
+		if (duplex) {
+			a.exchange(command, args->size, reply, args->size, args->send_timeout);
+		} else {
+			a.send(command, args->size, args->send_timeout);
+			a.recv(reply, args->size, args->recv_timeout);
+		}
+		latency[i] = now_us() - sent;
+
+		///< the duplex reply is the echo of the previous command
+		int echoed = duplex ? i - 1 : i;
+		for (unsigned long long j = 0; echoed >= 0 && j < args->size; j++) {
+			if (reply[j] != pattern(echoed, j))
+				errors++;
+		}
+	}
+
+	pthread_join(thread, NULL);
+
+	result->elapsed = now_us() - start;
+	result->frames = a.get_tx_stats().frames + b.get_tx_stats().frames;
+	result->wire_bytes = a.get_tx_stats().bytes + b.get_tx_stats().bytes;
+	result->max_latency = 0;
+	for (int i = 0; i < args->messages; i++) {
+		if (latency[i] > result->max_latency)
+			result->max_latency = latency[i];
+	}
+	result->timeouts = a.get_rtt_stats().timeouts + b.get_rtt_stats().timeouts;
+	result->lost = b.get_lost();
+	ack_stats sa = a.get_ack_stats();
+	ack_stats sb = b.get_ack_stats();
+	result->acks = sb;
+	result->acks.acks += sa.acks;
+	result->acks.naks += sa.naks;
+	result->acks.sacks += sa.sacks;
+	result->acks.piggybacked += sa.piggybacked;
+	result->errors = errors + r.errors;
+
+	a.close();
+	b.close();
+	free(command);
+	free(reply);
+	free(latency);
+
+	return result->errors != 0;
+}
+
+
+/**
+ * Round trips of small commands, ping-pong against duplex
+ */
+int duplex_bench(bench_args* args) {
+	int ret = 0;
+
+	///< the handshake would cost more than the commands
+	args->session = true;
+
+	fprintf(stderr, "transport = %s, protocol = %s, window = %u, payload = %u, commands = %d of %llu bytes\n",
+		args->transport, args->protocol, args->window > 0 ? args->window : WINDOW_SIZE,
+		args->payload > 0 ? args->payload : PKT_SIZE, args->messages, args->size);
+	fprintf(stderr, "%9s %12s %12s %14s %10s %8s %12s %9s %7s\n",
+		"pattern", "elapsed us", "us/trip", "round trips/s", "frames", "acks", "piggybacked", "timeouts", "errors");
+
+	for (int d = 0; d < 2; d++) {
+		transfer_result result;
+
+		ret = run_round_trips(args, d, &result) || ret;
+
+		unsigned long long control = result.acks.acks + result.acks.naks + result.acks.sacks;
+		fprintf(stderr, "%9s %12llu %12.1f %14.1f %10llu %8llu %12llu %9llu %7d\n",
+			d ? "duplex" : "ping-pong", result.elapsed, (double)result.elapsed / args->messages,
+			args->messages * 1000000.0 / result.elapsed, result.frames, control,
+			result.acks.piggybacked, result.timeouts, result.errors);
+	}
+	return ret;
+}
+
+
+/**
+ * Selective repeat over a noisy line, without and with parity frames.
+ * The goodput is the user data over the elapsed time; a damaged frame
+ * costs a nak and a retransmission, or a timeout if it is the last one
+ * of the message, unless the parity rebuilds it.
+ */
+int fec_bench(bench_args* args) {
+	double bers[] = {0, 1e-6, 1e-5, 3e-5, 1e-4};
+	unsigned int nbers = sizeof(bers) / sizeof(bers[0]);
+	unsigned int groups[] = {0, 16, 4};
+	unsigned int ngroups = sizeof(groups) / sizeof(groups[0]);
+	int ret = 0;
+
+	///< as in the sack bench, a late copy must not end in the next message
+	args->protocol = "selective repeat";
+	args->transport = "socketpair";
+	args->session = true;
+	if (args->messages == 1000)
+		args->messages = 200;
+	if (args->size == 0)
+		args->size = 16 * 1024;
+	if (args->window == 0)
+		args->window = 64;
+	if (args->payload == 0)
+		args->payload = 256;
+
+	unsigned long long data_frames = args->messages * ((args->size + args->payload - 1) / args->payload);
+
+	fprintf(stderr, "transport = %s, protocol = %s, window = %u, payload = %u, messages = %d of %llu bytes, %llu data frames\n",
+		args->transport, args->protocol, args->window, args->payload, args->messages, args->size, data_frames);
+	fprintf(stderr, "%8s %4s %12s %12s %9s %9s %9s %9s %9s %7s\n",
+		"ber", "fec", "elapsed us", "goodput B/s", "vs ber 0", "resent", "parity", "rebuilt", "timeouts", "errors");
+
+	unsigned long long base[3] = {0, 0, 0};
+	for (unsigned int i = 0; i < nbers; i++) {
+		for (unsigned int g = 0; g < ngroups; g++) {
+			transfer_result result;
+
+			args->ber = bers[i];
+			args->fec = groups[g];
+			ret = run_transfer(args, false, &result) || ret;
+
+			if (i == 0)
+				base[g] = result.elapsed;
+			unsigned long long sent = data_frames + result.fec.parity;
+			fprintf(stderr, "%8g %4u %12llu %12.0f %8.2fx %9llu %9llu %9llu %9llu %7d\n",
+				bers[i], groups[g], result.elapsed,
+				(double)args->messages * args->size * 1000000.0 / result.elapsed,
+				base[g] ? (double)result.elapsed / base[g] : 0.0,
+				result.frames > sent ? result.frames - sent : 0,
+				result.fec.parity, result.fec.rebuilt, result.timeouts, result.errors);
+		}
+	}
+	return ret;
+}
+
+
+/**
+ * The same transfer with both protocols over each simulated link.
+ * The acks are not impaired, as with -L.
+ */
+int link_bench(bench_args* args) {
+	const char* protocols[] = {"selective repeat", "go back n"};
+	int ret = 0;
+
+	args->session = true;
+	if (args->messages == 1000)
+		args->messages = 200;
+	if (args->size == 0)
+		args->size = 4 * 1024;
+	if (args->window == 0)
+		args->window = 32;
+	if (args->payload == 0)
+		args->payload = 256;
+
+	fprintf(stderr, "transport = %s, window = %u, payload = %u, messages = %d of %llu bytes\n",
+		args->transport, args->window, args->payload, args->messages, args->size);
+	fprintf(stderr, "%-10s %-17s %12s %10s %10s %10s %6s %9s %9s %7s\n",
+		"link", "protocol", "elapsed us", "us/msg", "p99 us", "max us", "lost", "corrupted", "timeouts", "errors");
+
+	for (unsigned int i = 0; i < nlinks; i++) {
+		for (unsigned int p = 0; p < 2; p++) {
+			transfer_result result;
+
+			args->link = links[i].name;
+			args->protocol = protocols[p];
+			ret = run_transfer(args, false, &result) || ret;
+
+			fprintf(stderr, "%-10s %-17s %12llu %10.1f %10llu %10llu %6llu %9llu %9llu %7d\n",
+				links[i].name, protocols[p], result.elapsed, (double)result.elapsed / args->messages,
+				result.p99_latency, result.max_latency, result.link.lost, result.link.corrupted,
+				result.timeouts, result.errors);
+		}
+	}
+	return ret;
+}
+
+
+/**
+ * Time -n rounds of a check over len bytes, in ns per byte.
+ * The result is accumulated so the calls can not be optimized away.
+ */
+double time_check(uint32_t (*check)(const unsigned char*, size_t), const unsigned char* data,
+		size_t len, int rounds, uint32_t* sink) {
+	unsigned long long start = now_us();
+	for (int i = 0; i < rounds; i++)
+		*sink = *sink + check(data + (i & 7), len);
+	unsigned long long elapsed = now_us() - start;
+	return elapsed * 1000.0 / ((double)rounds * len);
+}
+
+
+uint32_t impl_sum8(const unsigned char* data, size_t len) { return Crc::sum8(data, len); }
+uint32_t impl_crc16_bytewise(const unsigned char* data, size_t len) { return Crc::crc16_bytewise(data, len); }
+uint32_t impl_crc16_slice8(const unsigned char* data, size_t len) { return Crc::crc16(data, len); }
+uint32_t impl_crc32_bytewise(const unsigned char* data, size_t len) { return Crc::crc32c_bytewise(data, len); }
+uint32_t impl_crc32_slice8(const unsigned char* data, size_t len) { return Crc::crc32c_slice8(data, len); }
+uint32_t impl_crc32_sse42(const unsigned char* data, size_t len) { return Crc::crc32c_sse42(data, len); }
+
+
+/**
+ * Cost per byte of every implementation of the checks, on buffers
+ * of the size of an ack, of small and of the largest frames.
+ * The offsets move by one byte per round, so the loads are not aligned.
+ */
+int crc_bench(bench_args* args) {
+	typedef struct {
+		const char* name;
+		uint32_t (*check)(const unsigned char*, size_t);
+	} check_impl;
+
+	check_impl impls[] = {
+		{"sum8", impl_sum8},
+		{"crc16 bytewise", impl_crc16_bytewise},
+		{"crc16 slice-by-8", impl_crc16_slice8},
+		{"crc32c bytewise", impl_crc32_bytewise},
+		{"crc32c slice-by-8", impl_crc32_slice8},
+		{"crc32c sse4.2", impl_crc32_sse42},
+	};
+	unsigned int sizes[] = {FRAME_HEADER_SIZE, FRAME_HEADER_SIZE + PKT_SIZE, 64, 256, FRAME_HEADER_SIZE + MAX_PKT_SIZE};
+	unsigned int nimpls = sizeof(impls) / sizeof(impls[0]);
+	unsigned int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+	unsigned char data[FRAME_HEADER_SIZE + MAX_PKT_SIZE + 8];
+	for (unsigned int i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	const unsigned char* vector = (const unsigned char*)"123456789";
+	if (Crc::crc16(vector, 9) != CRC16_CHECK || Crc::crc16_bytewise(vector, 9) != CRC16_CHECK ||
+		Crc::crc32c_slice8(vector, 9) != CRC32C_CHECK || Crc::crc32c_bytewise(vector, 9) != CRC32C_CHECK ||
+		Crc::crc32c(vector, 9) != CRC32C_CHECK) {
+		fprintf(stderr, "Wrong check value\n");
+		return 1;
+	}
+
+	fprintf(stderr, "rounds = %d, sse4.2 = %s, ns/byte:\n", args->messages, Crc::has_sse42() ? "yes" : "no");
+	fprintf(stderr, "%-18s", "bytes");
+	for (unsigned int j = 0; j < nsizes; j++)
+		fprintf(stderr, " %8u", sizes[j]);
+	fprintf(stderr, "\n");
+
+	uint32_t sink = 0;
+	for (unsigned int i = 0; i < nimpls; i++) {
+		if (impls[i].check == impl_crc32_sse42 && !Crc::has_sse42())
+			continue;
+		fprintf(stderr, "%-18s", impls[i].name);
+		for (unsigned int j = 0; j < nsizes; j++)
+			fprintf(stderr, " %8.3f", time_check(impls[i].check, data, sizes[j], args->messages, &sink));
+		fprintf(stderr, "\n");
+	}
+
+	return sink == 0xFFFFFFFF;
+}
+
+
+/**
+ * The retransmission timers before the wheel: after every change the
+ * lowest one is looked for again, O(window).
+ */
+typedef struct {
+	unsigned long long* timer;
+	unsigned long long lowest;
+	unsigned int window;
+} linear_timers;
+
+
+void linear_recalc(linear_timers* l) {
+	l->lowest = 0xffffffffffffffff;
+	for (unsigned int i = 0; i < l->window; i++) {
+		if (l->timer[i] > 0 && l->timer[i] < l->lowest)
+			l->lowest = l->timer[i];
+	}
+}
+
+
+void linear_arm(linear_timers* l, unsigned int i, unsigned long long deadline) {
+	l->timer[i] = deadline;
+	linear_recalc(l);
+}
+
+
+void linear_cancel(linear_timers* l, unsigned int i) {
+	l->timer[i] = 0;
+	linear_recalc(l);
+}
+
+
+int linear_expire(linear_timers* l, unsigned long long current_time) {
+	if (l->lowest == 0xffffffffffffffff || current_time < l->lowest)
+		return -1;
+	for (unsigned int i = 0; i < l->window; i++) {
+		if (l->timer[i] == l->lowest) {
+			l->timer[i] = 0;
+			linear_recalc(l);
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Sliding window on a virtual clock, one tick per step: the oldest frame
+ * is acked, a new one is sent with a timeout of a few windows, and the
+ * timers are checked. Then the whole window is sent again and times out
+ * frame by frame, one check each, for steps / window rounds.
+ * Times are in ns per step and per timeout (arm + expire).
+ */
+void time_timers(unsigned int window, int steps, double* wheel_step, double* wheel_expire,
+		double* linear_step, double* linear_expire_ns) {
+	unsigned long long start_time = 1000000;
+	unsigned long long timeout = 4ULL * window + 1000;
+	unsigned long long start;
+	int sink = 0;
+
+	TimerWheel wheel;
+	wheel.init(window, start_time);
+	for (unsigned int i = 0; i < window; i++)
+		wheel.arm(i, start_time + timeout + i);
+
+	start = now_us();
+	for (int k = 0; k < steps; k++) {
+		unsigned long long t = start_time + window + k;
+		wheel.cancel(k % window);
+		wheel.arm(k % window, t + timeout);
+		sink = sink + wheel.expire(t);
+	}
+	*wheel_step = (now_us() - start) * 1000.0 / steps;
+
+	int rounds = steps / window > 0 ? steps / window : 1;
+	unsigned long long t = start_time + window + steps + timeout;
+	start = now_us();
+	for (int r = 0; r < rounds; r++) {
+		for (unsigned int i = 0; i < window; i++)
+			wheel.arm(i, t + timeout + i);
+		t = t + timeout;
+		for (unsigned int i = 0; i < window; i++)
+			sink = sink + wheel.expire(t + i);
+	}
+	*wheel_expire = (now_us() - start) * 1000.0 / ((double)rounds * window);
+
+	linear_timers linear;
+	linear.window = window;
+	linear.timer = new unsigned long long[window];
+	for (unsigned int i = 0; i < window; i++)
+		linear.timer[i] = start_time + timeout + i;
+	linear_recalc(&linear);
+
+	///< the scan is slow, fewer steps for large windows
+	int linear_steps = steps / (1 + window / 64);
+	start = now_us();
+	for (int k = 0; k < linear_steps; k++) {
+		unsigned long long t = start_time + window + k;
+		linear_cancel(&linear, k % window);
+		linear_arm(&linear, k % window, t + timeout);
+		sink = sink + linear_expire(&linear, t);
+	}
+	*linear_step = (now_us() - start) * 1000.0 / (linear_steps > 0 ? linear_steps : 1);
+
+	int linear_rounds = rounds / (1 + window / 64) > 0 ? rounds / (1 + window / 64) : 1;
+	t = start_time + window + linear_steps + timeout;
+	start = now_us();
+	for (int r = 0; r < linear_rounds; r++) {
+		for (unsigned int i = 0; i < window; i++)
+			linear_arm(&linear, i, t + timeout + i);
+		t = t + timeout;
+		for (unsigned int i = 0; i < window; i++)
+			sink = sink + linear_expire(&linear, t + i);
+	}
+	*linear_expire_ns = (now_us() - start) * 1000.0 / ((double)linear_rounds * window);
+
+	delete[] linear.timer;
+	if (sink == 0x7fffffff)
+		fprintf(stderr, "\n");
+}
+
+
+/**
+ * The same steps through the timer API of the protocol, with the real
+ * clock: a timeout of one second never expires during the test.
+ */
+double time_protocol_timers(unsigned int window, int steps) {
+	Protocol protocol;
+	int sink = 0;
+
+	if (protocol.set_window(window, window * 2 - 1) < 0)
+		return 0;
+	protocol.set_up(window * 2 - 1, 1000000, 0);
+
+	for (unsigned int i = 0; i < window; i++)
+		protocol.start_timer(i);
+
+	unsigned long long start = now_us();
+	for (int k = 0; k < steps; k++) {
+		protocol.stop_timer(k % (window * 2));
+		protocol.start_timer((k + window) % (window * 2));
+		sink = sink + protocol.check_timers();
+	}
+	double ns = (now_us() - start) * 1000.0 / steps;
+
+	if (sink == 0x7fffffff)
+		fprintf(stderr, "\n");
+	return ns;
+}
+
+
+int timers_bench(bench_args* args) {
+	unsigned int windows[] = {4, 16, 64, 256, 1024, 4096};
+	unsigned int nwindows = sizeof(windows) / sizeof(windows[0]);
+	int steps = args->messages > 0 ? args->messages : 1;
+
+	fprintf(stderr, "steps = %d, ns per step (ack + send + check) and per timeout:\n", steps);
+	fprintf(stderr, "%8s %12s %12s %12s %12s %12s\n", "window", "wheel step", "wheel t/o", "linear step", "linear t/o", "protocol");
+
+	for (unsigned int i = 0; i < nwindows; i++) {
+		double wheel_step, wheel_expire, linear_step, linear_expire;
+		time_timers(windows[i], steps, &wheel_step, &wheel_expire, &linear_step, &linear_expire);
+		double protocol = time_protocol_timers(windows[i], steps);
+		fprintf(stderr, "%8u %12.1f %12.1f %12.1f %12.1f %12.1f\n", windows[i],
+			wheel_step, wheel_expire, linear_step, linear_expire, protocol);
+	}
+	return 0;
+}
+
+
+/**
+ * Frame number i of the slip stream, the number is in seq and ack
+ */
+void make_frame(frame* f, unsigned int i, unsigned int payload) {
+	f->kind = DATA;
+	f->seq = i & 0xff;
+	f->ack = (i >> 8) & 0xff;
+	f->info.len = payload;
+	for (unsigned int j = 0; j < payload; j++)
+		f->info.data[j] = rand();
+	f->checksum = 0;
+}
+
+
+/**
+ * Drop or insert one byte every -s frames and measure the recovery:
+ * the number of frames between the damaged one and the next frame
+ * decoded correctly. Raw framing never gets aligned again by itself.
+ */
+int slip_bench(bench_args* args) {
+	///< the frame number must fit in seq and ack
+	unsigned int nframes = args->messages < 65536 ? args->messages : 65536;
+	unsigned int every = args->size > 1 ? (unsigned int)args->size : 2;
+	unsigned int payload = args->payload > 0 ? args->payload : PKT_SIZE;
+	unsigned int size = FRAME_HEADER_SIZE + payload;
+	unsigned int max_encoded = COBS_MAX_SIZE(size);
+
+	frame* frames = (frame*)malloc(nframes * sizeof(frame));
+	unsigned char* stream = (unsigned char*)malloc(nframes * max_encoded + nframes);
+	bool* good = (bool*)calloc(nframes, sizeof(bool));
+	unsigned int len = 0;
+	unsigned int slips = 0;
+
+	srand(1);
+
+	///< encode, damaging one frame every "every" frames
+	for (unsigned int i = 0; i < nframes; i++) {
+		unsigned char encoded[COBS_MAX_SIZE(sizeof(frame))];
+		unsigned int n;
+
+		make_frame(&frames[i], i, payload);
+
+		if (args->framing == framing_cobs) {
+			n = FrameParser::encode(FRAME_BYTES(&frames[i]), size, encoded);
+		} else {
+			memcpy(encoded, FRAME_BYTES(&frames[i]), size);
+			n = size;
+		}
+
+		bool slip = (i % every == every / 2);
+		unsigned int pos = rand() % n;
+
+		for (unsigned int j = 0; j < n; j++) {
+			if (slip && j == pos) {
+				if (slips % 2 == 0)
+					continue;				///< dropped byte
+				stream[len++] = rand();		///< extra byte
+			}
+			stream[len++] = encoded[j];
+		}
+		if (slip)
+			slips++;
+	}
+
+	///< decode
+	unsigned long long start = now_us();
+	FrameParser parser;
+	unsigned int decoded = 0;
+
+	for (unsigned int k = 0; k < len; k++) {
+		frame f;
+
+		if (args->framing == framing_cobs) {
+			if (parser.push(stream[k]) != (int)size)
+				continue;
+			memcpy(FRAME_BYTES(&f), parser.get_message(), size);
+		} else {
+			if ((k + 1) % size != 0)
+				continue;
+			memcpy(FRAME_BYTES(&f), stream + k + 1 - size, size);
+		}
+
+		unsigned int i = f.seq | (f.ack << 8);
+		if (f.kind == DATA && i < nframes && memcmp(FRAME_BYTES(&f), FRAME_BYTES(&frames[i]), size) == 0) {
+			good[i] = true;
+			decoded++;
+		}
+	}
+	unsigned long long elapsed = now_us() - start;
+
+	///< recovery distance after every damaged frame
+	unsigned int max_recovery = 0;
+	unsigned long long sum_recovery = 0;
+	unsigned int not_recovered = 0;
+
+	for (unsigned int i = every / 2; i < nframes; i = i + every) {
+		unsigned int next = i + 1;
+		while (next < nframes && next < i + every && !good[next])
+			next++;
+		if (next >= nframes || next >= i + every) {
+			not_recovered++;
+			continue;
+		}
+		sum_recovery = sum_recovery + (next - i);
+		if (next - i > max_recovery)
+			max_recovery = next - i;
+	}
+
+	fprintf(stderr, "framing = %s, frames = %u of %u bytes, slips = %u (one every %u frames)\n",
+		args->framing == framing_cobs ? "cobs" : "raw", nframes, size, slips, every);
+	fprintf(stderr, "decoded = %u, lost = %u, %.2f lost per slip\n",
+		decoded, nframes - decoded, slips ? (double)(nframes - decoded) / slips : 0.0);
+	fprintf(stderr, "recovery: avg = %.2f frames, max = %u frames, not recovered = %u\n",
+		slips > not_recovered ? (double)sum_recovery / (slips - not_recovered) : 0.0,
+		max_recovery, not_recovered);
+	fprintf(stderr, "decode = %llu us, %.2f ns/byte\n", elapsed, len ? elapsed * 1000.0 / len : 0.0);
+
+	free(frames);
+	free(stream);
+	free(good);
+
+	return 0;
+}
+
+
+int main(int argc, char** argv) {
+
+	bench_args args;
+	args.bench = "transfer";
+	args.transport = "socketpair";
+	args.protocol = "selective repeat";
+	args.messages = 1000;
+	args.size = 0;
+	args.send_timeout = 1000000;
+	args.recv_timeout = 2000;
+	args.mode = wait_block;
+	args.idle = 0;
+	args.framing = framing_cobs;
+	args.ring = 0;
+	args.session = false;
+	args.window = 0;
+	args.payload = 0;
+	args.check = check_crc16;
+	args.loss = 0;
+	args.sack = false;
+	args.fast = true;
+	args.ack_every = 0;
+	args.ack_delay = 0;
+	args.fec = 0;
+	args.ber = 0;
+	args.link = NULL;
+	args.trace = NULL;
+	args.metrics = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:t:p:n:s:T:R:w:i:f:x:SW:P:c:L:AFN:D:E:B:I:l:m:")) != -1) {
+		switch (opt) {
+			case 'b': args.bench = optarg; break;
+			case 't': args.transport = optarg; break;
+			case 'p': args.protocol = optarg; break;
+			case 'n': args.messages = atoi(optarg); break;
+			case 's': args.size = parse_size(optarg); break;
+			case 'T': args.send_timeout = atol(optarg); break;
+			case 'R': args.recv_timeout = atol(optarg); break;
+			case 'w': args.mode = strcmp(optarg, "poll") == 0 ? wait_poll : wait_block; break;
+			case 'i': args.idle = atoi(optarg); break;
+			case 'f': args.framing = strcmp(optarg, "raw") == 0 ? framing_raw : framing_cobs; break;
+			case 'x': args.ring = atoi(optarg); break;
+			case 'S': args.session = true; break;
+			case 'W': args.window = atoi(optarg); break;
+			case 'P': args.payload = atoi(optarg); break;
+			case 'L': args.loss = atof(optarg); break;
+			case 'A': args.sack = true; break;
+			case 'F': args.fast = false; break;
+			case 'N': args.ack_every = atoi(optarg); break;
+			case 'D': args.ack_delay = atol(optarg); break;
+			case 'E': args.fec = atoi(optarg); break;
+			case 'B': args.ber = atof(optarg); break;
+			case 'I': args.link = optarg; break;
+			case 'l': args.trace = optarg; break;
+			case 'm': args.metrics = optarg; break;
+			case 'c':
+				if (strcmp(optarg, "sum") == 0)
+					args.check = check_sum8;
+				else if (strcmp(optarg, "crc32") == 0)
+					args.check = check_crc32;
+				else
+					args.check = check_crc16;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-b transfer|goodput|bulk|sack|fast|ack|fec|link|duplex|crc|timers|slip] [-t transport] [-p protocol] [-n messages] [-s size] "
+					"[-T send timeout] [-R recv timeout] [-w block|poll] [-i idle ms] [-f cobs|raw] [-x ring] [-S] [-W window] [-P payload] [-c sum|crc16|crc32] [-L loss] [-A] [-F] [-N frames] [-D delay] [-E frames] [-B ber] [-I link] [-l trace] [-m metrics]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	///< the rest is written when the process exits
+	if (args.trace != NULL && rdt_trace.start(args.trace) < 0)
+		return 1;
+
+	if (strcmp(args.bench, "bulk") == 0)
+		return bulk_bench(&args);
+
+	if (strcmp(args.bench, "udp") == 0)
+		return udp_bench(&args);
+
+	if (strcmp(args.bench, "sack") == 0 || strcmp(args.bench, "fast") == 0)
+		return loss_bench(&args);
+
+	if (strcmp(args.bench, "ack") == 0)
+		return ack_bench(&args);
+
+	if (strcmp(args.bench, "fec") == 0)
+		return fec_bench(&args);
+
+	if (strcmp(args.bench, "link") == 0)
+		return link_bench(&args);
+
+	///< 4 bytes messages by default, as the LED commands
+	if (args.size == 0)
+		args.size = 4;
+
+	if (strcmp(args.bench, "slip") == 0)
+		return slip_bench(&args);
+
+	if (strcmp(args.bench, "crc") == 0)
+		return crc_bench(&args);
+
+	if (strcmp(args.bench, "timers") == 0)
+		return timers_bench(&args);
+
+	if (strcmp(args.bench, "goodput") == 0)
+		return goodput_bench(&args);
+
+	if (strcmp(args.bench, "duplex") == 0)
+		return duplex_bench(&args);
+
+	return transfer_bench(&args);
+}
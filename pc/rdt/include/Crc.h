@@ -0,0 +1,103 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**
+ * CRC of "123456789", the test vector of the CRC catalogues
+ */
+#define CRC16_CHECK		0x906E
+#define CRC32C_CHECK	0xE3069283
+
+
+/**
+ * Integrity check of the frames, the peer must use the same
+ */
+typedef enum {
+	check_sum8 = 0,					///< 8 bit additive sum, 1 byte
+	check_crc16 = 1,				///< CRC-16/X-25 (CCITT polynomial, reflected), 2 bytes
+	check_crc32 = 2					///< CRC-32C (Castagnoli), 4 bytes
+} check_type;
+
+
+/**
+ * @brief      Class for crc.
+ *
+ * Table driven CRCs for the frame check. Both are reflected, so the
+ * same slice-by-8 loop serves them: eight bytes are folded into the crc
+ * with eight table lookups instead of one lookup per byte. On x86 with
+ * SSE4.2 the crc32 instruction computes CRC-32C directly, it is chosen
+ * at run time. The byte by byte versions are kept for the benchmarks.
+ *
+ */
+class Crc {
+
+	public:
+
+		/**
+		 * @brief      Size of the check on the wire
+		 *
+		 * @param[in]  type  The check type
+		 *
+		 * @return     The size in bytes
+		 */
+		static unsigned int size(check_type type);
+
+		/**
+		 * @brief      Compute the check of a buffer
+		 *
+		 * @param[in]  type  The check type
+		 * @param[in]  data  The data
+		 * @param[in]  len   The length
+		 *
+		 * @return     The check, in the low size(type) bytes
+		 */
+		static uint32_t compute(check_type type, const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      8 bit two's complement sum, the data plus the sum adds to 0
+		 */
+		static uint8_t sum8(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-16/X-25, slice-by-8
+		 */
+		static uint16_t crc16(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-16/X-25, one table lookup per byte
+		 */
+		static uint16_t crc16_bytewise(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-32C, with SSE4.2 if the CPU has it, slice-by-8 otherwise
+		 */
+		static uint32_t crc32c(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-32C, slice-by-8
+		 */
+		static uint32_t crc32c_slice8(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-32C, one table lookup per byte
+		 */
+		static uint32_t crc32c_bytewise(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      CRC-32C with the SSE4.2 crc32 instruction, call it only if has_sse42()
+		 */
+		static uint32_t crc32c_sse42(const unsigned char* data, size_t len);
+
+		/**
+		 * @brief      Check if the CPU has the SSE4.2 crc32 instruction
+		 *
+		 * @return     true if available
+		 */
+		static bool has_sse42();
+};
+
+
+#endif
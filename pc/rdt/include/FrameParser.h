@@ -0,0 +1,129 @@
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include <atomic>
+#include <string.h>
+
+
+/**
+ * Byte that separates two encoded messages on the wire
+ */
+#define FRAME_DELIMITER		0x00
+
+/**
+ * Max size of a decoded message
+ */
+#define MAX_MESSAGE_SIZE	1024
+
+/**
+ * Worst case size of n bytes once encoded (code bytes + delimiter)
+ */
+#define COBS_MAX_SIZE(n)	((n) + (n) / 254 + 2)
+
+
+/**
+ * Statistics of the parser
+ */
+typedef struct {
+	unsigned long long bytes;			///< bytes pushed
+	unsigned long long messages;		///< messages decoded
+	unsigned long long errors;			///< messages dropped because badly encoded
+	unsigned long long discarded;		///< bytes thrown away while resynchronizing
+} parser_stats;
+
+
+/**
+ * The counters behind parser_stats, written by the thread that pushes
+ * the bytes (the RX thread if any) and read from any thread
+ */
+typedef struct {
+	std::atomic<unsigned long long> bytes{0};
+	std::atomic<unsigned long long> messages{0};
+	std::atomic<unsigned long long> errors{0};
+	std::atomic<unsigned long long> discarded{0};
+} parser_counters;
+
+
+/**
+ * Add n to a counter written by one thread only: a relaxed load and store,
+ * no locked add for every byte.
+ */
+inline void counter_add(std::atomic<unsigned long long>* counter, unsigned long long n) {
+	counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief      Class for frame parser.
+ *
+ * Consistent Overhead Byte Stuffing: every message is encoded without
+ * any 0x00 byte and terminated by a 0x00 delimiter.
+ * The parser decodes one byte at a time, so it accepts any partial read,
+ * and after a lost, extra or corrupted byte it is aligned again
+ * at the next delimiter: at most the damaged message is lost.
+ *
+ */
+class FrameParser {
+
+	private:
+		unsigned char message[MAX_MESSAGE_SIZE];	///< message being decoded
+		unsigned int len;							///< bytes decoded so far
+		unsigned int remaining;						///< bytes left in the current block
+		bool block_zero;							///< a zero follows the current block
+		bool skip;									///< drop bytes until next delimiter
+		unsigned int skipped;						///< bytes dropped since the error
+		bool done;									///< message returned, clear at next push
+
+		parser_counters stats;
+
+		/**
+		 * @brief      Drop the current message and wait for a delimiter
+		 */
+		void error();
+
+	public:
+
+		FrameParser();
+
+		/**
+		 * @brief      Encode a message
+		 *
+		 * @param      src   The message
+		 * @param[in]  len   The length of the message
+		 * @param      dst   The output, at least COBS_MAX_SIZE(len) bytes
+		 *
+		 * @return     Number of bytes written in dst, delimiter included
+		 */
+		static unsigned int encode(unsigned char* src, unsigned int len, unsigned char* dst);
+
+		/**
+		 * @brief      Push one byte received from the wire
+		 *
+		 * @param[in]  byte  The byte
+		 *
+		 * @return     Length of the completed message, 0 if not complete, -1 if dropped
+		 */
+		int push(unsigned char byte);
+
+		/**
+		 * @brief      Gets the last completed message.
+		 *
+		 * @return     The message, valid until the next push()
+		 */
+		unsigned char* get_message();
+
+		/**
+		 * @brief      Forget the partial message
+		 */
+		void reset();
+
+		/**
+		 * @brief      Gets the statistics.
+		 *
+		 * @return     The statistics.
+		 */
+		parser_stats get_stats();
+};
+
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+
+#include "PhysicalLayer.h"
+
+
+/**
+ * Statistics of the ring
+ */
+typedef struct {
+	unsigned int capacity;				///< number of slots
+	unsigned int high_water;			///< max number of frames queued at the same time
+	unsigned long long pushed;			///< frames queued
+	unsigned long long popped;			///< frames removed
+	unsigned long long drops;			///< frames lost because the ring was full
+} ring_stats;
+
+
+/**
+ * @brief      Class for frame ring.
+ *
+ * Circular buffer of frames for one producer and one consumer.
+ * Without RX thread both are the protocol loop; with the RX thread
+ * the producer is the thread and no lock is needed: head is written
+ * only by the consumer and tail only by the producer.
+ *
+ */
+class FrameRing {
+
+	private:
+		frame* slots = NULL;					///< the frames
+		unsigned int mask = 0;					///< capacity - 1, capacity is a power of 2
+		std::atomic<unsigned int> head;			///< next frame to pop (consumer)
+		std::atomic<unsigned int> tail;			///< next slot to push (producer)
+
+		std::atomic<unsigned int> high_water;	///< written by the producer only
+		std::atomic<unsigned long long> drops;	///< written by the producer only
+
+		FrameRing(const FrameRing&);
+		FrameRing& operator=(const FrameRing&);
+
+	public:
+
+		FrameRing();
+
+		~FrameRing();
+
+		/**
+		 * @brief      Allocate the slots, not thread safe
+		 *
+		 * @param[in]  capacity  The capacity, rounded up to a power of 2
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int init(unsigned int capacity);
+
+		/**
+		 * @brief      Empty the ring (consumer)
+		 */
+		void clear();
+
+		/**
+		 * @brief      Queue a frame (producer)
+		 *
+		 * @param      f     The frame
+		 *
+		 * @return     true if queued, false if the ring is full (the frame is dropped)
+		 */
+		bool push(frame* f);
+
+		/**
+		 * @brief      Remove the oldest frame (consumer)
+		 *
+		 * @param      f     Where to copy the frame
+		 *
+		 * @return     true if a frame was removed, false if empty
+		 */
+		bool pop(frame* f);
+
+		/**
+		 * @brief      Number of queued frames
+		 *
+		 * @return     The number of frames
+		 */
+		unsigned int size();
+
+		/**
+		 * @brief      Number of free slots
+		 *
+		 * @return     The number of slots
+		 */
+		unsigned int space();
+
+		/**
+		 * @brief      Gets the statistics.
+		 *
+		 * @return     The statistics.
+		 */
+		ring_stats get_stats();
+};
+
+
+#endif
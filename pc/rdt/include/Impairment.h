@@ -0,0 +1,219 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+#include "PhysicalLayer.h"
+
+
+/**
+ * Frames the link can hold back at the same time, the next ones are dropped
+ */
+#define IMPAIRMENT_QUEUE	1024
+
+
+/**
+ * Distribution of the latency added on top of the fixed delay
+ */
+typedef enum {
+	jitter_uniform = 0,				///< uniform between 0 and jitter
+	jitter_exponential = 1			///< exponential with mean jitter, a long tail
+} jitter_type;
+
+
+/**
+ * How the simulated link treats the frames. All zero is a perfect link.
+ * Times are in ticks (microseconds).
+ */
+typedef struct {
+	double loss;						///< probability to drop a frame
+	double burst;						///< mean length of a burst of losses, 1 or less for independent losses
+	double ber;							///< probability to flip each bit of a frame
+	double duplicate;					///< probability to deliver a frame twice
+	double reorder;						///< probability to hold a frame back, the next ones overtake it
+	unsigned long long delay;			///< latency of every frame
+	unsigned long long jitter;			///< random latency on top of the delay, the order is kept
+	jitter_type distribution;			///< distribution of the jitter
+	unsigned long long reorder_delay;	///< extra latency of a frame held back
+} impairment_config;
+
+
+/**
+ * What the simulated link did to the frames
+ */
+typedef struct {
+	unsigned long long frames;			///< frames given to the link
+	unsigned long long lost;			///< frames dropped
+	unsigned long long corrupted;		///< frames with bits flipped
+	unsigned long long duplicated;		///< frames delivered twice
+	unsigned long long reordered;		///< frames held back
+	unsigned long long overflows;		///< frames dropped because the queue was full
+	unsigned int high_water;			///< max number of frames held at the same time
+} impairment_stats;
+
+
+/**
+ * A frame held by the link until its release time
+ */
+typedef struct {
+	unsigned long long release;			///< when the frame comes out
+	unsigned long long order;			///< arrival order, for the frames released together
+	frame f;
+} held_frame;
+
+
+/**
+ * @brief      Class for impairment.
+ *
+ * Simulated link in front of the receiver: the frames that go in may be
+ * dropped, damaged, copied, delayed or reordered, and come out when
+ * their time has come. The losses follow a Gilbert model, good and bad
+ * state, for bursts; the bit errors are drawn with the distance between
+ * two of them, so the cost does not depend on the error rate. Held
+ * frames wait in a heap ordered by release time.
+ *
+ * The generator is seeded, the same seed and the same frames give the
+ * same impairments. The time is given by the caller, as for TimerWheel.
+ *
+ */
+class Impairment {
+
+	private:
+		impairment_config config = {};
+		impairment_stats stats = {};
+		unsigned int seed = 1;						///< state of the generator
+
+		bool bad = false;							///< Gilbert model in the bad state
+		unsigned long long next_error = 0;			///< bits before the next bit error
+		unsigned long long last_release = 0;		///< release time of the last frame in order
+		unsigned long long order = 0;				///< frames held so far
+
+		held_frame* heap = NULL;					///< frames held, earliest release first
+		unsigned int held = 0;						///< number of frames held
+
+		Impairment(const Impairment&);
+		Impairment& operator=(const Impairment&);
+
+		/**
+		 * @brief      Uniform random number
+		 *
+		 * @return     A number in (0, 1)
+		 */
+		double uniform();
+
+		/**
+		 * @brief      Draw the distance to the next bit error
+		 */
+		void draw_error();
+
+		/**
+		 * @brief      Tell if the next frame is lost
+		 *
+		 * @return     true to drop it
+		 */
+		bool lose();
+
+		/**
+		 * @brief      Flip the bits of the frame hit by an error
+		 *
+		 * @param      f     The frame
+		 *
+		 * @return     true if at least one bit was flipped
+		 */
+		bool corrupt(frame* f);
+
+		/**
+		 * @brief      Hold a frame until its release time
+		 *
+		 * @param      f        The frame
+		 * @param[in]  release  The release time
+		 */
+		void hold(frame* f, unsigned long long release);
+
+		/**
+		 * @brief      Tell if a held frame comes out before another
+		 *
+		 * @param[in]  a     The index of the first frame in the heap
+		 * @param[in]  b     The index of the second frame in the heap
+		 *
+		 * @return     true if a comes first
+		 */
+		bool before(unsigned int a, unsigned int b);
+
+	public:
+
+		Impairment();
+
+		~Impairment();
+
+		/**
+		 * @brief      Set the impairments and restart the generator.
+		 *
+		 * The held frames are dropped, the statistics are kept.
+		 *
+		 * @param[in]  config  The impairments, NULL for a perfect link
+		 * @param[in]  seed    The seed of the generator
+		 */
+		void configure(const impairment_config* config, unsigned int seed);
+
+		/**
+		 * @brief      Gets the impairments in use.
+		 *
+		 * @return     The impairments.
+		 */
+		impairment_config get_config();
+
+		/**
+		 * @brief      Tell if the link does anything to the frames
+		 *
+		 * @return     false for a perfect link
+		 */
+		bool active();
+
+		/**
+		 * @brief      A frame enters the link
+		 *
+		 * @param      f     The frame
+		 * @param[in]  now   The current time (ticks)
+		 */
+		void push(frame* f, unsigned long long now);
+
+		/**
+		 * @brief      Take the next frame out of the link, if its time has come
+		 *
+		 * @param      f     Where to copy the frame
+		 * @param[in]  now   The current time (ticks)
+		 *
+		 * @return     true if a frame was taken
+		 */
+		bool pop(frame* f, unsigned long long now);
+
+		/**
+		 * @brief      Tell if a frame is due
+		 *
+		 * @param[in]  now   The current time (ticks)
+		 *
+		 * @return     true if pop() would return a frame
+		 */
+		bool due(unsigned long long now);
+
+		/**
+		 * @brief      When the next frame comes out
+		 *
+		 * @return     The time (ticks), 0 if no frame is held
+		 */
+		unsigned long long next_release();
+
+		/**
+		 * @brief      Drop the held frames
+		 */
+		void clear();
+
+		/**
+		 * @brief      Gets the statistics.
+		 *
+		 * @return     What the link did since the start.
+		 */
+		impairment_stats get_stats();
+};
+
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef LINK_STATS_H
+#define LINK_STATS_H
+
+#include <atomic>
+#include <stdio.h>
+
+
+/**
+ * Sub-buckets per power of 2 of the histograms (log2): 16 sub-buckets,
+ * a value is known within 1/16 (6.25%)
+ */
+#define HISTOGRAM_SUB_BITS	4
+#define HISTOGRAM_SUB		(1 << HISTOGRAM_SUB_BITS)
+
+
+/**
+ * Values up to 2^HISTOGRAM_BITS us (12 days), the larger ones go in the last bucket
+ */
+#define HISTOGRAM_BITS		40
+
+
+/**
+ * Buckets of a histogram: the values below HISTOGRAM_SUB have one each,
+ * then HISTOGRAM_SUB per power of 2
+ */
+#define HISTOGRAM_BUCKETS	((HISTOGRAM_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+
+/**
+ * Buckets of an exported Prometheus histogram: one per power of 2 up to
+ * 2^HISTOGRAM_EXPORT_BITS us (67 s), always the same from one export to the next
+ */
+#define HISTOGRAM_EXPORT_BITS	26
+
+
+/**
+ * Counters of a link, index of link_snapshot.counters
+ */
+typedef enum {
+	link_frames_sent = 0,				///< frames written, all kinds
+	link_data_sent,						///< data frames written, first copies and retransmissions
+	link_retransmits,					///< data frames written again
+	link_acks_sent,						///< ack frames written
+	link_naks_sent,						///< nak frames written
+	link_sacks_sent,					///< sack frames written
+	link_parity_sent,					///< parity frames written
+	link_frames_received,				///< frames taken from the ring, damaged ones included
+	link_data_received,					///< undamaged data frames
+	link_data_discarded,				///< undamaged data frames not accepted: copies, out of window or of order
+	link_naks_received,					///< undamaged nak frames
+	link_cksum_errors,					///< frames that failed the check
+	link_timeouts,						///< retransmission timeouts
+	link_ack_timeouts,					///< ack timer expirations, acks not piggybacked
+	link_ring_drops,					///< frames lost because the ring was full
+	link_messages_sent,					///< send() and exchange() completed
+	link_messages_received,				///< recv() and exchange() completed
+	link_bytes_sent,					///< user bytes of the messages sent
+	link_bytes_received,				///< user bytes of the messages received
+	LINK_COUNTERS
+} link_counter;
+
+
+/**
+ * Format of the exported statistics
+ */
+typedef enum {
+	export_prometheus = 0,				///< Prometheus text format, for the textfile collector
+	export_json = 1						///< one JSON object
+} export_format;
+
+
+/**
+ * Copy of a histogram. Times are in ticks (microseconds).
+ */
+typedef struct {
+	unsigned long long count;			///< values recorded
+	unsigned long long sum;				///< sum of the values
+	unsigned long long max;				///< largest value
+	unsigned long long buckets[HISTOGRAM_BUCKETS];	///< values in each bucket
+} histogram_snapshot;
+
+
+/**
+ * Copy of the statistics of a link, taken at one time
+ */
+typedef struct {
+	unsigned long long counters[LINK_COUNTERS];	///< see link_counter
+	histogram_snapshot rtt;				///< round trip time, one sample per ack of new frames (Karn)
+	histogram_snapshot latency;			///< time of send() and exchange(), handshake included
+} link_snapshot;
+
+
+/**
+ * @brief      Class for histogram.
+ *
+ * Log-linear histogram as HdrHistogram: the bucket of a value is its
+ * power of 2 and its next HISTOGRAM_SUB_BITS bits, so the relative error
+ * is the same at any scale and recording is a few shifts and an atomic
+ * add. Any thread may read while one records.
+ *
+ */
+class Histogram {
+
+	private:
+		std::atomic<unsigned long long> buckets[HISTOGRAM_BUCKETS];
+		std::atomic<unsigned long long> count;
+		std::atomic<unsigned long long> sum;
+		std::atomic<unsigned long long> max;
+
+		Histogram(const Histogram&);
+		Histogram& operator=(const Histogram&);
+
+	public:
+
+		Histogram();
+
+		/**
+		 * @brief      Add a value (one writer)
+		 *
+		 * @param[in]  value  The value
+		 */
+		void record(unsigned long long value);
+
+		/**
+		 * @brief      Copy the histogram (any thread)
+		 *
+		 * @param      snapshot  Where to copy
+		 */
+		void snapshot(histogram_snapshot* snapshot);
+
+		/**
+		 * @brief      Gets the bucket of a value
+		 *
+		 * @param[in]  value  The value
+		 *
+		 * @return     The index of the bucket
+		 */
+		static unsigned int bucket(unsigned long long value);
+
+		/**
+		 * @brief      Gets the smallest value of a bucket
+		 *
+		 * @param[in]  i     The index of the bucket
+		 *
+		 * @return     The value
+		 */
+		static unsigned long long lowest(unsigned int i);
+
+		/**
+		 * @brief      Gets the value below which a fraction of the values are
+		 *
+		 * The largest value of the bucket, but never more than the max.
+		 *
+		 * @param[in]  snapshot  The histogram
+		 * @param[in]  q         The fraction, 0 to 1
+		 *
+		 * @return     The value, 0 if the histogram is empty
+		 */
+		static unsigned long long percentile(const histogram_snapshot* snapshot, double q);
+};
+
+
+/**
+ * @brief      Class for link statistics.
+ *
+ * Counters and histograms of a link, updated by the protocol loop with
+ * relaxed atomic adds and read by any thread, e.g. a monitor that
+ * exports them every few seconds while the transfers go on. The copy
+ * is not taken at one instant: a counter may be one event ahead of
+ * another.
+ *
+ */
+class LinkStats {
+
+	private:
+		std::atomic<unsigned long long> counters[LINK_COUNTERS];
+
+		LinkStats(const LinkStats&);
+		LinkStats& operator=(const LinkStats&);
+
+	public:
+
+		Histogram rtt;							///< round trip time, one sample per ack of new frames
+		Histogram latency;						///< time of a message
+
+		LinkStats();
+
+		/**
+		 * @brief      Add to a counter (any thread)
+		 *
+		 * @param[in]  counter  The counter
+		 * @param[in]  n        The amount
+		 */
+		void count(link_counter counter, unsigned long long n = 1);
+
+		/**
+		 * @brief      Copy the statistics (any thread)
+		 *
+		 * @param      snapshot  Where to copy
+		 */
+		void snapshot(link_snapshot* snapshot);
+
+		/**
+		 * @brief      Gets the name of a counter, as exported
+		 *
+		 * @param[in]  counter  The counter
+		 *
+		 * @return     The name
+		 */
+		static const char* name(link_counter counter);
+
+		/**
+		 * @brief      Write a copy of the statistics
+		 *
+		 * @param      file      The file
+		 * @param[in]  snapshot  The statistics
+		 * @param[in]  format    export_prometheus or export_json
+		 * @param[in]  link      The label of the link, e.g. its number
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		static int write(FILE* file, const link_snapshot* snapshot, export_format format, unsigned int link);
+};
+
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef PHISYCAL_LAYER_H
 #define PHISYCAL_LAYER_H
 
+#include <atomic>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -9,14 +10,41 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/time.h>
-#include <termios.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <poll.h>
+
+#include "Transport.h"
+#include "SerialTransport.h"
+#include "PtyTransport.h"
+#include "SocketPairTransport.h"
+#include "UdpTransport.h"
+#include "FrameParser.h"
+#include "Crc.h"
 
 /**
- * Determines packet size in bytes
+ * Default payload size of a frame in bytes, the same as the Arduino
+ * (one LED command per frame). See Protocol::set_payload_size().
  */
-#define PKT_SIZE	1
+#define PKT_SIZE	4
+
+/**
+ * Largest payload a frame can carry, in bytes
+ */
+#define MAX_PKT_SIZE	512
+
+/**
+ * Max number of frames collected before a write
+ */
+#define TX_BATCH	64
+
+/**
+ * Size of the buffer for bytes read from the transport: a whole TX batch,
+ * on UDP it is one datagram and the bytes not read would be lost
+ */
+#define RX_BUFFER_SIZE	(TX_BATCH * COBS_MAX_SIZE(sizeof(frame)))
 
 /**
  * Bytes needed fo connection
@@ -25,85 +53,238 @@
 
 
 /**
- * Convert the user baudrate to termios baudrate
+ * Readiness handshake: PROBE asks the peer if it is running, the peer
+ * answers READY (the Arduino sends it also once after its setup)
  */
-struct rate {
-	unsigned int rawrate;
-	unsigned int termiosrate;
-};
-
+#define PROBE		80
+#define READY		82
 
 
 /**
- * The conversion table
+ * Interval between two probes and max time to wait for the peer (us)
  */
-const rate conversiontable[] = {
-	{9600, B9600},
-	{19200, B19200},
-	{38400, B38400},
-	{57600, B57600},
-	{115200, B115200}
-};
+#define PROBE_INTERVAL	50000
+#define READY_TIMEOUT	4000000
 
 
 /**
- * Packet definition
+ * Packet definition: only the first len bytes of data are used
  */
-typedef struct {
-	unsigned char data[PKT_SIZE];
+typedef struct __attribute__((packed)) {
+	unsigned short len;			///< Payload length
+	unsigned char data[MAX_PKT_SIZE];
 } packet;
 
 
 /**
- * Frames are transported in this layer
+ * Sequence and ack numbers, 16 bit on the wire
  */
-typedef struct {
+typedef unsigned short seq_nr;
+
+
+/**
+ * Frames are transported in this layer.
+ * Packed: the Arduino has no padding, the layout must be the same.
+ * On the wire a frame is the bytes from kind to the last used byte of
+ * the payload (see FRAME_SIZE), followed by the check, 1 to 4 bytes
+ * little endian. The check covers all of them.
+ */
+typedef struct __attribute__((packed)) {
+	uint32_t checksum;			///< The check of the frame, sent after the payload
 	unsigned char kind;			///< What kind of frame is it?
-	unsigned char seq;			///< Sequence number
-	unsigned char ack;			///< Acknowledgement number
+	seq_nr seq;					///< Sequence number
+	seq_nr ack;					///< Acknowledgement number
 	packet info;				///< The data packet
-	unsigned char checksum;		///< The checksum computed on data packet
 } frame;
 
 
+/**
+ * Size of the header (kind to payload length), and size of the frame f
+ * on the wire without the check; the bytes start at FRAME_BYTES(f)
+ */
+#define FRAME_HEADER_SIZE	(sizeof(frame) - sizeof(uint32_t) - MAX_PKT_SIZE)
+#define FRAME_SIZE(f)		(FRAME_HEADER_SIZE + (f)->info.len)
+#define FRAME_BYTES(f)		((unsigned char*)&(f)->kind)
+
+
+
+/**
+ * How frames are put on the wire
+ */
+typedef enum {
+	framing_raw = 0,				///< frames back to back, the stream must stay aligned
+	framing_cobs = 1				///< COBS encoded frames separated by a delimiter
+} framing_type;
+
+
+/**
+ * Statistics of the TX batching, frames / writes is the batch size
+ */
+typedef struct {
+	unsigned long long frames;			///< frames passed to send()
+	unsigned long long bytes;			///< bytes written
+	unsigned long long writes;			///< write syscalls
+	unsigned long long flushes;			///< batches flushed
+} tx_stats;
+
+
+/**
+ * Statistics of the receive path
+ */
+typedef struct {
+	unsigned long long bytes;			///< bytes read
+	unsigned long long frames;			///< good frames
+	unsigned long long bad_frames;		///< frames dropped, bad encoding or size
+	unsigned long long discarded;		///< bytes thrown away while resynchronizing
+	unsigned long long connects;		///< connect messages
+} rx_stats;
+
+
+/**
+ * The counters behind rx_stats, written by the thread that reads the
+ * transport (the RX thread if any) and read from any thread
+ */
+typedef struct {
+	std::atomic<unsigned long long> bytes{0};
+	std::atomic<unsigned long long> frames{0};
+	std::atomic<unsigned long long> bad_frames{0};
+	std::atomic<unsigned long long> connects{0};
+} rx_counters;
+
+
+/**
+ * Startup times, in microseconds from the start of init()
+ */
+typedef struct {
+	unsigned long long open;			///< transport configured
+	unsigned long long ready;			///< READY received, 0 if never
+	unsigned long long first_frame;		///< first frame received, 0 if none yet
+	unsigned int probes;				///< probes sent
+} startup_stats;
+
 
 /**
  * @brief      Class for physical layer.
  * 
  * Implements all the platform dependent syscall to read and write frame.
+ * The bytes go through a Transport (serial, pty, socketpair, udp).
  * 
  */
 class PhysicalLayer {
 	private:
-		///< The file descriptor used in read/write syscall
-		int file_desc;
+		///< The channel used in read/write syscall
+		Transport* transport;
+		///< true if the transport was created by init(device, baudrate)
+		bool own_transport;
+		///< The epoll instance watching the transport
+		int epoll_desc;
+
+		framing_type framing = framing_cobs;			///< wire encoding of frames
+		unsigned int check_size = 2;					///< bytes of the check after the payload
+
+		unsigned char tx_buf[TX_BATCH * COBS_MAX_SIZE(sizeof(frame))];	///< frames waiting to be written
+		unsigned int tx_len = 0;						///< bytes in tx_buf
+		tx_stats stats = {};							///< TX batching statistics
+
+		FrameParser parser;								///< decoder of COBS frames
+		unsigned char rx_buf[RX_BUFFER_SIZE];			///< bytes read, not parsed yet
+		unsigned int rx_pos = 0;						///< next byte to parse
+		unsigned int rx_len = 0;						///< bytes in rx_buf
+		unsigned int connects = 0;						///< connect messages not consumed yet
+		bool connect_frames = false;					///< return connect messages as frames
+		std::atomic<bool> connect_pending{false};		///< connect sent, no frame received since
+		std::atomic<bool> ready_reply{false};			///< READY asked by a probe, not sent yet
+		std::atomic<bool> connect_reply{false};			///< CONNECT to repeat for a probe, not sent yet
+		rx_counters rx;									///< receive statistics
+
+		unsigned long long init_time = 0;				///< tick at the start of init()
+		bool peer_ready = false;						///< READY received
+		startup_stats startup = {};						///< startup times
 
 		/**
-		 * @brief      Get termios baudrate using conversion table
+		 * @brief      Read frames
 		 *
-		 * @param[in]  rawrate  The rawrate
+		 * @param      buff  The buffer
+		 * @param[in]  len   The length (multiple of frame size)
 		 *
-		 * @return     The baudrate.
+		 * @return     Number of bytes read
 		 */
-		int get_baudrate(unsigned int rawrate);
+		int read_frames(unsigned char* buff, unsigned int len);
 
 		/**
-		 * @brief      Read frames
+		 * @brief      Read aligned frames without any framing
+		 *
+		 * The length field of each header tells where the next frame starts.
 		 *
 		 * @param      buff  The buffer
 		 * @param[in]  len   The length (multiple of frame size)
 		 *
 		 * @return     Number of bytes read
 		 */
-		int read_frames(unsigned char* buff, unsigned int len);
+		int read_raw(unsigned char* buff, unsigned int len);
+
+		/**
+		 * @brief      Size on the wire of the frame starting at message
+		 *
+		 * @param      message  The message, at least FRAME_HEADER_SIZE bytes
+		 *
+		 * @return     The size, check included, 0 if the length field is out of range
+		 */
+		unsigned int wire_size(const unsigned char* message);
+
+		/**
+		 * @brief      Copy a frame from the wire, the check goes in checksum
+		 *
+		 * @param      f        The frame
+		 * @param      message  The bytes on the wire
+		 * @param[in]  len      The size on the wire
+		 */
+		void from_wire(frame* f, const unsigned char* message, unsigned int len);
+
+		/**
+		 * @brief      Copy a frame to the wire, followed by its check
+		 *
+		 * @param      f     The frame
+		 * @param      dst   The output, at least FRAME_SIZE(f) + 4 bytes
+		 *
+		 * @return     The size on the wire
+		 */
+		unsigned int to_wire(frame* f, unsigned char* dst);
+
+		/**
+		 * @brief      Parse the received bytes until a message is complete
+		 *
+		 * Connect messages are counted and skipped, unless connect_frames is set.
+		 *
+		 * @return     The size of the message, 0 if no more bytes, -1 if error
+		 */
+		int next_message();
+
+		/**
+		 * @brief      Write a one byte control message (connect, probe, ready) at once
+		 *
+		 * @param[in]  c     The message
+		 *
+		 * @return     Number of bytes written, -1 if error
+		 */
+		int send_control(unsigned char c);
+
+		/**
+		 * @brief      Probe the peer until it answers READY
+		 *
+		 * @param[in]  timeout  The max time to wait in microseconds
+		 *
+		 * @return     1 if the peer is ready, 0 on timeout, -1 if error
+		 */
+		int probe(unsigned long long timeout);
 
 		/**
-		 * @brief      Writes frames.
+		 * @brief      Writes frames in the TX batch, they are sent by flush_tx().
 		 *
 		 * @param      buff  The buffer
 		 * @param[in]  len   The length
 		 *
-		 * @return     Number of bytes written
+		 * @return     Number of bytes accepted
 		 */
 		int write_frames(unsigned char* buff, unsigned int len);
 
@@ -112,10 +293,50 @@ class PhysicalLayer {
 		/**
 		 * @brief      Gets the tick.
 		 *
-		 * @return     The tick.
+		 * @return     The tick, microseconds of the monotonic clock.
 		 */
 		unsigned long long get_tick();
 
+		/**
+		 * @brief      Sets the framing, the peer must use the same
+		 *
+		 * @param[in]  framing  framing_cobs (default) or framing_raw
+		 */
+		void set_framing(framing_type framing);
+
+		/**
+		 * @brief      Sets the size of the check sent after each frame
+		 *
+		 * @param[in]  size  The size in bytes, 1 to 4
+		 */
+		void set_check_size(unsigned int size);
+
+		/**
+		 * @brief      Return connect messages from recv() as frames of kind CONNECT.
+		 *
+		 * Used when another thread reads the frames, so that the connect
+		 * keeps its place in the stream (COBS framing only).
+		 *
+		 * @param[in]  enable  true to enable
+		 *
+		 * @return     0 if success, -1 with raw framing
+		 */
+		int set_connect_frames(bool enable);
+
+		/**
+		 * @brief      Gets the startup times.
+		 *
+		 * @return     The times since the start of init().
+		 */
+		startup_stats get_startup_stats();
+
+		/**
+		 * @brief      Gets the receive statistics.
+		 *
+		 * @return     The statistics.
+		 */
+		rx_stats get_rx_stats();
+
 		/**
 		 * @brief      Init serial connection
 		 *
@@ -126,6 +347,15 @@ class PhysicalLayer {
 		 */
 		int init(const char* device, unsigned int baudrate);
 
+		/**
+		 * @brief      Init the connection on a transport given by the user
+		 *
+		 * @param      transport  The transport, it must outlive the physical layer
+		 *
+		 * @return     1 if success, -1 if error
+		 */
+		int init(Transport* transport);
+
 		/**
 		 * @brief      Connect and synchronize sender and receiver
 		 *
@@ -145,6 +375,29 @@ class PhysicalLayer {
 		 */
 		int send(frame* f, unsigned int len);
 
+		/**
+		 * @brief      Write the replies to a probe, then all the batched frames
+		 *             with a single write
+		 *
+		 * @return     Number of bytes written, -1 if error: the bytes not
+		 *             written are kept for the next flush
+		 */
+		int flush_tx();
+
+		/**
+		 * @brief      Tell if replies to a probe wait for flush_tx()
+		 *
+		 * @return     true if a reply is pending
+		 */
+		bool has_replies();
+
+		/**
+		 * @brief      Gets the TX batching statistics.
+		 *
+		 * @return     The statistics.
+		 */
+		tx_stats get_tx_stats();
+
 		/**
 		 * @brief      Receive a frame
 		 *
@@ -155,6 +408,15 @@ class PhysicalLayer {
 		 */
 		int recv(frame* f, unsigned int len);
 
+		/**
+		 * @brief      Wait until there is something to read
+		 *
+		 * @param[in]  timeout  The timeout in microseconds, -1 to wait forever
+		 *
+		 * @return     1 if readable, 0 on timeout, -1 if error
+		 */
+		int wait(long long timeout);
+
 		/**
 		 * @brief      End serial connection
 		 *
@@ -164,6 +426,8 @@ class PhysicalLayer {
 
 		/**
 		 * @brief      Flush RX serial buffer with a timeout.
+		 *
+		 * @param[in]  timeout  The timeout in microseconds
 		 */
 		void flush(unsigned long long timeout);
 };
@@ -2,40 +2,70 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <pthread.h>
+#include <sys/eventfd.h>
+
 #include "PhysicalLayer.h"
+#include "FrameRing.h"
+#include "TimerWheel.h"
+#include "Impairment.h"
+#include "LinkStats.h"
+#include "Trace.h"
 
 
 /**
- * Maximum sequence number should be 2^n - 1
+ * Default maximum sequence number, should be 2^n - 1.
+ * The Arduino uses it, see set_window() for larger values.
  */
 #define MAX_SEQ			7
 
 
 /**
- * Sender's/receiver's window size
- * This should be greater than half the number of sequence numbers
+ * Default sender's/receiver's window size
+ * This should not be greater than half the number of sequence numbers
  */
 #define WINDOW_SIZE		((MAX_SEQ + 1) / 2)
 
 
 /**
- * Max number of buffered frames
+ * Largest sequence number that fits in a frame
  */
-#define QUEUE_SIZE		(WINDOW_SIZE * 2)
+#define MAX_SEQ_LIMIT	65535
 
 
 /**
- * Possible frame kind
+ * Max number of frames read from the transport at once
  */
-#define ACK		1
-#define NAK		2
-#define DATA	3
+#define RX_BURST		64
+
+
+/**
+ * Default number of buffered frames with the RX thread
+ */
+#define RX_RING_SIZE	1024
+
+
+/**
+ * How often the RX thread checks if it has to stop (us)
+ */
+#define RX_THREAD_PERIOD	10000
 
 
 /**
- * Macro inc is expanded in-line: Increment k circularly
+ * Floor of the retransmission timeout (us), so the delayed acks
+ * of the receiver are not taken for losses
  */
-#define inc(k) if (k < MAX_SEQ) k = k + 1; else k = 0;
+#define RTO_MIN			2000
+
+
+/**
+ * Possible frame kind
+ */
+#define ACK		1
+#define NAK		2
+#define DATA	3
+#define SACK	4
+#define PARITY	5
 
 
 /**
@@ -51,6 +81,46 @@ typedef enum {
 } event_type;
 
 
+/**
+ * How wait_for_event() waits for the next event
+ */
+typedef enum {
+	wait_poll = 0,					///< spin calling enqueue(), burns a core
+	wait_block = 1					///< block until readable or next timer deadline
+} wait_mode;
+
+
+/**
+ * Statistics of wait_for_event(), to measure CPU usage and wake up latency.
+ * Times are in ticks (microseconds).
+ */
+typedef struct {
+	unsigned long long polls;			///< enqueue() + pick_event() rounds
+	unsigned long long waits;			///< blocking waits
+	unsigned long long read_wakeups;	///< waits ended by incoming bytes
+	unsigned long long timer_wakeups;	///< waits ended by a timer deadline
+	unsigned long long blocked;			///< total time spent blocked
+	unsigned long long latency;			///< sum of delays between deadline and wake up
+	unsigned long long max_latency;		///< max delay between deadline and wake up
+} wait_stats;
+
+
+/**
+ * Round trip time of the data frames and the retransmission timeout
+ * computed from it (Jacobson/Karels). Times are in ticks (microseconds).
+ */
+typedef struct {
+	unsigned long long srtt;			///< smoothed round trip time, 0 before the first sample
+	unsigned long long rttvar;			///< mean deviation of the round trip time
+	unsigned long long rto;				///< retransmission timeout in use, backoff included
+	unsigned long long last;			///< last sample
+	unsigned long long samples;			///< one per ack of new frames, the newest sent once (Karn)
+	unsigned long long ambiguous;		///< acked frames not measured because sent again (Karn)
+	unsigned long long timeouts;		///< retransmission timeouts
+	unsigned int backoff;				///< the timeout is doubled this many times
+} rtt_stats;
+
+
 /**
  * @brief      Class for protocol.
  * 
@@ -63,32 +133,138 @@ class Protocol {
 
 	private:
 
-		bool error[MAX_SEQ + 1];
-
 		PhysicalLayer physical_layer;
 		int status;										///< 0 is disabled, 1 is enabled
 
 		unsigned long long offset;						///< to prevent multiple timeouts on same tick
-		unsigned long long ack_timer[WINDOW_SIZE];		///< ack timers
-		unsigned long long lowest_timer;				///< lowest of the timers
+		TimerWheel timers;								///< ack timers, one per window slot
 		unsigned long long aux_timer;					///< value of the auxiliary timer
 
-		unsigned char seqs[WINDOW_SIZE];				///< last sequence number sent per timer
-		unsigned char oldest_frame;						///< tells which frame timed out
+		seq_nr* seqs = NULL;							///< last sequence number sent per timer
+		unsigned long long* sent_at = NULL;				///< first transmission of the frame per timer, 0 if acked
+		bool* resent = NULL;							///< the frame has been sent more than once
+		unsigned long long acked_sent_at = 0;			///< first transmission of the newest frame acked, 0 if none
+		rtt_stats rtt = {};								///< round trip time estimate
+		unsigned long long backoff_until = 0;			///< no new backoff before this time
+		seq_nr oldest_frame;							///< tells which frame timed out
+
+		unsigned int window = 0;						///< window size, slots of the arrays above
+		seq_nr max_seq = 0;								///< sequence numbers are 0 .. max_seq
 
-		frame queue[QUEUE_SIZE];						///< buffered incoming frames
-		frame *inp = &queue[0];							///< where to put the next frame
-		frame *outp = &queue[0];						///< where to remove the next frame from
-		int nframes = 0;								///< number of queued frames
+		FrameRing ring;									///< buffered incoming frames
+		unsigned int connects = 0;						///< connect frames taken from the ring
+
+		pthread_t rx_thread;							///< drains the transport into the ring
+		std::atomic<bool> rx_running;					///< true while the RX thread runs
+		int rx_event = -1;								///< eventfd, signaled when frames are queued
 
 		frame last_frame;								///< arrive frames are kept here
+		frame arrived;									///< frame on its way through the simulated link
+
+		unsigned long long timeout_interval;			///< timeout interval from user (us), cap of the rto
+		unsigned long long ack_delay = 0;				///< delay of the acks (us), 0 for half the timeout
+		unsigned long long next_pkt_fetch;				///< offset of next packet from user to fetch
+		unsigned long long last_pkt_given;				///< offset of last pkt delivered to user
+		unsigned int pkt_size = PKT_SIZE;				///< max payload of the data frames sent
+		check_type check = check_crc16;					///< integrity check of the frames
+
+		Impairment impairment;							///< simulated link in front of dequeue()
+		LinkStats link;									///< counters and histograms, readable by any thread
+		unsigned int trace_source = 0;					///< our records in the trace, set by the rdt
 
-		unsigned long long timeout_interval;			///< timeout interval from user
-		unsigned char next_pkt_fetch;					///< seq of next packet from user to fetch
-		unsigned char last_pkt_given;					///< seq of last pkt delivered to user
+		wait_mode mode = wait_block;					///< how to wait for events
+		wait_stats stats = {};							///< wait_for_event() statistics
+
+		/**
+		 * @brief      Earliest deadline among data and ack timers.
+		 *
+		 * @return     The deadline, 0 if no timer is running
+		 */
+		unsigned long long next_deadline(void);
+
+		/**
+		 * @brief      Block until the transport is readable or the next deadline.
+		 */
+		void block(void);
+
+		/**
+		 * @brief      Update the round trip time estimate with a new measure.
+		 *
+		 * @param[in]  sample  The round trip time of an acked frame (us)
+		 */
+		void rtt_sample(unsigned long long sample);
+
+		/**
+		 * @brief      Block until the RX thread queues frames or the timeout expires.
+		 *
+		 * @param[in]  timeout  The timeout in microseconds, -1 to wait forever
+		 *
+		 * @return     Positive if frames are queued, 0 on timeout, -1 if error
+		 */
+		int wait_ring(long long timeout);
+
+		/**
+		 * @brief      Body of the RX thread: read the frames and push them in the ring.
+		 *
+		 * @param      arg   The protocol
+		 *
+		 * @return     NULL
+		 */
+		static void* rx_loop(void* arg);
 
 	public:
 
+		Protocol();
+
+		~Protocol();
+
+		/**
+		 * @brief      Set the window size and the sequence space.
+		 *
+		 * Allocates one timer per window slot. Both peers must use the
+		 * same values. The ring is resized to two windows unless the
+		 * RX thread runs. Call it before a transfer, not during one.
+		 *
+		 * @param[in]  window   The window size
+		 * @param[in]  max_seq  The maximum sequence number, 2^n - 1 up to MAX_SEQ_LIMIT
+		 *
+		 * @return     1 if success, -1 if the values are not valid
+		 */
+		int set_window(unsigned int window, unsigned int max_seq);
+
+		/**
+		 * @brief      Gets the window size.
+		 *
+		 * @return     The window size.
+		 */
+		unsigned int get_window(void);
+
+		/**
+		 * @brief      Gets the maximum sequence number.
+		 *
+		 * @return     The maximum sequence number.
+		 */
+		seq_nr get_max_seq(void);
+
+		/**
+		 * @brief      Set the max payload of the data frames sent.
+		 *
+		 * Frames carry their length, so the peer accepts any payload up
+		 * to its own maximum (MAX_PKT_SIZE, PKT_SIZE on the Arduino).
+		 *
+		 * @param[in]  size  The payload size in bytes, 1 to MAX_PKT_SIZE
+		 *
+		 * @return     1 if success, -1 if the size is not valid
+		 */
+		int set_payload_size(unsigned int size);
+
+		/**
+		 * @brief      Gets the max payload of the data frames sent.
+		 *
+		 * @return     The payload size in bytes.
+		 */
+		unsigned int get_payload_size(void);
+
 		/**
 		 * @brief      Check if the value is between the extremes.
 		 *
@@ -98,29 +274,46 @@ class Protocol {
 		 *
 		 * @return     True if a <=b < c circularly; false otherwise.
 		 */
-		bool between(unsigned char a, unsigned char b, unsigned char c);
+		bool between(seq_nr a, seq_nr b, seq_nr c);
 
 		/**
 		 * @brief      Sets the maximum seqnr.
 		 *
 		 * @param[in]  max_seqnr  The maximum seqnr.
 		 */
-		void set_max_seqnr(unsigned char max_seqnr);
+		void set_max_seqnr(seq_nr max_seqnr);
 
 		/**
 		 * @brief      Gets the timedout seqnr.
 		 *
 		 * @return     The timedout seqnr.
 		 */
-		unsigned char get_timedout_seqnr(void);
+		seq_nr get_timedout_seqnr(void);
 
 		/**
 		 * @brief      Sets the timeout.
 		 *
-		 * @param[in]  timeout  The timeout.
+		 * The retransmission timeout follows the measured round trip time,
+		 * this is its upper bound and its value before the first measure.
+		 *
+		 * @param[in]  timeout  The timeout in microseconds.
 		 */
 		void set_timeout(unsigned long long timeout);
 
+		/**
+		 * @brief      Gets the retransmission timeout of the next data frame.
+		 *
+		 * @return     The timeout in microseconds.
+		 */
+		unsigned long long get_rto(void);
+
+		/**
+		 * @brief      Gets the round trip time statistics.
+		 *
+		 * @return     The estimate and the counters since the protocol was created.
+		 */
+		rtt_stats get_rtt_stats(void);
+
 		/**
 		 * @brief      Allow the application layer to cause a send_ready event.
 		 */
@@ -135,31 +328,45 @@ class Protocol {
 		 * @brief      Set up the protocol to new send or receive.
 		 *
 		 * @param[in]  max_seqnr  The maximum seqnr
-		 * @param[in]  timeout    The timeout
+		 * @param[in]  timeout    The timeout in microseconds
 		 * @param[in]  state      The state
 		 */
-		void set_up(unsigned char max_seqnr, unsigned long long timeout, int state);
+		void set_up(seq_nr max_seqnr, unsigned long long timeout, int state);
+
+		/**
+		 * @brief      Set up the protocol for the next message of a session.
+		 *
+		 * Unlike set_up() the queued frames and the timers are kept.
+		 *
+		 * @param[in]  timeout  The timeout in microseconds
+		 * @param[in]  state    The state
+		 */
+		void next_message(unsigned long long timeout, int state);
+
+		/**
+		 * @brief      Choose the integrity check of the frames, the peer must use the same.
+		 *
+		 * @param[in]  type  check_crc16 (default), check_crc32 or check_sum8
+		 */
+		void set_check(check_type type);
 
 		/**
-		 * @brief      Calculates the checksum.
+		 * @brief      Calculates the checksum of the whole frame, header included.
 		 *
-		 * @param      data       The data
-		 * @param[in]  num_bytes  The number bytes
+		 * @param      f     The frame, payload length set
 		 *
 		 * @return     The checksum.
 		 */
-		unsigned char compute_checksum(unsigned char data[], size_t num_bytes);
+		uint32_t compute_checksum(frame* f);
 
 		/**
-		 * @brief      Verify the checksum with the received data and checksum.
+		 * @brief      Verify the checksum of a received frame.
 		 *
-		 * @param      data       The data
-		 * @param[in]  num_bytes  The number bytes
-		 * @param[in]  checksum   The checksum
+		 * @param      f     The frame
 		 *
 		 * @return     The result of checking, 0 if positive.
 		 */
-		unsigned char verify_checksum(unsigned char data[], size_t num_bytes, unsigned char checksum);
+		int verify_checksum(frame* f);
 
 		/**
 		 * @brief      Init the physical layer.
@@ -171,6 +378,15 @@ class Protocol {
 		 */
 		int init(const char* device, int baudrate);
 
+		/**
+		 * @brief      Init the physical layer on a given transport.
+		 *
+		 * @param      transport  The transport
+		 *
+		 * @return     1 if success, -1 otherwise
+		 */
+		int init(Transport* transport);
+
 		/**
 		 * @brief      Connect and synch sender and receiver.
 		 *
@@ -189,9 +405,70 @@ class Protocol {
 
 		/**
 		 * @brief      Flush the RX serial buffer
+		 *
+		 * @param[in]  timeout  The timeout in microseconds
 		 */
 		void flush(unsigned long long timeout);
 
+		/**
+		 * @brief      Write the frames batched in the physical layer
+		 */
+		void flush_tx(void);
+
+		/**
+		 * @brief      Gets the TX batching statistics.
+		 *
+		 * @return     The statistics of the physical layer.
+		 */
+		tx_stats get_tx_stats(void);
+
+		/**
+		 * @brief      Gets the receive statistics.
+		 *
+		 * @return     The statistics of the physical layer.
+		 */
+		rx_stats get_rx_stats(void);
+
+		/**
+		 * @brief      Gets the startup times.
+		 *
+		 * @return     The startup times of the physical layer.
+		 */
+		startup_stats get_startup_stats(void);
+
+		/**
+		 * @brief      Sets the framing of the physical layer.
+		 *
+		 * @param[in]  framing  framing_cobs (default) or framing_raw
+		 */
+		void set_framing(framing_type framing);
+
+		/**
+		 * @brief      Start a thread that reads the transport continuously.
+		 *
+		 * The frames are queued in a ring of the given capacity instead of
+		 * waiting in the kernel buffer until wait_for_event() runs; when
+		 * the ring is full the frames are dropped and counted.
+		 * Needs COBS framing. Call it after init() and before any transfer.
+		 *
+		 * @param[in]  capacity  The ring capacity in frames
+		 *
+		 * @return     1 if success, -1 otherwise
+		 */
+		int start_rx_thread(unsigned int capacity);
+
+		/**
+		 * @brief      Stop the RX thread, if running. Called by close().
+		 */
+		void stop_rx_thread(void);
+
+		/**
+		 * @brief      Gets the statistics of the incoming frame ring.
+		 *
+		 * @return     The ring statistics.
+		 */
+		ring_stats get_ring_stats(void);
+
 		/**
 		 * @brief      Read from physical file descriptor and insert frame in the queue
 		 */
@@ -211,6 +488,95 @@ class Protocol {
 		 */
 		void wait_for_event(event_type* event);
 
+		/**
+		 * @brief      Sleep until bytes arrive or the next deadline.
+		 *
+		 * Returns at once in wait_poll mode.
+		 */
+		void idle(void);
+
+		/**
+		 * @brief      Choose how wait_for_event() waits
+		 *
+		 * @param[in]  mode  wait_block (default) or wait_poll
+		 */
+		void set_wait_mode(wait_mode mode);
+
+		/**
+		 * @brief      Drop incoming frames at random, to test the recovery.
+		 *
+		 * Every frame but the connect is dropped with the same probability,
+		 * as if lost on the link. The sequence repeats with the same seed.
+		 * The other impairments are kept.
+		 *
+		 * @param[in]  rate  The probability, 0 (default) to 1
+		 * @param[in]  seed  The seed of the generator
+		 */
+		void set_loss(double rate, unsigned int seed);
+
+		/**
+		 * @brief      Gets the number of frames dropped by the simulated link.
+		 *
+		 * @return     The number of frames.
+		 */
+		unsigned long long get_lost(void);
+
+		/**
+		 * @brief      Pass the incoming frames through a simulated link.
+		 *
+		 * Every frame but the connect may be dropped, damaged, copied,
+		 * delayed or reordered before dequeue() sees it; see Impairment.
+		 * The sequence repeats with the same seed.
+		 *
+		 * @param[in]  config  The impairments, NULL for a perfect link (default)
+		 * @param[in]  seed    The seed of the generator
+		 */
+		void set_impairment(const impairment_config* config, unsigned int seed);
+
+		/**
+		 * @brief      Gets what the simulated link did to the incoming frames.
+		 *
+		 * @return     The impairment statistics.
+		 */
+		impairment_stats get_impairment_stats(void);
+
+		/**
+		 * @brief      Gets the counters and histograms of the link.
+		 *
+		 * The object is updated in place, any thread may copy it.
+		 *
+		 * @return     The link statistics.
+		 */
+		LinkStats* get_link_stats(void);
+
+		/**
+		 * @brief      Sets the source of the timeline records, the one of the rdt.
+		 *
+		 * @param[in]  source  The source number
+		 */
+		void set_trace_source(unsigned int source);
+
+		/**
+		 * @brief      Sets how long the receiver may keep an ack back.
+		 *
+		 * @param[in]  delay  The delay (us), 0 for half the timeout of the transfer (default)
+		 */
+		void set_ack_delay(unsigned long long delay);
+
+		/**
+		 * @brief      Gets the current time.
+		 *
+		 * @return     The time (ticks).
+		 */
+		unsigned long long get_tick(void);
+
+		/**
+		 * @brief      Gets the wait statistics.
+		 *
+		 * @return     The statistics collected since init.
+		 */
+		wait_stats get_wait_stats(void);
+
 		/**
 		 * @brief      Pick an event if any
 		 *
@@ -221,19 +587,35 @@ class Protocol {
 		/**
 		 * @brief      Starts a timer and enable the timeout event.
 		 *
+		 * The timer lasts get_rto().
+		 *
 		 * @param[in]  seqnr  The sequence number of started imer
 		 */
-		void start_timer(unsigned char seqnr);
+		void start_timer(seq_nr seqnr);
 
 		/**
 		 * @brief      Stops a timer and disable the timeout event.
 		 *
+		 * Call it when the frame is acked: unless it was sent again, the
+		 * frame is the candidate for the round trip time sample of the ack.
+		 *
 		 * @param[in]  seqnr  The sequence number of started imer
 		 */
-		void stop_timer(unsigned char seqnr);
+		void stop_timer(seq_nr seqnr);
+
+		/**
+		 * @brief      Take the round trip time sample of an ack.
+		 *
+		 * Call it once per ack frame, after stop_timer() for all the frames
+		 * it acks: the newest of them sent only once gives the sample.
+		 */
+		void ack_received(void);
 
 		/**
 		 * @brief      Starts the acknowledge timer and enable the ack_timeout event.
+		 *
+		 * A running timer is not moved: the frames that arrive meanwhile
+		 * share its ack, which is never later than the ack delay.
 		 */
 		void start_ack_timer(void);
 
@@ -243,7 +625,7 @@ class Protocol {
 		void stop_ack_timer(void);
 
 		/**
-		 * @brief      Check for possible timeout. If found, reset the timer.
+		 * @brief      Check for possible timeout. If found, reset the timer and back off.
 		 *
 		 * @return     Return the sequence number of timeout timer if any, -1 if no timeout
 		 */
@@ -256,26 +638,26 @@ class Protocol {
 		 */
 		int check_ack_timer(void);
 
-		/**
-		 * @brief      Find the lowest timer.
-		 */
-		void recalc_timers(void);
-
 		/**
 		 * @brief      Fetch a packet from the application layer for transmission on the channel
 		 *
+		 * The packet takes the next payload size bytes of the data,
+		 * the last one of the message may be shorter.
+		 *
 		 * @param      data  The data from application layer
+		 * @param[in]  len   The length of the data
 		 * @param      p     The packet in which put the data
 		 */
-		void from_application_layer(unsigned char* data, packet* p);
+		void from_application_layer(unsigned char* data, unsigned long long len, packet* p);
 
 		/**
 		 * @brief      Deliver information from an inbound frame to the physical layer
 		 *
 		 * @param      data  The data buffer in which put the received data
+		 * @param[in]  len   The length of the data buffer, never written beyond
 		 * @param      p     The packet received from channel.
 		 */
-		void to_application_layer(unsigned char* data, packet* p);
+		void to_application_layer(unsigned char* data, unsigned long long len, packet* p);
 
 		/**
 		 * @brief      Go get an inbound frame from the physical layer and copy it to f
@@ -0,0 +1,56 @@
+#ifndef PTY_TRANSPORT_H
+#define PTY_TRANSPORT_H
+
+#include <termios.h>
+
+#include "Transport.h"
+
+
+/**
+ * @brief      Class for pseudo-terminal transport.
+ *
+ * Without a slave path a new pseudo-terminal is allocated and this object
+ * is its master side; the peer opens get_peer_name().
+ * With a slave path the object is the slave side of an existing pty.
+ * Both sides are set in raw mode, like the serial port.
+ *
+ */
+class PtyTransport : public Transport {
+
+	private:
+		char peer_name[64];					///< Path of the other side of the pty
+		bool master;						///< true if this is the master side
+
+	public:
+
+		/**
+		 * @brief      Constructor of the master side
+		 */
+		PtyTransport();
+
+		/**
+		 * @brief      Constructor of the slave side
+		 *
+		 * @param[in]  slave  The slave path (e.g. /dev/pts/3)
+		 */
+		PtyTransport(const char* slave);
+
+		/**
+		 * @brief      Open the master or the slave side
+		 *
+		 * @return     The file descriptor if success, -1 if error
+		 */
+		int open();
+
+		const char* get_name();
+
+		/**
+		 * @brief      Gets the path to open from the other side.
+		 *
+		 * @return     The slave path for a master, the slave path itself otherwise
+		 */
+		const char* get_peer_name();
+};
+
+
+#endif
@@ -2,7 +2,49 @@
 #ifndef RELIABLE_DATA_TRANSFER_H
 #define RELIABLE_DATA_TRANSFER_H
 
+#include <limits.h>
+
 #include "Protocol.h"
+#include "Trace.h"
+
+
+/**
+ * Duplicate acks that make go back n send the window again
+ */
+#define DUP_ACKS		3
+
+
+/**
+ * Bytes of a parity frame before the parity of the payloads: the number
+ * of data frames in the group and the parity of their lengths
+ */
+#define FEC_HEADER		3
+
+
+/**
+ * Parity frames, and the data frames the receiver rebuilt from them
+ */
+typedef struct {
+	unsigned long long parity;			///< parity frames sent
+	unsigned long long received;		///< parity frames received
+	unsigned long long rebuilt;			///< data frames rebuilt from a parity frame
+} fec_stats;
+
+
+/**
+ * Control frames sent by the receiver, and how long the sender waited
+ * for them with a full window. Times are in ticks (microseconds).
+ */
+typedef struct {
+	unsigned long long data_frames;		///< data frames received, copies included
+	unsigned long long acks;			///< ack frames sent, duplicate acks included
+	unsigned long long naks;			///< nak frames sent
+	unsigned long long sacks;			///< sack frames sent
+	unsigned long long piggybacked;		///< acks carried by a data frame
+	unsigned long long delayed;			///< acks sent by the ack timer
+	unsigned long long stalls;			///< times the sender filled its window
+	unsigned long long stalled;			///< time the sender spent with a full window
+} ack_stats;
 
 
 /**
@@ -15,41 +57,112 @@ class ReliableDataTransfer {
 
 	private:
 		bool no_nak;						///< no nak has been sent yet
-		bool not_expected;
-		bool end;							///< To stop send and receive
+		bool sending;						///< an outbound message is in progress
+		bool receiving;						///< an inbound message is in progress
 
-		unsigned char ack_expected;			///< lower edge of sender's window
-		unsigned char next_frame_to_send;	///< upper edge of sender's window + 1
-		unsigned char frame_expected;		///< lower edge of receiver's window
-		unsigned char too_far;				///< upper edge of receiver's window + 1
+		bool session = false;				///< keep the connection across transfers
+		bool sack = false;					///< selective acks for the frames out of order
+		bool fast_retransmit = true;		///< go back n: nak, duplicate acks and fast retransmit
+		unsigned int fec = 0;				///< data frames per parity frame, 0 for none
+		bool connected = false;				///< the session handshake is done
+
+		seq_nr ack_expected;				///< lower edge of sender's window
+		seq_nr next_frame_to_send;			///< upper edge of sender's window + 1
+		seq_nr frame_expected;				///< lower edge of receiver's window
+		seq_nr too_far;						///< upper edge of receiver's window + 1
+
+		unsigned int window = 0;			///< window size
+		seq_nr max_seq = 0;					///< sequence numbers are 0 .. max_seq
 
 		frame r;							///< scratch variable
-		packet out_buf[WINDOW_SIZE];		///< buffers for the outbound stream
-		packet in_buf[WINDOW_SIZE];			///< buffers for the inbound stream
-		bool arrived[WINDOW_SIZE];			///< inbound bit map
+		packet* out_buf = NULL;				///< buffers for the outbound stream
+		packet* in_buf = NULL;				///< buffers for the inbound stream
+		bool* arrived = NULL;				///< inbound bit map
+		bool* sacked = NULL;				///< outbound frames the receiver already has
+		bool* sack_resent = NULL;			///< outbound frames already sent again for a SACK
+		seq_nr* in_seq = NULL;				///< sequence number of the frame in each in_buf slot
+		packet fec_out;						///< parity of the group of outbound frames
+		seq_nr fec_first;					///< first frame of the group
+		unsigned int fec_count = 0;			///< frames in the group so far
+		unsigned short fec_len;				///< parity of the lengths of the group
+		fec_stats fecs = {0, 0, 0};
 		unsigned int nbuffered;				///< how many output buffers currently used
+		unsigned int dup_acks;				///< acks in a row that did not move the window
+		unsigned int ack_every = 0;			///< ack every n frames in order, 0 for a window
+		unsigned int unacked = 0;			///< frames in order since the last ack sent
+		ack_stats acks = {0, 0, 0, 0, 0, 0, 0, 0};
+		seq_nr gone_back;					///< ack_expected of the last go back, max_seq + 1 if none
 
 		event_type event;
+		unsigned int trace_source = rdt_trace.next_source();	///< tells our records in the trace and our statistics
 
 		Protocol protocol;
 
-		unsigned int nframes;				///< Number of frames to send and receive
-		unsigned int last_frame_recv;		///< Counter for frame received
-		unsigned int last_frame_send;		///< Counter for frame send
+		unsigned char* out_data = NULL;		///< user data to send
+		unsigned char* in_data = NULL;		///< user buffer for the data received
+		unsigned long long out_length;		///< Length of the user data to send
+		unsigned long long in_length;		///< Length of the user data to receive
+		unsigned long long out_frames;		///< Number of frames to send
+		unsigned long long in_frames;		///< Number of frames to receive
+		unsigned long long last_frame_send;	///< Counter for frame send
+		unsigned long long last_frame_acked;///< Counter for frame sent and acked
+		unsigned long long last_frame_recv;	///< Counter for frame received
 
 		/**
 		 * The functors to rdt implementation function.
 		 * Based on user choice it is initizialized
 		 * with the corresponding function implementation.
 		 */
-		void (ReliableDataTransfer::*run)(unsigned char*);
+		void (ReliableDataTransfer::*run)();
 
 		/**
 		 * @brief      Set up the member for a new trasmission.
 		 *
-		 * @param[in]  len   The length of the user data
+		 * @param[in]  out_len  The length of the data to send
+		 * @param[in]  in_len   The length of the data to receive
+		 */
+		void set_up(unsigned long long out_len, unsigned long long in_len);
+
+		/**
+		 * @brief      Increment a sequence number circularly
+		 *
+		 * @param      k     The sequence number
+		 */
+		void inc(seq_nr& k);
+
+		/**
+		 * @brief      Reset the sequence numbers and the windows
+		 */
+		void reset_windows();
+
+		/**
+		 * @brief      Ack the frames in order now, or start the ack timer
+		 */
+		void ack_in_order();
+
+		/**
+		 * @brief      Pass the in order frames of the current message to the user
+		 */
+		void deliver();
+
+		/**
+		 * @brief      Tell if the messages in progress are done
+		 *
+		 * @return     true when the outbound one is acked and the inbound one delivered and acked
+		 */
+		bool done();
+
+		/**
+		 * @brief      Run the protocol until the messages in progress are done
+		 */
+		void transfer();
+
+		/**
+		 * @brief      Choose the implementation pointed by run
+		 *
+		 * @param[in]  protocol  "selective repeat" or "go back n"
 		 */
-		void set_up(int len);
+		void set_protocol(const char* protocol);
 
 		/**
 		 * @brief      Connect two devices, simple handshaking
@@ -68,24 +181,111 @@ class ReliableDataTransfer {
 		 * @param[in]  frame_expected  The frame expected
 		 * @param      buffer          The data buffer
 		 */
-		void send_frame(unsigned char fk, unsigned char frame_nr, unsigned char frame_expected, packet buffer[]);
+		void send_frame(unsigned char fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[]);
 
 		/**
-		 * @brief      Selective repeat implementation
+		 * @brief      Fill the payload of a SACK frame.
+		 *
+		 * Bit i of the bitmap (bit 0 of byte 0 first) tells if frame
+		 * frame_expected + 1 + i has arrived; the bitmap ends with the
+		 * last frame arrived, or when the payload is full.
 		 *
-		 * @param      buff  The buffer to send or receiver
+		 * @param      p     The packet of the SACK frame
 		 */
-		void selective_repeat(unsigned char* buff);
+		void sack_bitmap(packet* p);
 
 		/**
-		 * @brief      GO back n implementation
+		 * @brief      Handle the bitmap of a SACK frame, the ack is already done.
+		 *
+		 * The frames the receiver has lose their timer, the missing ones
+		 * before the last frame it has are all sent again at once.
+		 *
+		 * @param      f     The SACK frame
+		 */
+		void selective_ack(frame* f);
+
+		/**
+		 * @brief      Add a new data frame to the parity of its group.
+		 *
+		 * The parity frame is sent when the group has fec frames, or
+		 * with the last frame of the message.
 		 *
-		 * @param      buff  The buffer to send or receive
+		 * @param[in]  seq   The sequence number of the frame
+		 * @param      p     The packet of the frame
 		 */
-		void go_back_n(unsigned char* buff);
+		void fec_add(seq_nr seq, packet* p);
+
+		/**
+		 * @brief      Rebuild the data frame missing in the group of a parity frame.
+		 *
+		 * Only one frame may be missing, the others must still be in in_buf.
+		 *
+		 * @param      f     The parity frame
+		 */
+		void fec_rebuild(frame* f);
+
+		/**
+		 * @brief      Selective repeat implementation
+		 */
+		void selective_repeat();
+
+		/**
+		 * @brief      Send all the outstanding frames again, from ack_expected
+		 */
+		void go_back();
+
+		/**
+		 * @brief      GO back n implementation
+		 */
+		void go_back_n();
 
 	public:
 
+		ReliableDataTransfer();
+
+		~ReliableDataTransfer();
+
+		/**
+		 * @brief      Set the window size and the sequence space.
+		 *
+		 * The default is a window of WINDOW_SIZE frames and sequence numbers
+		 * up to MAX_SEQ, as on the Arduino. On a fast link the window should
+		 * cover the bandwidth-delay product. Both peers must use the same
+		 * values; a running session is closed.
+		 *
+		 * @param[in]  window   The window size, up to 32768
+		 * @param[in]  max_seq  The maximum sequence number, 2^n - 1 and at least
+		 *                      2 * window - 1; 0 to use the smallest one
+		 *
+		 * @return     1 if success, -1 if the values are not valid
+		 */
+		int set_window(unsigned int window, unsigned int max_seq = 0);
+
+		/**
+		 * @brief      Set the max payload of a data frame.
+		 *
+		 * A message of len bytes takes len / size frames, rounded up.
+		 * Both peers must use the same size; the default is PKT_SIZE,
+		 * as on the Arduino. Call it between two transfers.
+		 *
+		 * @param[in]  size  The payload size in bytes, up to MAX_PKT_SIZE,
+		 *                   MAX_PKT_SIZE - FEC_HEADER with set_fec()
+		 *
+		 * @return     1 if success, -1 if the size is not valid
+		 */
+		int set_payload_size(unsigned int size);
+
+		/**
+		 * @brief      Choose the integrity check of the frames.
+		 *
+		 * The check covers the header and the payload of every frame, acks
+		 * included. Both peers must use the same; the Arduino uses
+		 * CHECK_TYPE, CRC-16 by default.
+		 *
+		 * @param[in]  type  check_crc16 (default), check_crc32 or check_sum8
+		 */
+		void set_check(check_type type);
+
 		/**
 		 * @brief      Init the rdt
 		 *
@@ -97,23 +297,282 @@ class ReliableDataTransfer {
 		 */
 		int init(const char* device, const char* protocol, int baudrate);
 
+		/**
+		 * @brief      Init the rdt on a transport created by the user
+		 *
+		 * @param      transport  The transport (serial, pty, socketpair, udp)
+		 * @param[in]  protocol   The protocol
+		 *
+		 * @return     1 if success, -1 otherwise
+		 */
+		int init(Transport* transport, const char* protocol);
+
 		/**
 		 * @brief      Send the data
 		 *
 		 * @param      data     The data
 		 * @param[in]  len      The length
-		 * @param[in]  timeout  The timeout
+		 * @param[in]  timeout  The retransmission timeout in microseconds
 		 */
-		void send(unsigned char* data, int len, unsigned long timeout);
+		void send(unsigned char* data, unsigned long long len, unsigned long timeout);
 
 		/**
 		 * @brief      Receive the data
 		 *
 		 * @param      data     The data
 		 * @param[in]  len      The length
-		 * @param[in]  timeout  The timeout
+		 * @param[in]  timeout  The timeout in microseconds, acks are delayed by half of it
+		 */
+		void recv(unsigned char* data, unsigned long long len, unsigned long timeout);
+
+		/**
+		 * @brief      Send and receive at the same time.
+		 *
+		 * The outbound and the inbound message share one event loop: the
+		 * data frames of each side carry the ack of the other, so while
+		 * both sides have data no ack frame is needed. The peer calls
+		 * exchange() too, with the lengths swapped. Returns when the data
+		 * sent is acked and the data received is delivered and acked.
+		 * The Arduino does not support it.
+		 *
+		 * @param      out      The data to send
+		 * @param[in]  out_len  The length of the data to send
+		 * @param      in       The buffer for the data received
+		 * @param[in]  in_len   The length of the data to receive
+		 * @param[in]  timeout  The retransmission timeout in microseconds, acks are
+		 *                      delayed by half of it unless set_ack_delay() says otherwise
+		 */
+		void exchange(unsigned char* out, unsigned long long out_len,
+				unsigned char* in, unsigned long long in_len, unsigned long timeout);
+
+		/**
+		 * @brief      Keep the connection open across send() and recv().
+		 *
+		 * Only the first transfer makes the connect handshake; the sequence
+		 * numbers then continue from one message to the next, so a message
+		 * costs only its data and ack frames. Both peers must enable it.
+		 * A peer that restarts needs a new session: disable and enable it.
+		 *
+		 * @param[in]  enable  true to enable, false to go back to a handshake per transfer
+		 */
+		void set_session(bool enable);
+
+		/**
+		 * @brief      Send selective acks in selective repeat.
+		 *
+		 * A frame out of order that leaves a hole before it makes the
+		 * receiver send a SACK: the cumulative ack plus a bitmap of the
+		 * frames it has. The sender sends all the missing frames again
+		 * in one batch, instead of one per NAK or timeout. Both peers
+		 * must enable it, the Arduino does not support it.
+		 *
+		 * @param[in]  enable  true to enable, false for nak only (default)
+		 */
+		void set_sack(bool enable);
+
+		/**
+		 * @brief      Fast retransmit in go back n.
+		 *
+		 * The receiver sends a NAK for the first frame out of order or
+		 * damaged after a gap, and a duplicate ack for the next ones.
+		 * The sender goes back on the NAK, or on the third duplicate
+		 * ack if the NAK is lost, without waiting for the timer: once
+		 * for each position of the window, a second loss still waits.
+		 *
+		 * @param[in]  enable  true to enable (default), false for timeouts only
+		 */
+		void set_fast_retransmit(bool enable);
+
+		/**
+		 * @brief      Forward error correction in selective repeat.
+		 *
+		 * The sender follows every k new data frames, and the last one
+		 * of a message, with a parity frame: the XOR of their payloads.
+		 * The receiver rebuilds one frame lost or damaged in the group
+		 * without waiting for the retransmission; two need it. A parity
+		 * frame costs one payload every k frames, a smaller k recovers
+		 * more errors. Both peers must use the same k, the Arduino does
+		 * not support it.
+		 *
+		 * @param[in]  k     Data frames per parity frame, up to the window
+		 *                   and 255; 0 to disable (default)
+		 *
+		 * @return     1 if success, -1 if k is not valid or the payload
+		 *             leaves less than FEC_HEADER bytes free
+		 */
+		int set_fec(unsigned int k);
+
+		/**
+		 * @brief      Gets the forward error correction statistics.
+		 *
+		 * @return     The parity frames sent and received, the frames rebuilt.
+		 */
+		fec_stats get_fec_stats();
+
+		/**
+		 * @brief      How many frames the receiver acks at once.
+		 *
+		 * The receiver acks every n frames in order and the last frame
+		 * of a message. The first frame left without ack starts the ack
+		 * timer, so the frames of a partial window wait at most the ack
+		 * delay. With set_ack_delay() this gives the ack policy:
+		 * n = 1 acks every frame at once, n > 1 every n frames, n = 0
+		 * once per window or ack delay, whichever comes first. A smaller
+		 * n slides the window of the sender more often, at the cost of
+		 * more ack frames.
+		 *
+		 * @param[in]  n     Frames per ack, 0 or more than the window for a window (default)
+		 */
+		void set_ack_every(unsigned int n);
+
+		/**
+		 * @brief      How long the receiver may keep an ack back.
+		 *
+		 * Above the round trip time the sender may time out before the
+		 * ack: keep it well below the send timeout of the peer.
+		 *
+		 * @param[in]  delay  The delay (us), 0 for half the timeout of the transfer (default)
+		 */
+		void set_ack_delay(unsigned long long delay);
+
+		/**
+		 * @brief      Gets the ack statistics.
+		 *
+		 * @return     The control frames sent and the sender stalls since init.
+		 */
+		ack_stats get_ack_stats();
+
+		/**
+		 * @brief      Drop incoming frames at random, to test the recovery.
+		 *
+		 * @param[in]  rate  The probability, 0 (default) to 1
+		 * @param[in]  seed  The seed of the generator
+		 */
+		void set_loss(double rate, unsigned int seed = 1);
+
+		/**
+		 * @brief      Gets the number of incoming frames dropped by the simulated link.
+		 *
+		 * @return     The number of frames.
+		 */
+		unsigned long long get_lost();
+
+		/**
+		 * @brief      Pass the incoming frames through a simulated link.
+		 *
+		 * Losses in bursts, bit errors, copies, latency with jitter and
+		 * reordering; see impairment_config. Use it on one side only to
+		 * impair one direction.
+		 *
+		 * @param[in]  config  The impairments, NULL for a perfect link (default)
+		 * @param[in]  seed    The seed of the generator
+		 */
+		void set_impairment(const impairment_config* config, unsigned int seed = 1);
+
+		/**
+		 * @brief      Gets what the simulated link did to the incoming frames.
+		 *
+		 * @return     The impairment statistics since init.
+		 */
+		impairment_stats get_impairment_stats();
+
+		/**
+		 * @brief      Copy the counters and histograms of the link.
+		 *
+		 * Safe from any thread, also during a transfer.
+		 *
+		 * @param      snapshot  Where to copy
+		 */
+		void get_link_stats(link_snapshot* snapshot);
+
+		/**
+		 * @brief      Write the link statistics in a file.
+		 *
+		 * The file is written aside and renamed, so a reader never sees
+		 * half of it (e.g. the textfile collector of the node exporter).
+		 * The link label is the number of this rdt in the trace.
+		 * Safe from any thread, also during a transfer.
+		 *
+		 * @param[in]  path    The path of the file
+		 * @param[in]  format  export_prometheus or export_json
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int export_link_stats(const char* path, export_format format);
+
+		/**
+		 * @brief      Choose how the protocol waits for events
+		 *
+		 * @param[in]  mode  wait_block (default) or wait_poll
+		 */
+		void set_wait_mode(wait_mode mode);
+
+		/**
+		 * @brief      Gets the wait statistics of the protocol.
+		 *
+		 * @return     The wait statistics.
+		 */
+		wait_stats get_wait_stats();
+
+		/**
+		 * @brief      Gets the round trip time and retransmission timeout.
+		 *
+		 * @return     The RTT statistics.
+		 */
+		rtt_stats get_rtt_stats();
+
+		/**
+		 * @brief      Gets the TX batching statistics.
+		 *
+		 * @return     The TX statistics.
+		 */
+		tx_stats get_tx_stats();
+
+		/**
+		 * @brief      Gets the receive statistics.
+		 *
+		 * @return     The RX statistics.
+		 */
+		rx_stats get_rx_stats();
+
+		/**
+		 * @brief      Gets the startup times: open, peer ready, first frame.
+		 *
+		 * @return     The times in microseconds since init().
+		 */
+		startup_stats get_startup_stats();
+
+		/**
+		 * @brief      Sets the framing, the peer must use the same.
+		 *
+		 * @param[in]  framing  framing_cobs (default) or framing_raw
+		 */
+		void set_framing(framing_type framing);
+
+		/**
+		 * @brief      Read the transport in a dedicated thread.
+		 *
+		 * Incoming frames are queued in a ring while the protocol is busy,
+		 * instead of piling up in the kernel buffer. Needs COBS framing,
+		 * call it after init().
+		 *
+		 * @param[in]  capacity  The ring capacity in frames, RX_RING_SIZE by default
+		 *
+		 * @return     1 if success, -1 otherwise
+		 */
+		int start_rx_thread(unsigned int capacity = RX_RING_SIZE);
+
+		/**
+		 * @brief      Stop the RX thread, close() does it too.
+		 */
+		void stop_rx_thread();
+
+		/**
+		 * @brief      Gets the statistics of the incoming frame ring.
+		 *
+		 * @return     The capacity, high water mark and drops of the ring.
 		 */
-		void recv(unsigned char* data, int len, unsigned long timeout);
+		ring_stats get_ring_stats();
 
 		/**
 		 * @brief      Close the rdt
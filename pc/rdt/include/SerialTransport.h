@@ -0,0 +1,112 @@
+#ifndef SERIAL_TRANSPORT_H
+#define SERIAL_TRANSPORT_H
+
+#include <termios.h>
+
+#include "Transport.h"
+#include "Termios2.h"
+
+
+/**
+ * Convert the user baudrate to termios baudrate
+ */
+struct rate {
+	unsigned int rawrate;
+	unsigned int termiosrate;
+};
+
+
+
+/**
+ * The conversion table
+ */
+const rate conversiontable[] = {
+	{9600, B9600},
+	{19200, B19200},
+	{38400, B38400},
+	{57600, B57600},
+	{115200, B115200},
+	{230400, B230400},
+	{460800, B460800},
+	{500000, B500000},
+	{576000, B576000},
+	{921600, B921600},
+	{1000000, B1000000},
+	{1152000, B1152000},
+	{1500000, B1500000},
+	{2000000, B2000000},
+	{2500000, B2500000},
+	{3000000, B3000000},
+	{3500000, B3500000},
+	{4000000, B4000000}
+};
+
+
+
+/**
+ * @brief      Class for serial transport.
+ *
+ * Termios serial port in raw mode (the Arduino board).
+ * Standard rates up to 4 Mbaud are set with cfsetXspeed(), any other
+ * rate with termios2 and BOTHER (see Termios2). A rate of 0 is refused:
+ * B0 would hang up the line.
+ * Opening the port raises DTR, which resets most Arduino boards: the
+ * physical layer probes the sketch instead of sleeping for the boot time.
+ *
+ */
+class SerialTransport : public Transport {
+
+	private:
+		char* device;						///< Path of the serial device
+		unsigned int baudrate;				///< Baudrate requested by user
+		unsigned int actual_baudrate;		///< Baudrate configured by the driver
+		bool hold_dtr;						///< keep DTR up when the port is closed
+
+		/**
+		 * @brief      Get termios baudrate using conversion table
+		 *
+		 * @param[in]  rawrate  The rawrate
+		 *
+		 * @return     The baudrate.
+		 */
+		int get_baudrate(unsigned int rawrate);
+
+	public:
+
+		/**
+		 * @brief      Constructor
+		 *
+		 * With hold_dtr HUPCL is cleared: DTR stays up after close(), so
+		 * the next open() does not reset the board. The first open after
+		 * plugging the board in still resets it. A sketch that is not reset
+		 * keeps its session state (see ReliableDataTransfer::set_session()).
+		 *
+		 * @param[in]  device    The device
+		 * @param[in]  baudrate  The baudrate
+		 * @param[in]  hold_dtr  true to keep DTR up across closes
+		 */
+		SerialTransport(const char* device, unsigned int baudrate, bool hold_dtr = false);
+
+		~SerialTransport();
+
+		/**
+		 * @brief      Open the serial port and set it in raw mode
+		 *
+		 * @return     The file descriptor if success, -1 if error
+		 */
+		int open();
+
+		const char* get_name();
+
+		bool needs_probe();
+
+		/**
+		 * @brief      Gets the baudrate actually configured by the driver.
+		 *
+		 * @return     The baudrate, 0 if the port is not open.
+		 */
+		unsigned int get_configured_baudrate();
+};
+
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SOCKET_PAIR_TRANSPORT_H
+#define SOCKET_PAIR_TRANSPORT_H
+
+#include <sys/socket.h>
+
+#include "Transport.h"
+
+
+/**
+ * @brief      Class for socketpair transport.
+ *
+ * In process loopback: two objects are connected by pair()
+ * and each one is given to a different ReliableDataTransfer.
+ *
+ */
+class SocketPairTransport : public Transport {
+
+	public:
+
+		/**
+		 * @brief      Connect two transports with a unix stream socketpair
+		 *
+		 * @param      a     The first end
+		 * @param      b     The second end
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		static int pair(SocketPairTransport* a, SocketPairTransport* b);
+
+		/**
+		 * @brief      The socket is already created by pair()
+		 *
+		 * @return     The file descriptor, -1 if pair() was not called
+		 */
+		int open();
+
+		const char* get_name();
+};
+
+
+#endif
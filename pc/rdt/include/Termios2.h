@@ -0,0 +1,40 @@
+#ifndef TERMIOS2_H
+#define TERMIOS2_H
+
+
+/**
+ * @brief      Class for termios2.
+ *
+ * Any baudrate, not only the Bxxx ones, with termios2 and BOTHER (Linux
+ * only, the driver may round it). struct termios2 comes from
+ * <asm/termbits.h>, which can not be included together with <termios.h>:
+ * its layout changes with the architecture, so it is used only in this
+ * translation unit and never declared by hand.
+ *
+ */
+class Termios2 {
+
+	public:
+
+		/**
+		 * @brief      Set the baudrate of the port, input and output
+		 *
+		 * @param[in]  file_desc  The file descriptor of the port
+		 * @param[in]  rate       The baudrate
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		static int set_baudrate(int file_desc, unsigned int rate);
+
+		/**
+		 * @brief      Read the baudrate configured by the driver
+		 *
+		 * @param[in]  file_desc  The file descriptor of the port
+		 *
+		 * @return     The output baudrate, also for standard rates, 0 if error
+		 */
+		static unsigned int get_baudrate(int file_desc);
+};
+
+
+#endif
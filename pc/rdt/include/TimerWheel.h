@@ -0,0 +1,161 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Slots per level, one bit each in a 64 bit word
+ */
+#define WHEEL_BITS		6
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+
+
+/**
+ * Levels of the wheel, 11 groups of 6 bits cover the whole 64 bit time
+ */
+#define WHEEL_LEVELS	11
+
+
+/**
+ * A timer of the wheel, an entry of a doubly linked list
+ */
+typedef struct {
+	unsigned long long deadline;		///< expiry time (ticks), 0 if not armed
+	int prev;							///< previous timer of the list, -1 if first
+	int next;							///< next timer of the list, -1 if last
+	int list;							///< list the timer is in, -1 if not armed
+} wheel_timer;
+
+
+/**
+ * @brief      Class for timer wheel.
+ *
+ * Hierarchical timing wheel with one tick resolution. Timers are
+ * identified by an index from 0 to capacity - 1, a slot of the window.
+ * Level l has 64 slots of 64^l ticks: a timer goes in the level of the
+ * highest 6 bit group in which its deadline differs from the current time,
+ * in the slot given by that group. When time enters a slot of an upper
+ * level its timers move down, until they reach level 0 where a slot is a
+ * single tick. A bitmap per level finds the next non-empty slot, so empty
+ * ticks are skipped.
+ *
+ * Arm and cancel are O(1), every timer moves down at most once per level.
+ *
+ */
+class TimerWheel {
+
+	private:
+		wheel_timer* timers = NULL;					///< the timers, by index
+		unsigned int capacity = 0;					///< number of timers
+		unsigned int armed = 0;						///< number of armed timers
+
+		int heads[WHEEL_LEVELS * WHEEL_SLOTS + 1];	///< first timer of each slot, then the expired list
+		int expired_tail = -1;						///< last timer of the expired list
+		uint64_t occupied[WHEEL_LEVELS];			///< non-empty slots of each level
+
+		unsigned long long now = 0;					///< the wheel has moved up to here
+
+		TimerWheel(const TimerWheel&);
+		TimerWheel& operator=(const TimerWheel&);
+
+		/**
+		 * @brief      Put an armed timer in its slot, or in the expired list if due
+		 *
+		 * @param[in]  id    The timer
+		 */
+		void place(int id);
+
+		/**
+		 * @brief      Remove a timer from its list
+		 *
+		 * @param[in]  id    The timer
+		 */
+		void unlink(int id);
+
+		/**
+		 * @brief      Find the next slot to process
+		 *
+		 * @param      list  The slot found
+		 *
+		 * @return     The time at which the slot is processed, 0 if all are empty
+		 */
+		unsigned long long next_slot(int* list);
+
+	public:
+
+		TimerWheel();
+
+		~TimerWheel();
+
+		/**
+		 * @brief      Allocate the timers, all disarmed
+		 *
+		 * @param[in]  capacity  The number of timers
+		 * @param[in]  now       The current time (ticks)
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int init(unsigned int capacity, unsigned long long now);
+
+		/**
+		 * @brief      Disarm all the timers
+		 *
+		 * @param[in]  now   The current time (ticks)
+		 */
+		void clear(unsigned long long now);
+
+		/**
+		 * @brief      Arm a timer, or move it if already armed
+		 *
+		 * @param[in]  id        The timer
+		 * @param[in]  deadline  The expiry time (ticks), greater than 0
+		 */
+		void arm(unsigned int id, unsigned long long deadline);
+
+		/**
+		 * @brief      Disarm a timer, nothing if not armed
+		 *
+		 * @param[in]  id    The timer
+		 */
+		void cancel(unsigned int id);
+
+		/**
+		 * @brief      Gets the deadline of a timer
+		 *
+		 * @param[in]  id    The timer
+		 *
+		 * @return     The deadline, 0 if not armed
+		 */
+		unsigned long long deadline(unsigned int id);
+
+		/**
+		 * @brief      Disarm the earliest timer expired at the given time
+		 *
+		 * @param[in]  current_time  The current time (ticks)
+		 *
+		 * @return     The timer, -1 if none expired
+		 */
+		int expire(unsigned long long current_time);
+
+		/**
+		 * @brief      When to look for expired timers again
+		 *
+		 * The time may be earlier than the first deadline, when timers
+		 * of an upper level have to move down first.
+		 *
+		 * @return     The time (ticks), 0 if no timer is armed
+		 */
+		unsigned long long next_deadline();
+
+		/**
+		 * @brief      Number of armed timers
+		 *
+		 * @return     The number of timers
+		 */
+		unsigned int size();
+};
+
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <pthread.h>
+
+#include "PhysicalLayer.h"
+
+
+/**
+ * Trace levels: the calls above TRACE_LEVEL are removed at compile time
+ */
+#define TRACE_OFF		0		///< nothing
+#define TRACE_EVENTS	1		///< checksum errors and rebuilt frames
+#define TRACE_FRAMES	2		///< every frame sent and received
+#define TRACE_TIMELINE	3		///< also the protocol events: waits, timers, ring, handshake
+
+
+/**
+ * Level compiled in, set by the Makefile (TRACE_LEVEL=0 make to remove the trace)
+ */
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL		TRACE_FRAMES
+#endif
+
+
+/**
+ * Payload bytes kept in a trace record
+ */
+#define TRACE_BYTES		8
+
+
+/**
+ * Default number of records in the ring
+ */
+#define TRACE_RING_SIZE	65536
+
+
+/**
+ * Period of the writer thread (us)
+ */
+#define TRACE_WRITER_PERIOD	10000
+
+
+/**
+ * First bytes of a trace file, and version of the records
+ */
+#define TRACE_MAGIC		"RDTT"
+#define TRACE_VERSION	1
+
+
+/**
+ * Record an event if the level is compiled in.
+ * The arguments are not evaluated otherwise.
+ */
+#define TRACE(level, ...) \
+	do { \
+		if ((level) <= TRACE_LEVEL) \
+			rdt_trace.record(__VA_ARGS__); \
+	} while (0)
+
+
+/**
+ * What a record tells. The timeline events use the fields of the
+ * frame for their own values, as noted.
+ */
+typedef enum {
+	trace_send = 1,						///< frame sent
+	trace_recv = 2,						///< frame received
+	trace_cksum_err = 3,				///< damaged frame received, no frame fields
+	trace_rebuilt = 4,					///< data frame rebuilt from the parity, no checksum
+	trace_enqueue = 5,					///< frames read into the ring, seq = how many
+	trace_dequeue = 6,					///< frame taken from the ring, before the check
+	trace_timer_arm = 7,				///< data timer armed, seq = frame, checksum = timeout (us)
+	trace_timer_stop = 8,				///< data timer stopped by the ack, seq = frame
+	trace_timer_fire = 9,				///< data timer expired, seq = frame
+	trace_ack_timer_arm = 10,			///< ack timer armed, checksum = delay (us)
+	trace_ack_timer_stop = 11,			///< ack timer stopped, the ack went on a frame
+	trace_ack_timeout = 12,				///< ack timer expired
+	trace_wait_begin = 13,				///< the protocol goes to sleep, checksum = timeout (us), -1 for none
+	trace_wait_end = 14,				///< the protocol wakes up, checksum = 1 bytes, 0 timer
+	trace_connect_begin = 15,			///< handshake starts
+	trace_connect_end = 16,				///< handshake done
+	trace_message_begin = 17,			///< send(), recv() or exchange() starts, kind = 's', 'r' or 'x', checksum = bytes
+	trace_message_end = 18				///< the message is done
+} trace_event;
+
+
+/**
+ * A trace record, fixed size and written as is in the trace file
+ */
+typedef struct __attribute__((packed)) {
+	uint64_t tick;						///< when it happened (us, monotonic clock)
+	uint32_t source;					///< which rdt, see TraceLog::next_source()
+	uint32_t checksum;					///< check of the frame, or the value of a timeline event
+	uint16_t seq;						///< sequence number
+	uint16_t ack;						///< ack number
+	uint16_t len;						///< payload length
+	uint8_t event;						///< a trace_event
+	uint8_t kind;						///< kind of the frame
+	uint8_t data[TRACE_BYTES];			///< first bytes of the payload
+} trace_record;
+
+
+/**
+ * Header of a trace file, followed by the records
+ */
+typedef struct __attribute__((packed)) {
+	char magic[4];						///< TRACE_MAGIC
+	uint16_t version;					///< TRACE_VERSION
+	uint16_t record_size;				///< sizeof(trace_record)
+} trace_header;
+
+
+/**
+ * Statistics of the trace
+ */
+typedef struct {
+	unsigned int capacity;				///< records in the ring
+	unsigned long long recorded;		///< records queued
+	unsigned long long written;			///< records written in the file
+	unsigned long long drops;			///< records lost because the ring was full
+} trace_stats;
+
+
+/**
+ * A slot of the ring: the record and its turn
+ */
+typedef struct {
+	std::atomic<unsigned long long> turn;	///< position + 1 when the record is ready
+	trace_record r;
+} trace_slot;
+
+
+/**
+ * @brief      Class for trace log.
+ *
+ * Binary trace of the frames, in place of a printf per frame, and of
+ * the protocol events when TRACE_LEVEL is TRACE_TIMELINE. A call
+ * copies a record of fixed size in a ring and returns: no formatting,
+ * no system call, no lock. Every rdt of the process may write at the
+ * same time, a writer thread empties the ring into a file that
+ * tools/tracedump prints.
+ *
+ * The ring is bounded: when the writer does not keep up the new
+ * records are dropped and counted. Before init() or start() a call
+ * only reads a flag.
+ *
+ */
+class TraceLog {
+
+	private:
+		trace_slot* slots = NULL;				///< the records
+		unsigned int mask = 0;					///< capacity - 1, capacity is a power of 2
+		std::atomic<unsigned long long> tail;	///< next slot to claim (writers)
+		unsigned long long head = 0;			///< next slot to read (drain)
+		pthread_mutex_t drain_lock;				///< one drain at a time
+
+		std::atomic<bool> enabled;				///< record or not
+		std::atomic<unsigned int> sources;		///< sources given so far
+		std::atomic<unsigned long long> drops;	///< records lost
+		unsigned long long written = 0;			///< records drained
+
+		int fd = -1;							///< trace file of the writer thread
+		unsigned long period = TRACE_WRITER_PERIOD;
+		pthread_t writer;						///< drains the ring into fd
+		std::atomic<bool> writer_running;		///< true while the writer thread runs
+
+		TraceLog(const TraceLog&);
+		TraceLog& operator=(const TraceLog&);
+
+		/**
+		 * @brief      Body of the writer thread
+		 *
+		 * @param      arg   The trace log
+		 *
+		 * @return     NULL
+		 */
+		static void* writer_loop(void* arg);
+
+	public:
+
+		TraceLog();
+
+		~TraceLog();
+
+		/**
+		 * @brief      Allocate the ring and start recording, not thread safe
+		 *
+		 * @param[in]  capacity  The capacity, rounded up to a power of 2
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int init(unsigned int capacity);
+
+		/**
+		 * @brief      Record in a file until stop()
+		 *
+		 * The file starts with a trace_header. The ring is allocated
+		 * if init() was not called.
+		 *
+		 * @param[in]  path      The path of the file, truncated
+		 * @param[in]  capacity  The capacity of the ring
+		 * @param[in]  period    How often the writer thread drains the ring (us)
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int start(const char* path, unsigned int capacity = TRACE_RING_SIZE,
+			unsigned long period = TRACE_WRITER_PERIOD);
+
+		/**
+		 * @brief      Stop recording, write what is left and close the file
+		 */
+		void stop();
+
+		/**
+		 * @brief      Write the queued records, without header
+		 *
+		 * @param[in]  fd    The file descriptor
+		 *
+		 * @return     The number of records written, -1 if error
+		 */
+		int drain(int fd);
+
+		/**
+		 * @brief      Gets a new source number, for the records of one rdt
+		 *
+		 * @return     The source number
+		 */
+		unsigned int next_source();
+
+		/**
+		 * @brief      Queue a record (any thread)
+		 *
+		 * @param[in]  event     The trace_event
+		 * @param[in]  source    The source number
+		 * @param[in]  kind      The kind of the frame
+		 * @param[in]  seq       The sequence number
+		 * @param[in]  ack       The ack number
+		 * @param[in]  p         The payload, NULL if none
+		 * @param[in]  checksum  The check of the frame
+		 */
+		void record(trace_event event, unsigned int source, unsigned char kind, seq_nr seq, seq_nr ack,
+			const packet* p, uint32_t checksum);
+
+		/**
+		 * @brief      Gets the statistics.
+		 *
+		 * @return     The records queued, written and dropped.
+		 */
+		trace_stats get_stats();
+};
+
+
+/**
+ * The trace of the process
+ */
+extern TraceLog rdt_trace;
+
+
+#endif
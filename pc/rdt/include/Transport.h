@@ -0,0 +1,124 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+
+/**
+ * @brief      Class for transport.
+ *
+ * Abstract byte channel used by the physical layer.
+ * Every implementation is backed by a file descriptor, so read, write
+ * and close are shared here and only the way the descriptor is opened
+ * changes (serial port, pseudo-terminal, socketpair, UDP socket).
+ *
+ */
+class Transport {
+
+	protected:
+		///< The file descriptor used in read/write syscall
+		int file_desc;
+
+		/**
+		 * @brief      Set the file descriptor in non blocking mode
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		int set_nonblocking();
+
+	public:
+
+		Transport();
+
+		virtual ~Transport();
+
+		/**
+		 * @brief      Open the underlying channel
+		 *
+		 * @return     The file descriptor if success, -1 if error
+		 */
+		virtual int open() = 0;
+
+		/**
+		 * @brief      Gets the name of the transport.
+		 *
+		 * @return     The name.
+		 */
+		virtual const char* get_name() = 0;
+
+		/**
+		 * @brief      Tell if the peer may not be running yet after open().
+		 *
+		 * If so the physical layer probes it before the first transfer.
+		 *
+		 * @return     false by default, true for the serial port (the board resets)
+		 */
+		virtual bool needs_probe();
+
+		/**
+		 * @brief      Gets the file descriptor.
+		 *
+		 * @return     The file descriptor, -1 if not open
+		 */
+		int get_fd();
+
+		/**
+		 * @brief      Number of bytes ready to be read
+		 *
+		 * @return     Number of bytes, -1 if error
+		 */
+		virtual int available();
+
+		/**
+		 * @brief      Read bytes from the channel
+		 *
+		 * @param      buff  The buffer
+		 * @param[in]  len   The length
+		 *
+		 * @return     Number of bytes read, -1 if error
+		 */
+		virtual int read(unsigned char* buff, unsigned int len);
+
+		/**
+		 * @brief      Write bytes on the channel
+		 *
+		 * @param      buff  The buffer
+		 * @param[in]  len   The length
+		 *
+		 * @return     Number of bytes written, -1 if error
+		 */
+		virtual int write(unsigned char* buff, unsigned int len);
+
+		/**
+		 * @brief      Close the channel
+		 *
+		 * @return     0 if success, -1 if error
+		 */
+		virtual int close();
+
+		/**
+		 * @brief      Create a transport from a device string.
+		 *
+		 * Accepted formats:
+		 * - "pty"               master side of a new pseudo-terminal
+		 * - "pty:<slave path>"  slave side of an existing pseudo-terminal
+		 * - "udp:<lport>:<rport>" UDP socket on the loopback interface
+		 * - "<path>:hold"       serial device, DTR held across closes (no reset)
+		 * - anything else       serial device path
+		 *
+		 * @param[in]  device    The device
+		 * @param[in]  baudrate  The baudrate (serial only)
+		 *
+		 * @return     The transport (to delete by the caller), NULL if error
+		 */
+		static Transport* create(const char* device, unsigned int baudrate);
+};
+
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Transport.h"
+
+
+/**
+ * @brief      Class for UDP loopback transport.
+ *
+ * The socket is bound to 127.0.0.1:local_port and connected to
+ * 127.0.0.1:remote_port, so the peer uses the same ports swapped.
+ * Every write is a datagram, so reads always return whole writes.
+ *
+ */
+class UdpTransport : public Transport {
+
+	private:
+		unsigned short local_port;			///< Port to bind
+		unsigned short remote_port;			///< Port of the peer
+
+	public:
+
+		/**
+		 * @brief      Constructor
+		 *
+		 * @param[in]  local_port   The local port
+		 * @param[in]  remote_port  The remote port
+		 */
+		UdpTransport(unsigned short local_port, unsigned short remote_port);
+
+		/**
+		 * @brief      Create, bind and connect the socket
+		 *
+		 * @return     The file descriptor if success, -1 if error
+		 */
+		int open();
+
+		const char* get_name();
+};
+
+
+#endif
@@ -0,0 +1,232 @@
+#include <string.h>
+
+#include "../include/Crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC_X86
+#endif
+
+
+/**
+ * Reflected polynomials
+ */
+#define CRC16_POLY		0x8408
+#define CRC32C_POLY		0x82F63B78
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * The eight tables of the slice-by-8 loop. table[0] is the usual byte
+ * table, table[k][b] is the crc of byte b followed by k zero bytes.
+ * A function local static is built once, also with several threads.
+ */
+typedef struct {
+	uint16_t crc16[8][256];
+	uint32_t crc32c[8][256];
+} crc_tables;
+
+
+static crc_tables* build_tables() {
+	static crc_tables t;
+
+	for (unsigned int b = 0; b < 256; b++) {
+		uint16_t c16 = b;
+		uint32_t c32 = b;
+		for (int i = 0; i < 8; i++) {
+			c16 = (c16 & 1) ? (c16 >> 1) ^ CRC16_POLY : c16 >> 1;
+			c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32C_POLY : c32 >> 1;
+		}
+		t.crc16[0][b] = c16;
+		t.crc32c[0][b] = c32;
+	}
+
+	for (unsigned int k = 1; k < 8; k++) {
+		for (unsigned int b = 0; b < 256; b++) {
+			uint16_t c16 = t.crc16[k - 1][b];
+			uint32_t c32 = t.crc32c[k - 1][b];
+			t.crc16[k][b] = (c16 >> 8) ^ t.crc16[0][c16 & 0xff];
+			t.crc32c[k][b] = (c32 >> 8) ^ t.crc32c[0][c32 & 0xff];
+		}
+	}
+	return &t;
+}
+
+
+static const crc_tables* tables() {
+	static const crc_tables* t = build_tables();
+	return t;
+}
+
+
+/**
+ * Load 8 bytes as a little endian word, memcpy because data may not be aligned.
+ */
+static inline uint64_t load64(const unsigned char* p) {
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+
+/**
+ * Slice-by-8 for any reflected crc up to 32 bits: the crc is xored into
+ * the first bytes of the word, then every byte of the word goes through
+ * the table of its distance from the end.
+ */
+template <typename T>
+static T slice8(const T table[8][256], T crc, const unsigned char* data, size_t len) {
+	while (len >= 8) {
+		uint64_t w = load64(data) ^ crc;
+		crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+			table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+			table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+			table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+		data = data + 8;
+		len = len - 8;
+	}
+	while (len-- > 0)
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+	return crc;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * The check takes 1, 2 or 4 bytes at the end of the frame.
+ */
+unsigned int Crc::size(check_type type) {
+	switch (type) {
+		case check_crc16:
+			return 2;
+		case check_crc32:
+			return 4;
+		default:
+			return 1;
+	}
+}
+
+
+/**
+ * Dispatch on the check type.
+ */
+uint32_t Crc::compute(check_type type, const unsigned char* data, size_t len) {
+	switch (type) {
+		case check_crc16:
+			return crc16(data, len);
+		case check_crc32:
+			return crc32c(data, len);
+		default:
+			return sum8(data, len);
+	}
+}
+
+
+/**
+ * The old checksum: the negated sum of the bytes.
+ */
+uint8_t Crc::sum8(const unsigned char* data, size_t len) {
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += data[i];
+	return ~sum + 1;
+}
+
+
+/**
+ * Init 0xFFFF, final xor 0xFFFF.
+ */
+uint16_t Crc::crc16(const unsigned char* data, size_t len) {
+	return ~slice8<uint16_t>(tables()->crc16, 0xFFFF, data, len);
+}
+
+
+uint16_t Crc::crc16_bytewise(const unsigned char* data, size_t len) {
+	const uint16_t* table = tables()->crc16[0];
+	uint16_t crc = 0xFFFF;
+
+	while (len-- > 0)
+		crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xff];
+	return ~crc;
+}
+
+
+/**
+ * The instruction is looked for once.
+ */
+uint32_t Crc::crc32c(const unsigned char* data, size_t len) {
+	static const bool sse42 = has_sse42();
+
+	if (sse42)
+		return crc32c_sse42(data, len);
+	return crc32c_slice8(data, len);
+}
+
+
+/**
+ * Init 0xFFFFFFFF, final xor 0xFFFFFFFF.
+ */
+uint32_t Crc::crc32c_slice8(const unsigned char* data, size_t len) {
+	return ~slice8<uint32_t>(tables()->crc32c, 0xFFFFFFFF, data, len);
+}
+
+
+uint32_t Crc::crc32c_bytewise(const unsigned char* data, size_t len) {
+	const uint32_t* table = tables()->crc32c[0];
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len-- > 0)
+		crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xff];
+	return ~crc;
+}
+
+
+/**
+ * Eight bytes per instruction, the tail one byte at a time. Frames are
+ * at most a few hundred bytes, too short for the three way interleaving
+ * or the PCLMUL folding used on long buffers.
+ */
+#ifdef CRC_X86
+__attribute__((target("sse4.2")))
+uint32_t Crc::crc32c_sse42(const unsigned char* data, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (len >= 8) {
+		uint64_t w;
+		memcpy(&w, data, sizeof(w));
+		crc64 = _mm_crc32_u64(crc64, w);
+		data = data + 8;
+		len = len - 8;
+	}
+	crc = (uint32_t)crc64;
+#endif
+	while (len-- > 0)
+		crc = _mm_crc32_u8(crc, *data++);
+	return ~crc;
+}
+
+
+bool Crc::has_sse42() {
+	return __builtin_cpu_supports("sse4.2");
+}
+#else
+uint32_t Crc::crc32c_sse42(const unsigned char* data, size_t len) {
+	return crc32c_slice8(data, len);
+}
+
+
+bool Crc::has_sse42() {
+	return false;
+}
+#endif
@@ -0,0 +1,164 @@
+#include "../include/FrameParser.h"
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Bad encoding: everything up to the next delimiter is garbage.
+ */
+void FrameParser::error() {
+	counter_add(&stats.errors, 1);
+	counter_add(&stats.discarded, len);
+	skip = true;
+	skipped = 0;
+	len = 0;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+FrameParser::FrameParser() {
+	reset();
+}
+
+
+/**
+ * Every block starts with a code byte, which is the distance to the next zero
+ * of the message (or 0xFF for a block of 254 bytes without zero).
+ * The zeros are replaced by the code bytes, then the delimiter is appended.
+ */
+unsigned int FrameParser::encode(unsigned char* src, unsigned int len, unsigned char* dst) {
+	unsigned int code_pos = 0;
+	unsigned int out = 1;
+	unsigned char code = 1;
+
+	for (unsigned int i = 0; i < len; i++) {
+		if (src[i] == 0) {
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		} else {
+			dst[out++] = src[i];
+			code++;
+			if (code == 0xFF) {
+				dst[code_pos] = code;
+				code_pos = out++;
+				code = 1;
+			}
+		}
+	}
+
+	dst[code_pos] = code;
+	dst[out++] = FRAME_DELIMITER;
+	return out;
+}
+
+
+/**
+ * Decode on the fly. remaining is the number of data bytes still expected
+ * in the current block; when it reaches 0 the next byte is a code byte,
+ * or the delimiter if the message is complete.
+ * The zero implied by a block is written only when another block follows,
+ * because the last block of a message never implies a zero.
+ */
+int FrameParser::push(unsigned char byte) {
+	counter_add(&stats.bytes, 1);
+
+	///< the message returned by the previous push() is gone
+	if (done) {
+		len = 0;
+		done = false;
+	}
+
+	if (byte == FRAME_DELIMITER) {
+		int ret = 0;
+
+		if (skip) {
+			counter_add(&stats.discarded, skipped + 1);
+		} else if (remaining > 0) {
+			///< message truncated, the delimiter came inside a block
+			error();
+			counter_add(&stats.discarded, 1);
+			ret = -1;
+		} else if (len > 0) {
+			counter_add(&stats.messages, 1);
+			done = true;
+			ret = len;
+		}
+
+		skip = false;
+		skipped = 0;
+		remaining = 0;
+		block_zero = false;
+		return ret;
+	}
+
+	if (skip) {
+		skipped++;
+		return 0;
+	}
+
+	if (remaining == 0) {
+		///< code byte
+		if (block_zero) {
+			if (len >= MAX_MESSAGE_SIZE) {
+				error();
+				return -1;
+			}
+			message[len++] = 0;
+		}
+		remaining = byte - 1;
+		block_zero = (byte < 0xFF);
+		return 0;
+	}
+
+	///< data byte
+	if (len >= MAX_MESSAGE_SIZE) {
+		error();
+		return -1;
+	}
+	message[len++] = byte;
+	remaining--;
+	return 0;
+}
+
+
+/**
+ * Return the decoded message.
+ */
+unsigned char* FrameParser::get_message() {
+	return message;
+}
+
+
+/**
+ * Restart from an empty message. If we were in the middle of a message
+ * the next delimiter finds a bad encoding or a wrong size, and it is dropped.
+ */
+void FrameParser::reset() {
+	len = 0;
+	remaining = 0;
+	block_zero = false;
+	skip = false;
+	skipped = 0;
+	done = false;
+}
+
+
+/**
+ * Return the statistics. Relaxed: each counter is exact, but they are not
+ * read at the same instant while bytes are pushed.
+ */
+parser_stats FrameParser::get_stats() {
+	parser_stats ret;
+
+	ret.bytes = stats.bytes.load(std::memory_order_relaxed);
+	ret.messages = stats.messages.load(std::memory_order_relaxed);
+	ret.errors = stats.errors.load(std::memory_order_relaxed);
+	ret.discarded = stats.discarded.load(std::memory_order_relaxed);
+	return ret;
+}
@@ -0,0 +1,116 @@
+#include "../include/FrameRing.h"
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+FrameRing::FrameRing() : head(0), tail(0), high_water(0), drops(0) {
+}
+
+
+FrameRing::~FrameRing() {
+	delete[] slots;
+}
+
+
+/**
+ * head and tail run freely and are masked on access,
+ * so tail - head is always the number of queued frames.
+ */
+int FrameRing::init(unsigned int capacity) {
+	unsigned int size = 1;
+
+	while (size < capacity)
+		size = size * 2;
+
+	delete[] slots;
+	slots = new frame[size];
+	mask = size - 1;
+	head.store(0);
+	tail.store(0);
+	high_water.store(0);
+	drops.store(0);
+
+	return 0;
+}
+
+
+/**
+ * Drop all the queued frames. Only head moves, so the producer
+ * may keep pushing meanwhile.
+ */
+void FrameRing::clear() {
+	head.store(tail.load());
+}
+
+
+/**
+ * The slot is written before tail is published (release), so the consumer
+ * that reads tail (acquire) always sees a complete frame.
+ */
+bool FrameRing::push(frame* f) {
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	unsigned int h = head.load(std::memory_order_acquire);
+
+	if (t - h > mask) {
+		drops.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	slots[t & mask] = *f;
+	tail.store(t + 1, std::memory_order_release);
+
+	if (t + 1 - h > high_water.load(std::memory_order_relaxed))
+		high_water.store(t + 1 - h, std::memory_order_relaxed);
+
+	return true;
+}
+
+
+/**
+ * The frame is copied before head is published,
+ * so the producer can not overwrite it while we read.
+ */
+bool FrameRing::pop(frame* f) {
+	unsigned int h = head.load(std::memory_order_relaxed);
+	unsigned int t = tail.load(std::memory_order_acquire);
+
+	if (h == t)
+		return false;
+
+	*f = slots[h & mask];
+	head.store(h + 1, std::memory_order_release);
+
+	return true;
+}
+
+
+/**
+ * Frames between head and tail.
+ */
+unsigned int FrameRing::size() {
+	return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+}
+
+
+/**
+ * Free slots.
+ */
+unsigned int FrameRing::space() {
+	return mask + 1 - size();
+}
+
+
+/**
+ * Return the statistics.
+ */
+ring_stats FrameRing::get_stats() {
+	ring_stats stats;
+	stats.capacity = mask + 1;
+	stats.high_water = high_water.load(std::memory_order_relaxed);
+	stats.popped = head.load(std::memory_order_relaxed);
+	stats.pushed = tail.load(std::memory_order_relaxed);
+	stats.drops = drops.load(std::memory_order_relaxed);
+	return stats;
+}
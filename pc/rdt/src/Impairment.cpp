@@ -0,0 +1,279 @@
+
+#include <math.h>
+#include <limits.h>
+
+#include "../include/Impairment.h"
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Never 0 nor 1, the logarithms below stay finite.
+ */
+double Impairment::uniform() {
+	return (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+
+/**
+ * The distance between two bit errors is geometric. Without errors,
+ * or with a distance too large for the counter, there is no next error.
+ */
+void Impairment::draw_error() {
+	if (config.ber >= 1) {
+		next_error = 0;
+		return;
+	}
+	if (config.ber <= 0) {
+		next_error = ULLONG_MAX;
+		return;
+	}
+
+	double distance = log(uniform()) / log(1.0 - config.ber);
+	next_error = (distance < (double)ULLONG_MAX) ? (unsigned long long)distance : ULLONG_MAX;
+}
+
+
+/**
+ * Gilbert model: every frame in the bad state is lost. The bad state
+ * lasts burst frames on average, and is entered often enough to give
+ * the loss rate.
+ */
+bool Impairment::lose() {
+	if (config.loss <= 0)
+		return false;
+	if (config.loss >= 1)
+		return true;
+	if (config.burst <= 1)
+		return uniform() < config.loss;
+
+	double leave = 1.0 / config.burst;
+	double enter = config.loss * leave / (1.0 - config.loss);
+
+	if (bad)
+		bad = uniform() >= leave;
+	else
+		bad = uniform() < enter;
+	return bad;
+}
+
+
+/**
+ * The errors hit the bytes on the wire without the check, header
+ * included: the check of the frame finds them, or not.
+ */
+bool Impairment::corrupt(frame* f) {
+	unsigned long long bits = 8ULL * FRAME_SIZE(f);
+	unsigned long long bit = 0;
+	unsigned char* bytes = FRAME_BYTES(f);
+	bool flipped = false;
+
+	while (next_error < bits - bit) {
+		bit = bit + next_error;
+		bytes[bit / 8] ^= 1 << (bit % 8);
+		flipped = true;
+		bit = bit + 1;
+		draw_error();
+	}
+	next_error = next_error - (bits - bit);
+	return flipped;
+}
+
+
+bool Impairment::before(unsigned int a, unsigned int b) {
+	if (heap[a].release != heap[b].release)
+		return heap[a].release < heap[b].release;
+	return heap[a].order < heap[b].order;
+}
+
+
+/**
+ * Insert in the heap, sift up.
+ */
+void Impairment::hold(frame* f, unsigned long long release) {
+	if (held == IMPAIRMENT_QUEUE) {
+		stats.overflows++;
+		return;
+	}
+
+	unsigned int i = held++;
+	heap[i].release = release;
+	heap[i].order = order++;
+	heap[i].f = *f;
+
+	while (i > 0 && before(i, (i - 1) / 2)) {
+		held_frame tmp = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+
+	if (held > stats.high_water)
+		stats.high_water = held;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+Impairment::Impairment() {
+}
+
+
+Impairment::~Impairment() {
+	delete[] heap;
+}
+
+
+/**
+ * The queue is allocated the first time the link is not perfect.
+ */
+void Impairment::configure(const impairment_config* config, unsigned int seed) {
+	if (config != NULL)
+		this->config = *config;
+	else
+		this->config = impairment_config();
+
+	this->seed = seed;
+	bad = false;
+	last_release = 0;
+	draw_error();
+	clear();
+
+	if (active() && heap == NULL)
+		heap = new held_frame[IMPAIRMENT_QUEUE];
+}
+
+
+/**
+ * Return the impairments in use.
+ */
+impairment_config Impairment::get_config() {
+	return config;
+}
+
+
+/**
+ * Check if any impairment is set.
+ */
+bool Impairment::active() {
+	return config.loss > 0 || config.ber > 0 || config.duplicate > 0 || config.reorder > 0
+		|| config.delay > 0 || config.jitter > 0;
+}
+
+
+/**
+ * The jitter never lets a frame overtake the previous one, as on a
+ * serial line; only the frames held back by reorder are overtaken.
+ * A damaged length loses the frame, as the physical layer does.
+ */
+void Impairment::push(frame* f, unsigned long long now) {
+	stats.frames++;
+
+	if (lose()) {
+		stats.lost++;
+		return;
+	}
+
+	if (config.ber > 0) {
+		unsigned short len = f->info.len;
+		if (corrupt(f)) {
+			stats.corrupted++;
+			if (f->info.len != len) {
+				stats.lost++;
+				return;
+			}
+		}
+	}
+
+	unsigned long long release = now + config.delay;
+	if (config.jitter > 0) {
+		if (config.distribution == jitter_exponential)
+			release = release + (unsigned long long)(-log(uniform()) * config.jitter);
+		else
+			release = release + (unsigned long long)(uniform() * config.jitter);
+	}
+
+	if (config.reorder > 0 && uniform() < config.reorder) {
+		stats.reordered++;
+		release = release + config.reorder_delay;
+	} else {
+		if (release < last_release)
+			release = last_release;
+		last_release = release;
+	}
+
+	hold(f, release);
+
+	if (config.duplicate > 0 && uniform() < config.duplicate) {
+		stats.duplicated++;
+		hold(f, release);
+	}
+}
+
+
+/**
+ * Remove the root of the heap, sift down.
+ */
+bool Impairment::pop(frame* f, unsigned long long now) {
+	if (!due(now))
+		return false;
+
+	*f = heap[0].f;
+	heap[0] = heap[--held];
+
+	unsigned int i = 0;
+	while (true) {
+		unsigned int first = i;
+		unsigned int l = 2 * i + 1;
+		unsigned int r = 2 * i + 2;
+
+		if (l < held && before(l, first))
+			first = l;
+		if (r < held && before(r, first))
+			first = r;
+		if (first == i)
+			break;
+
+		held_frame tmp = heap[i];
+		heap[i] = heap[first];
+		heap[first] = tmp;
+		i = first;
+	}
+	return true;
+}
+
+
+/**
+ * Check the root of the heap.
+ */
+bool Impairment::due(unsigned long long now) {
+	return held > 0 && heap[0].release <= now;
+}
+
+
+/**
+ * Return the release time of the root.
+ */
+unsigned long long Impairment::next_release() {
+	return held > 0 ? heap[0].release : 0;
+}
+
+
+/**
+ * Empty the heap.
+ */
+void Impairment::clear() {
+	held = 0;
+}
+
+
+/**
+ * Return the statistics.
+ */
+impairment_stats Impairment::get_stats() {
+	return stats;
+}
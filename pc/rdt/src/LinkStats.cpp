@@ -0,0 +1,220 @@
+#include "../include/LinkStats.h"
+
+
+/**
+ * Names and descriptions of the counters, in the order of link_counter
+ */
+static const struct {
+	const char* name;
+	const char* help;
+} counter_info[LINK_COUNTERS] = {
+	{"frames_sent", "Frames written, all kinds."},
+	{"data_sent", "Data frames written, retransmissions included."},
+	{"retransmits", "Data frames written again."},
+	{"acks_sent", "Ack frames written."},
+	{"naks_sent", "Nak frames written."},
+	{"sacks_sent", "Sack frames written."},
+	{"parity_sent", "Parity frames written."},
+	{"frames_received", "Frames received, damaged ones included."},
+	{"data_received", "Undamaged data frames received."},
+	{"data_discarded", "Undamaged data frames not accepted: copies, out of window or out of order."},
+	{"naks_received", "Undamaged nak frames received."},
+	{"cksum_errors", "Frames that failed the check."},
+	{"timeouts", "Retransmission timeouts."},
+	{"ack_timeouts", "Acks sent by the ack timer, not piggybacked."},
+	{"ring_drops", "Frames lost because the receive ring was full."},
+	{"messages_sent", "Messages sent."},
+	{"messages_received", "Messages received."},
+	{"bytes_sent", "User bytes of the messages sent."},
+	{"bytes_received", "User bytes of the messages received."},
+};
+
+
+/**
+ * Prometheus histogram: the buckets are cumulative, one per power of 2.
+ * A power of 2 is always the first value of a bucket, so le = 2^k - 1
+ * is exact.
+ */
+static void write_histogram_prometheus(FILE* file, const char* name, const char* help,
+		const histogram_snapshot* h, unsigned int link) {
+	unsigned long long cumulative = 0;
+	unsigned int i = 0;
+
+	fprintf(file, "# HELP rdt_%s_microseconds %s\n", name, help);
+	fprintf(file, "# TYPE rdt_%s_microseconds histogram\n", name);
+	for (unsigned int k = 0; k <= HISTOGRAM_EXPORT_BITS; k++) {
+		unsigned long long le = (1ULL << k) - 1;
+		for (; i < Histogram::bucket(le + 1); i++)
+			cumulative = cumulative + h->buckets[i];
+		fprintf(file, "rdt_%s_microseconds_bucket{link=\"%u\",le=\"%llu\"} %llu\n", name, link, le, cumulative);
+	}
+	fprintf(file, "rdt_%s_microseconds_bucket{link=\"%u\",le=\"+Inf\"} %llu\n", name, link, h->count);
+	fprintf(file, "rdt_%s_microseconds_sum{link=\"%u\"} %llu\n", name, link, h->sum);
+	fprintf(file, "rdt_%s_microseconds_count{link=\"%u\"} %llu\n", name, link, h->count);
+}
+
+
+/**
+ * JSON histogram: the summary, not the buckets.
+ */
+static void write_histogram_json(FILE* file, const char* name, const histogram_snapshot* h) {
+	fprintf(file, "\"%s_us\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu, \"mean\": %.1f, "
+		"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu}",
+		name, h->count, h->sum, h->max, h->count > 0 ? (double)h->sum / h->count : 0.0,
+		Histogram::percentile(h, 0.5), Histogram::percentile(h, 0.9),
+		Histogram::percentile(h, 0.99), Histogram::percentile(h, 0.999));
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+Histogram::Histogram() : count(0), sum(0), max(0) {
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		buckets[i].store(0);
+}
+
+
+/**
+ * Only the writer changes max, a load and a store are enough.
+ */
+void Histogram::record(unsigned long long value) {
+	buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+/**
+ * The count is the sum of the buckets copied, so the percentiles
+ * stay consistent even if values are recorded meanwhile.
+ */
+void Histogram::snapshot(histogram_snapshot* snapshot) {
+	snapshot->count = 0;
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		snapshot->buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		snapshot->count = snapshot->count + snapshot->buckets[i];
+	}
+	snapshot->sum = sum.load(std::memory_order_relaxed);
+	snapshot->max = max.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * The values below HISTOGRAM_SUB have a bucket each. Above, the power
+ * of 2 chooses a group of HISTOGRAM_SUB buckets, and the bits that
+ * follow the leading one the bucket in the group.
+ */
+unsigned int Histogram::bucket(unsigned long long value) {
+	if (value < HISTOGRAM_SUB)
+		return value;
+
+	unsigned int e = 63 - __builtin_clzll(value);
+	if (e >= HISTOGRAM_BITS)
+		return HISTOGRAM_BUCKETS - 1;
+
+	return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB + ((value >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+
+/**
+ * The inverse of bucket().
+ */
+unsigned long long Histogram::lowest(unsigned int i) {
+	if (i < HISTOGRAM_SUB)
+		return i;
+
+	unsigned int e = i / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+	unsigned long long sub = i % HISTOGRAM_SUB;
+
+	return (1ULL << e) + (sub << (e - HISTOGRAM_SUB_BITS));
+}
+
+
+/**
+ * Walk the buckets until the fraction of the values is reached.
+ */
+unsigned long long Histogram::percentile(const histogram_snapshot* snapshot, double q) {
+	if (snapshot->count == 0)
+		return 0;
+
+	unsigned long long target = (unsigned long long)(q * snapshot->count + 0.999999);
+	unsigned long long cumulative = 0;
+
+	if (target == 0)
+		target = 1;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		cumulative = cumulative + snapshot->buckets[i];
+		if (cumulative >= target) {
+			unsigned long long highest = lowest(i + 1) - 1;
+			return (highest < snapshot->max) ? highest : snapshot->max;
+		}
+	}
+	return snapshot->max;
+}
+
+
+LinkStats::LinkStats() {
+	for (unsigned int i = 0; i < LINK_COUNTERS; i++)
+		counters[i].store(0);
+}
+
+
+/**
+ * Relaxed: the counters do not order anything.
+ */
+void LinkStats::count(link_counter counter, unsigned long long n) {
+	counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+
+/**
+ * Copy the counters, then the histograms.
+ */
+void LinkStats::snapshot(link_snapshot* snapshot) {
+	for (unsigned int i = 0; i < LINK_COUNTERS; i++)
+		snapshot->counters[i] = counters[i].load(std::memory_order_relaxed);
+	rtt.snapshot(&snapshot->rtt);
+	latency.snapshot(&snapshot->latency);
+}
+
+
+/**
+ * Return the name of a counter.
+ */
+const char* LinkStats::name(link_counter counter) {
+	return counter_info[counter].name;
+}
+
+
+/**
+ * The counters are Prometheus counters (_total), the histograms
+ * Prometheus histograms; every sample has the link label.
+ */
+int LinkStats::write(FILE* file, const link_snapshot* snapshot, export_format format, unsigned int link) {
+	if (format == export_prometheus) {
+		for (unsigned int i = 0; i < LINK_COUNTERS; i++) {
+			fprintf(file, "# HELP rdt_%s_total %s\n", counter_info[i].name, counter_info[i].help);
+			fprintf(file, "# TYPE rdt_%s_total counter\n", counter_info[i].name);
+			fprintf(file, "rdt_%s_total{link=\"%u\"} %llu\n", counter_info[i].name, link, snapshot->counters[i]);
+		}
+		write_histogram_prometheus(file, "rtt", "Round trip time, one sample per ack of new frames.", &snapshot->rtt, link);
+		write_histogram_prometheus(file, "latency", "Time of a message sent, handshake included.",
+			&snapshot->latency, link);
+	} else {
+		fprintf(file, "{\"link\": %u, \"counters\": {", link);
+		for (unsigned int i = 0; i < LINK_COUNTERS; i++)
+			fprintf(file, "%s\"%s\": %llu", i > 0 ? ", " : "", counter_info[i].name, snapshot->counters[i]);
+		fprintf(file, "}, ");
+		write_histogram_json(file, "rtt", &snapshot->rtt);
+		fprintf(file, ", ");
+		write_histogram_json(file, "latency", &snapshot->latency);
+		fprintf(file, "}\n");
+	}
+
+	return ferror(file) ? -1 : 0;
+}
@@ -7,172 +7,347 @@
 // ------------------------------------------------------------------------- //
 
 /**
- * Convert the user baudrate 9600 into a terios baudrate B9600
- * using the conversion table
+ * Frames have different sizes, so the bytes are read in rx_buf and a frame
+ * is taken out once its header and its payload are there; a partial frame
+ * is moved at the start of rx_buf and completed by the next read.
+ * A length field out of range means the stream is not aligned any more:
+ * without framing there is no way to find the next frame, drop everything.
  */
-int PhysicalLayer::get_baudrate(unsigned int rawrate) {
+int PhysicalLayer::read_raw(unsigned char* buff, unsigned int len) {
+	unsigned int nread = 0;
 
-	for (unsigned int i = 0; i < sizeof(conversiontable) / sizeof(conversiontable[0]); i++) {
-		if (conversiontable[i].rawrate == rawrate) {
-			return conversiontable[i].termiosrate;
+	while (nread + sizeof(frame) <= len) {
+		unsigned int avail = rx_len - rx_pos;
+
+		if (avail >= FRAME_HEADER_SIZE) {
+			unsigned int size = wire_size(rx_buf + rx_pos);
+
+			if (size == 0) {
+				counter_add(&rx.bad_frames, 1);
+				rx_pos = 0;
+				rx_len = 0;
+				continue;
+			}
+			if (avail >= size) {
+				from_wire((frame*)(buff + nread), rx_buf + rx_pos, size);
+				rx_pos = rx_pos + size;
+				nread = nread + sizeof(frame);
+				counter_add(&rx.frames, 1);
+				if (startup.first_frame == 0)
+					startup.first_frame = get_tick() - init_time;
+				continue;
+			}
 		}
+
+		memmove(rx_buf, rx_buf + rx_pos, avail);
+		rx_pos = 0;
+		rx_len = avail;
+
+		int bytes = transport->read(rx_buf + rx_len, sizeof(rx_buf) - rx_len);
+
+		if (bytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return nread > 0 ? (int)nread : -1;
+		}
+		if (bytes == 0)
+			break;
+
+		rx_len = rx_len + bytes;
+		counter_add(&rx.bytes, bytes);
 	}
-	return -1;
+	return nread;
 }
 
 
 /**
- * First we check if there are at least the bytes to compose a frame.
- * If there are read a number of bytes equal or multiple of the size of a frame
- * let's not read anything
+ * The payload length is the last field of the header.
  */
-int PhysicalLayer::read_frames(unsigned char* buff, unsigned int len) {
-	if (len > 0) {
-		fd_set rfds;
-		struct timeval tv;
-		int retval;
-		unsigned int bytes = 0;
+unsigned int PhysicalLayer::wire_size(const unsigned char* message) {
+	unsigned short len;
+	memcpy(&len, message + FRAME_HEADER_SIZE - sizeof(len), sizeof(len));
+
+	if (len > MAX_PKT_SIZE)
+		return 0;
+	return FRAME_HEADER_SIZE + len + check_size;
+}
+
 
-		FD_ZERO(&rfds);
-		FD_SET(file_desc, &rfds);
+/**
+ * The check is little endian, whatever its size.
+ */
+void PhysicalLayer::from_wire(frame* f, const unsigned char* message, unsigned int len) {
+	memcpy(FRAME_BYTES(f), message, len - check_size);
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 10;
+	f->checksum = 0;
+	for (unsigned int i = 0; i < check_size; i++)
+		f->checksum = f->checksum | ((uint32_t)message[len - check_size + i] << (8 * i));
+}
 
-		retval = select(file_desc + 1, &rfds, NULL, NULL, &tv);
 
-		if (retval < 0)
-			return -1;
+unsigned int PhysicalLayer::to_wire(frame* f, unsigned char* dst) {
+	unsigned int len = FRAME_SIZE(f);
 
-		if (retval > 0) {
-			if (FD_ISSET(file_desc, &rfds)) {
-				ioctl(file_desc, FIONREAD, &bytes);
-				if (bytes >= sizeof(frame)) {
-					bytes = bytes - (bytes % sizeof(frame));
-					int nread = read(file_desc, buff, bytes);
-					FD_CLR(file_desc, &rfds);
-					return nread;
-				}
+	memcpy(dst, FRAME_BYTES(f), len);
+	for (unsigned int i = 0; i < check_size; i++)
+		dst[len++] = (f->checksum >> (8 * i)) & 0xff;
+	return len;
+}
+
+
+/**
+ * Read whatever the transport has (any partial read is fine) and push it
+ * byte by byte into the parser. The bytes after a complete message are
+ * kept in rx_buf for the next call.
+ */
+int PhysicalLayer::next_message() {
+	while (true) {
+		if (rx_pos == rx_len) {
+			rx_pos = 0;
+			rx_len = 0;
+
+			int bytes = transport->read(rx_buf, sizeof(rx_buf));
+
+			if (bytes < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				return -1;
 			}
+			if (bytes == 0)
+				return 0;
+
+			rx_len = bytes;
+			counter_add(&rx.bytes, bytes);
+		}
+
+		int len = parser.push(rx_buf[rx_pos++]);
+
+		if (len == 1 && parser.get_message()[0] == CONNECT) {
+			counter_add(&rx.connects, 1);
+			if (connect_frames)
+				return len;
+			connects++;
+		} else if (len == 1 && parser.get_message()[0] == PROBE) {
+			///< the peer (re)started: answer, and repeat a connect it may have missed.
+			///< This may run on the RX thread, the protocol thread writes the replies
+			ready_reply.store(true);
+			if (connect_pending.load())
+				connect_reply.store(true);
+		} else if (len == 1 && parser.get_message()[0] == READY) {
+			if (!peer_ready)
+				startup.ready = get_tick() - init_time;
+			peer_ready = true;
+		} else if (len >= (int)FRAME_HEADER_SIZE && (int)wire_size(parser.get_message()) == len) {
+			///< the COBS delimiter gives the size, it must be the one in the header
+			counter_add(&rx.frames, 1);
+			if (startup.first_frame == 0)
+				startup.first_frame = get_tick() - init_time;
+			connect_pending = false;
+			return len;
+		} else if (len != 0) {
+			counter_add(&rx.bad_frames, 1);
 		}
-		FD_CLR(file_desc, &rfds);
 	}
-	return 0;
 }
 
 
 /**
- * We wait until there is space in the file descitpor to write a frame.
- * When the space is available we write a frame 
- * and return the number of bytes written.
+ * Fill the buffer with as many frames as possible.
  */
-int PhysicalLayer::write_frames(unsigned char* buff, unsigned int len) {
-	if (len > 0)
-		return write(file_desc, buff, len);
-	return 0;
-}
+int PhysicalLayer::read_frames(unsigned char* buff, unsigned int len) {
+	if (framing == framing_raw)
+		return read_raw(buff, len);
 
+	unsigned int nread = 0;
+
+	while (nread + sizeof(frame) <= len) {
+		int ret = next_message();
+
+		if (ret < 0)
+			return nread > 0 ? (int)nread : -1;
+		if (ret == 0)
+			break;
+
+		if (ret == 1) {
+			///< connect message, passed on as a frame of kind CONNECT
+			memset(buff + nread, 0, sizeof(frame));
+			((frame*)(buff + nread))->kind = CONNECT;
+		} else {
+			from_wire((frame*)(buff + nread), parser.get_message(), ret);
+		}
+		nread = nread + sizeof(frame);
+	}
+	return nread;
+}
 
-// ------------------------------------------------------------------------- //
-// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
-// ------------------------------------------------------------------------- //
 
 /**
- * Gets the current time.
+ * Control messages are not batched: the peer waits for them.
  */
-unsigned long long PhysicalLayer::get_tick() {
-	struct timeval current_time;
-	gettimeofday(&current_time, NULL);
+int PhysicalLayer::send_control(unsigned char c) {
+	if (framing == framing_raw)
+		return transport->write(&c, 1);
 
-	unsigned long long tick = (current_time.tv_sec * 1000) + (current_time.tv_usec / 1000);
-	return tick;
+	unsigned char message[COBS_MAX_SIZE(1)];
+	unsigned int len = FrameParser::encode(&c, 1, message);
+	return transport->write(message, len);
 }
 
 
 /**
- * Init the serial connection using termios struct.
- * Set the serial port parameters to raw mode and the baudrate given by user.
- * Then flush the file descriptor with a timeout.
- * This flush() is needed for one reason:
- * Having tcsetattr(), that flush the RX/TX buffer no timeout,
- * being the serial transmission low, it could be possible
- * that tcsetattr() flush empty buffer and data arrives soon after,
- * leaving the buffer dirty.
- * For this a flush with timeout is needed.
+ * Send a probe every PROBE_INTERVAL and parse what comes back, until READY.
+ * A board that was reset by the open answers as soon as its setup is done,
+ * one that was already running answers at once. Frames and partial
+ * messages received meanwhile are left over from before: dropped.
+ * A connect is kept, the sketch may send it right after READY.
  */
-int PhysicalLayer::init(const char* device, unsigned int baudrate) {
+int PhysicalLayer::probe(unsigned long long timeout) {
+	unsigned long long start = get_tick();
 
-	int retry = 0;
+	while (!peer_ready && get_tick() - start < timeout) {
+		if (send_control(PROBE) < 0 && errno != EAGAIN)
+			return -1;
+		startup.probes++;
 
-	while (retry <= 5) {
-		file_desc = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
+		unsigned long long next = get_tick() + PROBE_INTERVAL;
+		unsigned long long now;
 
-		if (file_desc != -1)
-			break;
-		retry++;
+		while (!peer_ready && (now = get_tick()) < next) {
+			int ret = next_message();
+			if (ret < 0)
+				return -1;
+			if (ret == 0 && !peer_ready)
+				wait(next - now);
+		}
+	}
+	return peer_ready ? 1 : 0;
+}
 
-		printf("Open() failed: device = %s, attempt number %d of 5\n", device, retry);
 
-		if (retry == 5)
+/**
+ * Frames are not written one by one: they are appended to tx_buf and
+ * written together by flush_tx(), when the protocol has nothing else to do
+ * or when the batch is full. With COBS framing every frame is encoded
+ * on its own, so a damaged frame does not affect the others.
+ * Only the header and the used part of the payload go on the wire.
+ */
+int PhysicalLayer::write_frames(unsigned char* buff, unsigned int len) {
+	if (len > 0) {
+		if (len % sizeof(frame) != 0)
 			return -1;
 
-		usleep(1000000);
-	}
+		for (unsigned int i = 0; i < len; i = i + sizeof(frame)) {
+			frame* f = (frame*)(buff + i);
 
+			if (f->info.len > MAX_PKT_SIZE)
+				return -1;
 
-	termios serialPortSettings;
+			if (tx_len + COBS_MAX_SIZE(FRAME_SIZE(f) + check_size) > sizeof(tx_buf) && flush_tx() < 0)
+				return -1;
 
-	if (tcgetattr(file_desc, &serialPortSettings) < 0) {
-		perror("tcgetattr() failed: ");
-		return -1;
+			if (framing == framing_cobs) {
+				unsigned char wire[sizeof(frame)];
+				unsigned int n = to_wire(f, wire);
+				tx_len = tx_len + FrameParser::encode(wire, n, tx_buf + tx_len);
+			} else {
+				tx_len = tx_len + to_wire(f, tx_buf + tx_len);
+			}
+			stats.frames++;
+		}
+		return len;
 	}
+	return 0;
+}
 
-	// ----- CONTROL OPTIONS ----- //
-	// Setting parity checking, setting hardware flow control
-	serialPortSettings.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS);
 
-	// 8 data bits, enable receiver, local line - do not change "owner" of port
-	serialPortSettings.c_cflag |= (CS8 | CREAD | CLOCAL);
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
 
-	// ----- INPUT OPTIONS ----- //
-	// Disable software flow control (ICRNL ignore carriage return on input)
-	serialPortSettings.c_iflag &= ~(IXON | IXOFF | IXANY | IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+/**
+ * Gets the current time in microseconds.
+ * CLOCK_MONOTONIC never jumps: a NTP step or a date change
+ * can not fire or suppress the protocol timers.
+ */
+unsigned long long PhysicalLayer::get_tick() {
+	struct timespec current_time;
+	clock_gettime(CLOCK_MONOTONIC, &current_time);
 
-	// ----- LINE OPTIONS ----- //
-	// Choosing Raw Input (Raw input is unprocessed)
-	serialPortSettings.c_lflag &= ~(ECHO | ECHOE | ECHONL | ICANON | ISIG | IEXTEN);
+	unsigned long long tick = (current_time.tv_sec * 1000000ULL) + (current_time.tv_nsec / 1000);
+	return tick;
+}
 
-	// ----- OUTPUT OPTIONS ----- //
-	// Choosing Raw Output
-	serialPortSettings.c_oflag &= ~OPOST;
 
-	// ----- CONTROL CHARACTERS ----- //
-	// Minimum number of characters to read
-	serialPortSettings.c_cc[VMIN]  = 0;
-	// Time to wait for data (tenths of seconds)
-	serialPortSettings.c_cc[VTIME] = 10;
+/**
+ * Init the connection creating the transport from the device string,
+ * by default a serial port (see Transport::create()). The transport is
+ * ours: deleted by end(), or here if it can not be opened.
+ */
+int PhysicalLayer::init(const char* device, unsigned int baudrate) {
+	Transport* t = Transport::create(device, baudrate);
 
-	// Setting the Baud Rate
-	int baud = get_baudrate(baudrate);
+	if (t == NULL)
+		return -1;
 
-	if (cfsetispeed(&serialPortSettings, baud) < 0 || cfsetospeed(&serialPortSettings, baud) < 0) {
-		perror("cfsetXspeed() failed: ");
+	int ret = init(t);
+	if (ret < 0) {
+		delete t;
+		transport = NULL;
 		return -1;
 	}
+	own_transport = true;
+	return ret;
+}
+
+
+/**
+ * Init the connection opening the given transport.
+ */
+int PhysicalLayer::init(Transport* transport) {
+	this->transport = transport;
+	own_transport = false;
+
+	init_time = get_tick();
+	peer_ready = false;
+	startup = {};
 
-	// Flush input and output buffers and make the change
-	if (tcsetattr(file_desc, TCSAFLUSH, &serialPortSettings) < 0) {
-		perror("tcsetattr() failed: ");
+	int file_desc = transport->open();
+	if (file_desc < 0)
+		return -1;
+
+	epoll_desc = epoll_create1(0);
+	if (epoll_desc < 0) {
+		perror("epoll_create1() failed: ");
+		transport->close();
 		return -1;
 	}
 
-	flush(1);
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = file_desc;
+	if (epoll_ctl(epoll_desc, EPOLL_CTL_ADD, file_desc, &ev) < 0) {
+		perror("epoll_ctl() failed: ");
+		::close(epoll_desc);
+		transport->close();
+		return -1;
+	}
 
-	// Arduino boot time: 1.7 seconds
-	usleep(1700000);
+	startup.open = get_tick() - init_time;
 
-	return file_desc;
+	if (transport->needs_probe()) {
+		int ret = probe(READY_TIMEOUT);
+		if (ret < 0) {
+			::close(epoll_desc);
+			transport->close();
+			return -1;
+		}
+		if (ret == 0)
+			printf("Peer not ready after %llu us, going on\n", get_tick() - init_time);
+		else
+			printf("Peer ready after %llu us, %u probes\n", startup.ready, startup.probes);
+	}
 
+	return file_desc;
 }
 
 
@@ -182,23 +357,46 @@ int PhysicalLayer::init(const char* device, unsigned int baudrate) {
  */
 int PhysicalLayer::connect(char type) {
 	if (type == 's') {
-		unsigned int bytes = 0;
-		ioctl(file_desc, FIONREAD, &bytes);
-		if (bytes > 0) {
-			int nread = -1;
-			char c = 0;
-			nread = read(file_desc, &c, 1);
-			if (nread > 0 && c == CONNECT) {
-				return 1;
+		if (framing == framing_cobs) {
+			///< frames before the connect message are from the previous transfer,
+			///< the ones after it may be the first data of a peer in exchange()
+			bool keep = connect_frames;
+			int ret;
+
+			connect_frames = true;
+			while (connects == 0 && (ret = next_message()) > 0) {
+				if (ret == 1)
+					connects++;
 			}
+			connect_frames = keep;
+			if (connects == 0)
+				return 0;
+			connects--;
+			return 1;
+		}
+		///< the connect byte may already be in rx_buf, read with the last frames:
+		///< all the buffered bytes are scanned, the caller then sleeps on the
+		///< transport and would never wake up for bytes already read
+		while (rx_pos < rx_len) {
+			if (rx_buf[rx_pos++] == CONNECT)
+				return 1;
+		}
+		while (transport->available() > 0) {
+			unsigned char c = 0;
+			if (transport->read(&c, 1) <= 0)
+				break;
+			if (c == CONNECT)
+				return 1;
 		}
 		return 0;
 	} else if (type == 'r') {
-		int nwrite = -1;
-		char c = CONNECT;
-		nwrite = write(file_desc, &c, 1);
-		if (nwrite > 0)
+		///< the connect byte must not overtake the batched frames
+		flush_tx();
+
+		if (send_control(CONNECT) > 0) {
+			connect_pending = true;
 			return 1;
+		}
 		return 0;
 	}
 	return 0;
@@ -213,6 +411,70 @@ int PhysicalLayer::send(frame *f, unsigned int len) {
 }
 
 
+/**
+ * Write the whole batch. The transport is non blocking, so on a short write
+ * we wait for the TX buffer to drain and write the rest: dropping part
+ * of a frame would misalign the stream on the other side. If it does not
+ * drain, the bytes not written stay in tx_buf for the next flush.
+ */
+int PhysicalLayer::flush_tx() {
+	unsigned int sent = 0;
+
+	///< the replies to a probe go first, as if written when it came
+	if (ready_reply.exchange(false))
+		send_control(READY);
+	if (connect_reply.exchange(false))
+		send_control(CONNECT);
+
+	if (tx_len == 0)
+		return 0;
+
+	stats.flushes++;
+
+	while (sent < tx_len) {
+		int written = transport->write(tx_buf + sent, tx_len - sent);
+		stats.writes++;
+
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				pollfd pfd;
+				pfd.fd = transport->get_fd();
+				pfd.events = POLLOUT;
+				if (poll(&pfd, 1, 1000) > 0)
+					continue;
+			}
+			printf("Error write(): written = %d, error = %d\n", written, errno);
+			memmove(tx_buf, tx_buf + sent, tx_len - sent);
+			tx_len = tx_len - sent;
+			stats.bytes = stats.bytes + sent;
+			return -1;
+		}
+
+		sent = sent + written;
+	}
+
+	stats.bytes = stats.bytes + sent;
+	tx_len = 0;
+	return sent;
+}
+
+
+/**
+ * Return true if a probe is not answered yet.
+ */
+bool PhysicalLayer::has_replies() {
+	return ready_reply.load() || connect_reply.load();
+}
+
+
+/**
+ * Return the TX batching statistics.
+ */
+tx_stats PhysicalLayer::get_tx_stats() {
+	return stats;
+}
+
+
 /**
  * Receive frame
  */
@@ -222,10 +484,61 @@ int PhysicalLayer::recv(frame *f, unsigned int len) {
 
 
 /**
- * Close the serial connection
+ * Close the connection. The transport is deleted only if created here.
  */
 int PhysicalLayer::end() {
-	return close(file_desc);
+	flush_tx();
+	::close(epoll_desc);
+	int ret = transport->close();
+	if (own_transport) {
+		delete transport;
+		transport = NULL;
+	}
+	return ret;
+}
+
+
+/**
+ * Block until the transport is readable or the timeout expires.
+ * epoll_pwait2() takes a timespec, so sub millisecond timers are honoured.
+ * On kernels older than 5.11 it fails with ENOSYS and we fall back to
+ * epoll_wait(), rounding the timeout up to the next millisecond:
+ * waking up a bit late is fine, waking up early would only spin.
+ */
+int PhysicalLayer::wait(long long timeout) {
+	///< the kernel is the same for every instance and thread
+	static std::atomic<bool> pwait2_supported{true};
+	epoll_event ev;
+	int ret;
+
+#if defined(__GLIBC_PREREQ) && __GLIBC_PREREQ(2, 35)
+	if (pwait2_supported.load(std::memory_order_relaxed)) {
+		timespec ts;
+		ts.tv_sec = timeout / 1000000;
+		ts.tv_nsec = (timeout % 1000000) * 1000;
+
+		ret = epoll_pwait2(epoll_desc, &ev, 1, timeout >= 0 ? &ts : NULL, NULL);
+
+		if (ret >= 0 || errno != ENOSYS) {
+			if (ret < 0 && errno == EINTR)
+				return 0;
+			return ret;
+		}
+		pwait2_supported.store(false, std::memory_order_relaxed);
+	}
+#else
+	pwait2_supported.store(false, std::memory_order_relaxed);
+#endif
+
+	int ms = -1;
+	if (timeout >= 0)
+		ms = (int)((timeout + 999) / 1000);
+
+	ret = epoll_wait(epoll_desc, &ev, 1, ms);
+
+	if (ret < 0 && errno == EINTR)
+		return 0;
+	return ret;
 }
 
 
@@ -239,7 +552,63 @@ void PhysicalLayer::flush(unsigned long long timeout) {
 	unsigned long long startTime = get_tick();
 	while (get_tick() - startTime < timeout);
 
-	read(file_desc, trash, sizeof(trash));
+	transport->read(trash, sizeof(trash));
+
+	parser.reset();
+	rx_pos = 0;
+	rx_len = 0;
+	connects = 0;
+}
+
+
+/**
+ * Return the startup times.
+ */
+startup_stats PhysicalLayer::get_startup_stats() {
+	return startup;
+}
+
+
+/**
+ * Set the size of the check.
+ */
+void PhysicalLayer::set_check_size(unsigned int size) {
+	check_size = size;
+}
+
+
+/**
+ * Keep connect messages in the frame stream.
+ */
+int PhysicalLayer::set_connect_frames(bool enable) {
+	if (enable && framing != framing_cobs)
+		return -1;
+	connect_frames = enable;
+	return 0;
+}
+
+
+/**
+ * Set the framing.
+ */
+void PhysicalLayer::set_framing(framing_type framing) {
+	this->framing = framing;
+}
+
+
+/**
+ * Return the receive statistics, including the ones of the parser.
+ */
+rx_stats PhysicalLayer::get_rx_stats() {
+	parser_stats p = parser.get_stats();
+	rx_stats ret;
+
+	ret.bytes = rx.bytes.load(std::memory_order_relaxed);
+	ret.frames = rx.frames.load(std::memory_order_relaxed);
+	ret.bad_frames = rx.bad_frames.load(std::memory_order_relaxed) + p.errors;
+	ret.discarded = p.discarded;
+	ret.connects = rx.connects.load(std::memory_order_relaxed);
+	return ret;
 }
 
 /*
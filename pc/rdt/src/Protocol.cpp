@@ -9,21 +9,21 @@
 /**
  * Checks if b is between a and c in a circular manner
  */
-bool Protocol::between(unsigned char a, unsigned char b, unsigned char c) {
+bool Protocol::between(seq_nr a, seq_nr b, seq_nr c) {
 	return ((a <= b) && (b < c)) || ((c < a) && (a <= b)) || ((b < c) && (c < a));
 }
 
 /**
  * Set max sequence number.
  */
-void Protocol::set_max_seqnr(unsigned char max_seqnr) {
+void Protocol::set_max_seqnr(seq_nr max_seqnr) {
 	oldest_frame = max_seqnr;
 }
 
 /**
  * Return the timedout sequence number.
  */
-unsigned char Protocol::get_timedout_seqnr(void) {
+seq_nr Protocol::get_timedout_seqnr(void) {
 	return oldest_frame;
 }
 
@@ -34,6 +34,56 @@ void Protocol::set_timeout(unsigned long long timeout) {
 	timeout_interval = timeout;
 }
 
+/**
+ * SRTT + 4 RTTVAR, not below RTO_MIN, doubled for every timeout since
+ * the last good sample and never above the timeout of the user.
+ * Before the first sample the timeout of the user is all we have.
+ */
+unsigned long long Protocol::get_rto(void) {
+	if (rtt.srtt == 0)
+		return timeout_interval;
+
+	unsigned long long rto = rtt.srtt + ((rtt.rttvar > 0) ? 4 * rtt.rttvar : 1);
+	if (rto < RTO_MIN)
+		rto = RTO_MIN;
+
+	for (unsigned int i = 0; i < rtt.backoff && rto < timeout_interval; i++)
+		rto = rto * 2;
+
+	return (rto < timeout_interval) ? rto : timeout_interval;
+}
+
+/**
+ * Return the round trip time statistics.
+ */
+rtt_stats Protocol::get_rtt_stats(void) {
+	rtt_stats stats = rtt;
+	stats.rto = get_rto();
+	return stats;
+}
+
+/**
+ * Jacobson/Karels: the first sample sets SRTT and half of it RTTVAR,
+ * the next ones move SRTT by 1/8 and RTTVAR by 1/4 of the error.
+ * A good sample ends the backoff.
+ */
+void Protocol::rtt_sample(unsigned long long sample) {
+	if (rtt.srtt == 0) {
+		rtt.srtt = (sample > 0) ? sample : 1;
+		rtt.rttvar = sample / 2;
+	} else {
+		unsigned long long err = (sample > rtt.srtt) ? sample - rtt.srtt : rtt.srtt - sample;
+		rtt.rttvar = (3 * rtt.rttvar + err) / 4;
+		rtt.srtt = (7 * rtt.srtt + sample) / 8;
+		if (rtt.srtt == 0)
+			rtt.srtt = 1;
+	}
+	rtt.last = sample;
+	rtt.samples++;
+	rtt.backoff = 0;
+	link.rtt.record(sample);
+}
+
 /**
  * Allow send_ready events to occur.
  */
@@ -53,59 +103,83 @@ void Protocol::disable_protocol(void) {
 /**
  * Set all the member before a new send or receive.
  */
-void Protocol::set_up(unsigned char max_seqnr, unsigned long long timeout, int state) {
+void Protocol::set_up(seq_nr max_seqnr, unsigned long long timeout, int state) {
 	if (state == 0)
 		disable_protocol();
 	else
 		enable_protocol();
 	offset = 0;
-	for (int i = 0; i < WINDOW_SIZE; i++) {
-		seqs[i] = MAX_SEQ + 1;
-		ack_timer[i] = 0;
-		error[i] = false;
+	for (unsigned int i = 0; i < window; i++) {
+		seqs[i] = max_seq;
+		sent_at[i] = 0;
+		resent[i] = false;
 	}
+	acked_sent_at = 0;
 
-	lowest_timer = 0xffffffffffffffff;
+	timers.clear(physical_layer.get_tick());
 	aux_timer = 0;
 
 	set_timeout(timeout);
 	set_max_seqnr(max_seqnr);
-	inp = &queue[0];						///< where to put the next frame
-	outp = &queue[0];						///< where to remove the next frame from
-	nframes = 0;
+
+	///< drop the old frames, but not a connect from the other side
+	frame f;
+	impairment.clear();
+	while (ring.pop(&f)) {
+		if (f.kind == CONNECT)
+			connects++;
+	}
 	next_pkt_fetch = 0;						///< seq of next packet from user to fetch
 	last_pkt_given = 0;
 
 }
 
 
+/**
+ * Only the user buffer positions restart: the frames already queued
+ * may belong to this message.
+ */
+void Protocol::next_message(unsigned long long timeout, int state) {
+	if (state == 0)
+		disable_protocol();
+	else
+		enable_protocol();
+	offset = 0;
+
+	set_timeout(timeout);
+	next_pkt_fetch = 0;
+	last_pkt_given = 0;
+}
+
+
 
 // ----------------------------------------------------------------------------
 // CHECKSUM FUNCTION
 // ----------------------------------------------------------------------------
 
 /**
- * Compute the checksum to send with the data.
+ * The physical layer sends as many bytes of the check as the type needs.
  */
-unsigned char Protocol::compute_checksum(unsigned char data[], size_t num_bytes) {
-	unsigned char sum = 0;
-	for (unsigned int i = 0; i < num_bytes; i++) {
-		sum += data[i];
-	}
-	return ~sum + 1;
+void Protocol::set_check(check_type type) {
+	check = type;
+	physical_layer.set_check_size(Crc::size(type));
 }
 
 
 /**
- * Verify the checksum received with the data.
+ * Compute the checksum to send with the frame, over all the bytes
+ * that go on the wire: a damaged header or ack is detected too.
  */
-unsigned char Protocol::verify_checksum(unsigned char data[], size_t num_bytes, unsigned char checksum) {
-	unsigned char sum = 0;
-	for (unsigned int i = 0; i < num_bytes; i++) {
-		sum += data[i];
-	}
-	sum += checksum;
-	return sum;
+uint32_t Protocol::compute_checksum(frame* f) {
+	return Crc::compute(check, FRAME_BYTES(f), FRAME_SIZE(f));
+}
+
+
+/**
+ * Verify the checksum received with the frame.
+ */
+int Protocol::verify_checksum(frame* f) {
+	return compute_checksum(f) != f->checksum;
 }
 
 
@@ -123,9 +197,31 @@ int Protocol::init(const char* device, int baudrate) {
 
 
 /**
- * Connect and synchronize the sender and receiver
+ * Init the protocol on a transport created by the user.
+ */
+int Protocol::init(Transport* transport) {
+	return physical_layer.init(transport);
+}
+
+
+/**
+ * Connect and synchronize the sender and receiver.
+ * With the RX thread the connect message arrives as a frame in the ring:
+ * the frames before it are from the previous transfer and are dropped.
  */
 int Protocol::connect(char type) {
+	if (type == 's' && rx_running) {
+		frame f;
+
+		while (connects == 0 && ring.pop(&f)) {
+			if (f.kind == CONNECT)
+				connects++;
+		}
+		if (connects == 0)
+			return 0;
+		connects--;
+		return 1;
+	}
 	return physical_layer.connect(type);
 }
 
@@ -134,44 +230,294 @@ int Protocol::connect(char type) {
  * Close the physical layer
  */
 int Protocol::close() {
+	stop_rx_thread();
 	return physical_layer.end();
 }
 
 /**
- * Description
+ * Flush the RX buffer. With the RX thread the bytes are already
+ * in the ring, so the ring is emptied instead, sleeping on the
+ * eventfd until the deadline.
  */
 void Protocol::flush(unsigned long long timeout) {
+	impairment.clear();
+	if (rx_running) {
+		unsigned long long start_time = physical_layer.get_tick();
+		unsigned long long elapsed;
+
+		ring.clear();
+		while ((elapsed = physical_layer.get_tick() - start_time) < timeout) {
+			wait_ring(timeout - elapsed);
+			ring.clear();
+		}
+
+		connects = 0;
+		return;
+	}
 	physical_layer.flush(timeout);
 }
 
 
+/**
+ * Write the batched frames.
+ */
+void Protocol::flush_tx(void) {
+	physical_layer.flush_tx();
+}
+
+
+/**
+ * Return the TX statistics of the physical layer.
+ */
+tx_stats Protocol::get_tx_stats(void) {
+	return physical_layer.get_tx_stats();
+}
+
+
+/**
+ * Return the RX statistics of the physical layer.
+ */
+rx_stats Protocol::get_rx_stats(void) {
+	return physical_layer.get_rx_stats();
+}
+
+
+/**
+ * Return the startup times of the physical layer.
+ */
+startup_stats Protocol::get_startup_stats(void) {
+	return physical_layer.get_startup_stats();
+}
+
+
+/**
+ * Set the framing of the physical layer.
+ */
+void Protocol::set_framing(framing_type framing) {
+	physical_layer.set_framing(framing);
+}
+
+
+/**
+ * Wait for bytes, read the frames and queue them, then wake up the protocol.
+ * The timeout of wait() only bounds the time needed to notice the stop.
+ */
+void* Protocol::rx_loop(void* arg) {
+	Protocol* p = (Protocol*)arg;
+	frame burst[RX_BURST];
+
+	while (p->rx_running.load(std::memory_order_acquire)) {
+		if (p->physical_layer.wait(RX_THREAD_PERIOD) <= 0)
+			continue;
+
+		int reads;
+		while ((reads = p->physical_layer.recv(burst, sizeof(burst))) > 0) {
+			int queued = 0;
+
+			TRACE(TRACE_TIMELINE, trace_enqueue, p->trace_source, 0, reads / sizeof(frame), 0, NULL, 0);
+
+			for (unsigned int i = 0; i < reads / sizeof(frame); i++) {
+				if (p->ring.push(&burst[i]))
+					queued++;
+				else
+					p->link.count(link_ring_drops);
+			}
+
+			if (queued > 0) {
+				uint64_t one = 1;
+				if (write(p->rx_event, &one, sizeof(one)) < 0)
+					printf("Error write(eventfd): error = %d\n", errno);
+			}
+		}
+
+		///< a probe came: wake up the protocol, its flush_tx() answers
+		if (p->physical_layer.has_replies()) {
+			uint64_t one = 1;
+			if (write(p->rx_event, &one, sizeof(one)) < 0)
+				printf("Error write(eventfd): error = %d\n", errno);
+		}
+	}
+	return NULL;
+}
+
+
 // ------------------------------------------------------------------------- //
 // ---------------------------- PUBLIC FUNCTIONS --------------------------- //
 // ------------------------------------------------------------------------- //
 
+Protocol::Protocol() : rx_running(false) {
+	set_window(WINDOW_SIZE, MAX_SEQ);
+}
+
+
+Protocol::~Protocol() {
+	delete[] seqs;
+	delete[] sent_at;
+	delete[] resent;
+}
+
+
+/**
+ * Selective repeat needs at most half of the sequence numbers in the
+ * window, or an old frame could be taken for a new one.
+ * max_seq + 1 must be a power of 2 for inc() and between().
+ */
+int Protocol::set_window(unsigned int window, unsigned int max_seq) {
+	if (window == 0 || max_seq > MAX_SEQ_LIMIT || ((max_seq + 1) & max_seq) != 0 || window > (max_seq + 1) / 2) {
+		printf("Invalid window: window = %u, max seq = %u\n", window, max_seq);
+		return -1;
+	}
+
+	delete[] seqs;
+	delete[] sent_at;
+	delete[] resent;
+
+	this->window = window;
+	this->max_seq = max_seq;
+	timers.init(window, physical_layer.get_tick());
+	seqs = new seq_nr[window];
+	sent_at = new unsigned long long[window];
+	resent = new bool[window];
+
+	if (!rx_running)
+		ring.init(window * 2);
+
+	set_up(max_seq, 0, 0);
+	return 1;
+}
+
+
+/**
+ * The size only bounds the frames we send, it can change between two messages.
+ */
+int Protocol::set_payload_size(unsigned int size) {
+	if (size == 0 || size > MAX_PKT_SIZE) {
+		printf("Invalid payload size: %u\n", size);
+		return -1;
+	}
+	pkt_size = size;
+	return 1;
+}
+
+
+/**
+ * Return the payload size.
+ */
+unsigned int Protocol::get_payload_size(void) {
+	return pkt_size;
+}
+
+
+/**
+ * Return the window size.
+ */
+unsigned int Protocol::get_window(void) {
+	return window;
+}
+
+
+/**
+ * Return the maximum sequence number.
+ */
+seq_nr Protocol::get_max_seq(void) {
+	return max_seq;
+}
+
+
+// ----------------------------------------------------------------------------
+// RX THREAD METHOD
+// ----------------------------------------------------------------------------
+
+/**
+ * From now on the RX thread is the only reader of the transport and
+ * the producer of the ring; the protocol loop is the consumer.
+ */
+int Protocol::start_rx_thread(unsigned int capacity) {
+	if (rx_running)
+		return 1;
+
+	if (physical_layer.set_connect_frames(true) < 0) {
+		printf("The RX thread needs COBS framing\n");
+		return -1;
+	}
+
+	if (ring.init(capacity) < 0) {
+		physical_layer.set_connect_frames(false);
+		return -1;
+	}
+
+	rx_event = eventfd(0, EFD_NONBLOCK);
+	if (rx_event < 0) {
+		perror("eventfd() failed: ");
+		physical_layer.set_connect_frames(false);
+		return -1;
+	}
+
+	rx_running = true;
+
+	if (pthread_create(&rx_thread, NULL, rx_loop, this) != 0) {
+		printf("Error pthread_create()\n");
+		rx_running = false;
+		physical_layer.set_connect_frames(false);
+		::close(rx_event);
+		rx_event = -1;
+		return -1;
+	}
+	return 1;
+}
+
+
+/**
+ * The thread notices the stop within RX_THREAD_PERIOD.
+ * The frames still in the ring are kept.
+ */
+void Protocol::stop_rx_thread(void) {
+	if (!rx_running)
+		return;
+
+	rx_running = false;
+	pthread_join(rx_thread, NULL);
+
+	physical_layer.set_connect_frames(false);
+	::close(rx_event);
+	rx_event = -1;
+}
+
+
+/**
+ * Return the ring statistics.
+ */
+ring_stats Protocol::get_ring_stats(void) {
+	return ring.get_stats();
+}
+
+
 // ----------------------------------------------------------------------------
 // QUEUE METHOD
 // ----------------------------------------------------------------------------
 
 /**
- * See if there is space in the circular buffer queue[].
+ * See if there is space in the ring.
  * If so try to read as much from the file descriptor as possible.
- * If inp is near the top of queue[], a single call here
- * may read a few frames into the top of queue[] and then some more starting
- * at queue[0]. This is done in two read operations.
+ * With the RX thread there is nothing to do: it fills the ring by itself.
  */
 void Protocol::enqueue() {
 
 	int reads;
 	unsigned int k;
-	frame *top;
+	frame burst[RX_BURST];
+
+	if (rx_running)
+		return;
 
-	///< How many frames can be read consecutively?
-	top = (outp <= inp ? &queue[QUEUE_SIZE] : outp);
-	///< number of frames that can be read consecutively
-	k = top - inp;
+	///< number of frames that can be queued
+	k = ring.space();
+	if (k > RX_BURST)
+		k = RX_BURST;
+	if (k == 0)
+		return;
 
-	reads = physical_layer.recv(inp, k * sizeof(frame));
+	reads = physical_layer.recv(burst, k * sizeof(frame));
 
 	if (reads < 0) {
 		if (errno != EAGAIN)
@@ -180,89 +526,65 @@ void Protocol::enqueue() {
 	}
 
 	if (reads % sizeof(frame) != 0) {
-		printf("Error read() 1: nreads = %d\n", reads);
+		printf("Error read(): nreads = %d\n", reads);
 	}
 
-	if (reads > 0) {
-		nframes = nframes + reads / sizeof(frame);
-		inp = inp + reads / sizeof(frame);
+	if (reads > 0)
+		TRACE(TRACE_TIMELINE, trace_enqueue, trace_source, 0, reads / sizeof(frame), 0, NULL, 0);
 
-		if (inp == &queue[QUEUE_SIZE])
-			inp = queue;
-
-		///< are there residual frames to be read?
-		if (reads / sizeof(frame) == k) {
-			k = outp - inp;
-
-			reads = physical_layer.recv(inp, k * sizeof(frame));
-
-			if (reads < 0) {
-				if (errno != EAGAIN)
-					printf("Error read(): error = %d\n", errno);
-				return;
-			}
-
-			if (reads % sizeof(frame) != 0) {
-				printf("Error read() 2: nreads = %d\n", reads);
-			}
-
-			if (reads > 0) {
-				nframes = nframes + reads / sizeof(frame);
-				inp = inp + reads / sizeof(frame);
-				if (reads / sizeof(frame) == k)
-					printf("Queue full");
-			}
-		}
+	for (unsigned int i = 0; i < reads / sizeof(frame); i++) {
+		if (!ring.push(&burst[i]))
+			link.count(link_ring_drops);
 	}
 
 }
 
 /**
  * This function is called after it has been decided that a frame_arrival
- * event will occur. The earliest frame is removed from queue[] and copied
+ * event will occur. The earliest frame is removed from the ring and copied
  * to last_frame.
- * If dequeue() did not remove incoming frames from queue[], they never would be removed.
+ * If dequeue() did not remove incoming frames from the ring, they never would be removed.
+ * With a simulated link the frame goes through it first, and the one
+ * copied to last_frame is the next that comes out, if any.
  * This function determines whether the arrived frame is good
  * or bad (contains a checksum error)
  */
 event_type Protocol::dequeue(void) {
 
 	event_type event;
-
-	///< Remove one frame from the queue, copy the first frame in the queue
-	last_frame = *outp;
-	outp++;
-	if (outp == &queue[QUEUE_SIZE])
-		outp = queue;
-	nframes--;
-
-	// --------------------------------------------------------------------- //
-	/**
-	 * Generate frames with checksum errors at random
-	 */
-	/*
-	if (last_frame.kind == DATA && error[last_frame.seq] == false) {
-		int r = rand() % 10;
-		if (r % 3 == 0) {
-			for (unsigned int i = 0; i < PKT_SIZE; i++)
-				last_frame.info.data[i] += 1;
-
-			error[last_frame.seq] = true;
+	frame* f = impairment.active() ? &arrived : &last_frame;
+
+	///< Remove one frame from the ring, copy the first frame in the ring
+	if (ring.pop(f)) {
+		///< a connect during a transfer is kept for the next connect('s')
+		if (f->kind == CONNECT) {
+			connects++;
+			return no_event;
 		}
-		//clean the error of the next window element
-		if (error[(last_frame.seq + WINDOW_SIZE) % (MAX_SEQ + 1)] != false)
-			error[(last_frame.seq + WINDOW_SIZE) % (MAX_SEQ + 1)] = false;
+		if (f == &arrived)
+			impairment.push(f, physical_layer.get_tick());
+	} else if (f == &last_frame) {
+		return no_event;
 	}
-	*/
-	// --------------------------------------------------------------------- //
 
-	if (last_frame.kind == DATA) {
-		if (verify_checksum(last_frame.info.data, sizeof(last_frame.info.data), last_frame.checksum) != 0)
-			event = cksum_err;
-		else
-			event = frame_arrival;
-	} else if (last_frame.kind == ACK || last_frame.kind == NAK) {
+	///< the frame may be lost or still on the way
+	if (f == &arrived && !impairment.pop(&last_frame, physical_layer.get_tick()))
+		return no_event;
+
+	link.count(link_frames_received);
+	TRACE(TRACE_TIMELINE, trace_dequeue, trace_source, last_frame.kind, last_frame.seq, last_frame.ack, NULL, 0);
+
+	///< every frame is checked, a damaged ack must not move the window
+	if (verify_checksum(&last_frame) != 0) {
+		event = cksum_err;
+		link.count(link_cksum_errors);
+	} else if (last_frame.kind == DATA || last_frame.kind == ACK || last_frame.kind == NAK || last_frame.kind == SACK
+			|| last_frame.kind == PARITY) {
 		event = frame_arrival;
+		if (last_frame.kind == DATA)
+			link.count(link_data_received);
+		else if (last_frame.kind == NAK)
+			link.count(link_naks_received);
 	} else {
 		event = no_event;
 	}
@@ -280,6 +602,9 @@ event_type Protocol::dequeue(void) {
  * Wait_for_event reads the file descriptor to see if any
  * frames are there.  If so, if collects them all in the queue array.
  * Once the file descriptor is empty, it makes a decision about what to do next.
+ * If there is nothing to do, the frames produced so far are written with
+ * a single syscall and it sleeps in the physical layer until bytes
+ * arrive or a timer expires, instead of spinning.
  */
 void Protocol::wait_for_event(event_type *event) {
 
@@ -287,19 +612,205 @@ void Protocol::wait_for_event(event_type *event) {
 	offset = 0;
 
 	while (true) {
+		stats.polls++;
+
 		///< go get any newly arrived frames
 		enqueue();
 
 		///< Now pick event
 		*event = pick_event();
 
-		if (*event == no_event)
+		if (*event != no_event)
+			return;
+
+		///< dequeue() dropped a frame, the next ones are already here
+		if (ring.size() > 0 || impairment.due(physical_layer.get_tick()))
 			continue;
 
-		return;
+		flush_tx();
+		idle();
+	}
+}
+
+
+/**
+ * Block only if the user asked for it.
+ */
+void Protocol::idle(void) {
+	if (mode == wait_block)
+		block();
+}
+
+
+/**
+ * Return the earliest deadline, data timers first, then the ack timer.
+ * The wheel may wake us up a bit early, to move its timers down a level.
+ */
+unsigned long long Protocol::next_deadline(void) {
+	unsigned long long deadline = timers.next_deadline();
+
+	if (aux_timer > 0 && (deadline == 0 || aux_timer < deadline))
+		deadline = aux_timer;
+
+	///< a frame held by the simulated link comes out
+	unsigned long long release = impairment.next_release();
+	if (release > 0 && (deadline == 0 || release < deadline))
+		deadline = release;
+
+	return deadline;
+}
+
+
+/**
+ * Sleep until the transport is readable or the next deadline expires,
+ * and keep track of how long we slept and how late we woke up.
+ */
+void Protocol::block(void) {
+	unsigned long long deadline = next_deadline();
+	unsigned long long current_time = physical_layer.get_tick();
+	long long timeout = -1;
+	int ret;
+
+	if (deadline > 0)
+		timeout = (deadline > current_time) ? deadline - current_time : 0;
+
+	stats.waits++;
+	TRACE(TRACE_TIMELINE, trace_wait_begin, trace_source, 0, 0, 0, NULL, timeout);
+
+	if (rx_running)
+		ret = wait_ring(timeout);
+	else
+		ret = physical_layer.wait(timeout);
+
+	unsigned long long wake_time = physical_layer.get_tick();
+	TRACE(TRACE_TIMELINE, trace_wait_end, trace_source, 0, 0, 0, NULL, ret > 0);
+	stats.blocked += wake_time - current_time;
+
+	if (ret > 0) {
+		stats.read_wakeups++;
+	} else if (ret == 0 && deadline > 0) {
+		unsigned long long latency = (wake_time > deadline) ? wake_time - deadline : 0;
+		stats.timer_wakeups++;
+		stats.latency += latency;
+		if (latency > stats.max_latency)
+			stats.max_latency = latency;
 	}
 }
 
+
+/**
+ * With the RX thread we sleep on the eventfd it signals, not on the transport.
+ * The eventfd keeps its count, so a push done just before ppoll()
+ * is not lost.
+ */
+int Protocol::wait_ring(long long timeout) {
+	if (ring.size() > 0)
+		return 1;
+
+	pollfd pfd;
+	pfd.fd = rx_event;
+	pfd.events = POLLIN;
+
+	timespec ts;
+	ts.tv_sec = timeout / 1000000;
+	ts.tv_nsec = (timeout % 1000000) * 1000;
+
+	int ret = ppoll(&pfd, 1, timeout >= 0 ? &ts : NULL, NULL);
+
+	if (ret > 0) {
+		uint64_t count;
+		if (read(rx_event, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			printf("Error read(eventfd): error = %d\n", errno);
+	} else if (ret < 0 && errno == EINTR) {
+		ret = 0;
+	}
+	return ret;
+}
+
+
+/**
+ * Set the wait mode.
+ */
+void Protocol::set_wait_mode(wait_mode mode) {
+	this->mode = mode;
+}
+
+
+/**
+ * Set the loss rate of the incoming frames, the losses are independent.
+ */
+void Protocol::set_loss(double rate, unsigned int seed) {
+	impairment_config config = impairment.get_config();
+
+	config.loss = rate;
+	config.burst = 0;
+	impairment.configure(&config, seed);
+}
+
+
+/**
+ * Return the number of frames dropped on purpose.
+ */
+unsigned long long Protocol::get_lost(void) {
+	return impairment.get_stats().lost;
+}
+
+
+/**
+ * Set the impairments of the incoming frames.
+ */
+void Protocol::set_impairment(const impairment_config* config, unsigned int seed) {
+	impairment.configure(config, seed);
+}
+
+
+/**
+ * Return the impairment statistics.
+ */
+impairment_stats Protocol::get_impairment_stats(void) {
+	return impairment.get_stats();
+}
+
+
+/**
+ * Return the link statistics.
+ */
+LinkStats* Protocol::get_link_stats(void) {
+	return &link;
+}
+
+
+/**
+ * Set the source of the timeline records.
+ */
+void Protocol::set_trace_source(unsigned int source) {
+	trace_source = source;
+}
+
+
+/**
+ * Set the delay of the ack timer.
+ */
+void Protocol::set_ack_delay(unsigned long long delay) {
+	ack_delay = delay;
+}
+
+
+/**
+ * Return the current time.
+ */
+unsigned long long Protocol::get_tick(void) {
+	return physical_layer.get_tick();
+}
+
+
+/**
+ * Return the wait statistics.
+ */
+wait_stats Protocol::get_wait_stats(void) {
+	return stats;
+}
+
 /**
  * Pick a random event that is now possible for the process.
  * Note that the order in which the tests is made is critical,
@@ -310,7 +821,7 @@ event_type Protocol::pick_event(void) {
 	if (check_ack_timer() > 0)
 		return ack_timeout;
 
-	if (nframes > 0)
+	if (ring.size() > 0 || impairment.due(physical_layer.get_tick()))
 		return dequeue();
 
 	if (status)
@@ -331,32 +842,62 @@ event_type Protocol::pick_event(void) {
 /**
  * Start a timer for a data frame.
  */
-void Protocol::start_timer(unsigned char seqnr) {
+void Protocol::start_timer(seq_nr seqnr) {
 	unsigned long long current_time = physical_layer.get_tick();
-	ack_timer[seqnr % WINDOW_SIZE] = current_time + timeout_interval + offset;
+	unsigned long long rto = get_rto();
+
+	timers.arm(seqnr % window, current_time + rto + offset);
 	offset++;
-	///< figure out which timer is now lowest
-	recalc_timers();
+	TRACE(TRACE_TIMELINE, trace_timer_arm, trace_source, 0, seqnr, 0, NULL, rto);
 }
 
 /**
- * Stop a timer for a data frame.
+ * Stop a timer for a data frame, the frame has been acked.
+ * Karn's rule: if the frame was sent again we do not know which
+ * copy is acked, so it is not a candidate for the sample.
  */
-void Protocol::stop_timer(unsigned char seqnr) {
-	ack_timer[seqnr % WINDOW_SIZE] = 0;
-	///< figure out which timer is now lowest
-	recalc_timers();
+void Protocol::stop_timer(seq_nr seqnr) {
+	unsigned int i = seqnr % window;
+
+	timers.cancel(i);
+	TRACE(TRACE_TIMELINE, trace_timer_stop, trace_source, 0, seqnr, 0, NULL, 0);
+
+	if (sent_at[i] > 0 && seqs[i] == seqnr) {
+		if (resent[i])
+			rtt.ambiguous++;
+		else
+			acked_sent_at = sent_at[i];
+	}
+	sent_at[i] = 0;
 }
 
 /**
- * Start the auxiliary timer for sending separate acks. The length of the
- * auxiliary timer is arbitrarily set to half the main timer.
+ * One sample per ack (RFC 6298): a cumulative ack stops the timers of
+ * many frames sent back to back, a sample for each one would be the same
+ * round trip again and again and drive RTTVAR to 0. The sample is the
+ * newest frame acked that was sent only once.
+ */
+void Protocol::ack_received(void) {
+	if (acked_sent_at == 0)
+		return;
+
+	rtt_sample(physical_layer.get_tick() - acked_sent_at);
+	acked_sent_at = 0;
+}
+
+/**
+ * Start the auxiliary timer for sending separate acks. Its length is the
+ * ack delay of the user, by default half the main timer.
  */
 void Protocol::start_ack_timer(void) {
 	unsigned long long current_time = physical_layer.get_tick();
 
-	aux_timer = current_time + timeout_interval / 2ULL;
+	if (aux_timer > 0)
+		return;
+
+	aux_timer = current_time + (ack_delay > 0 ? ack_delay : timeout_interval / 2ULL);
 	offset++;
+	TRACE(TRACE_TIMELINE, trace_ack_timer_arm, trace_source, 0, 0, 0, NULL, aux_timer - current_time);
 }
 
 
@@ -364,37 +905,38 @@ void Protocol::start_ack_timer(void) {
  * Stop the ack timer.
  */
 void Protocol::stop_ack_timer(void) {
+	if (aux_timer > 0)
+		TRACE(TRACE_TIMELINE, trace_ack_timer_stop, trace_source, 0, 0, 0, NULL, 0);
 	aux_timer = 0;
 }
 
 
 /**
  * Check for possible timeout.  If found, reset the timer.
- * Find the lowest timer.
  * The use of the offset variable guarantees that each successive timer set
- * gets a higher value than the previous one.
- * So when a hit is found, it is the only possibility.
+ * gets a higher value than the previous one, the wheel gives back the
+ * expired timers in order of deadline.
  */
 int Protocol::check_timers(void) {
 	unsigned long long current_time = physical_layer.get_tick();
 
-	///< See if a timeout event is even possible now.
-	if (lowest_timer == 0 || current_time < lowest_timer) 
+	int i = timers.expire(current_time);
+	if (i < 0)
 		return -1;
 
-	for (int i = 0; i < WINDOW_SIZE; i++) {
-		if (ack_timer[i] == lowest_timer) {
-			///< turn the timer off
-			ack_timer[i] = 0;
-			///< find new lowest timer
-			recalc_timers();
-			///< timed out sequence number
-			oldest_frame = seqs[i];
-			return i;
-		}
+	///< exponential backoff, until the rto reaches the cap. Once per rto:
+	///< the timers that expire meanwhile were armed before, for the same loss
+	rtt.timeouts++;
+	link.count(link_timeouts);
+	if (current_time >= backoff_until && get_rto() < timeout_interval) {
+		rtt.backoff++;
+		backoff_until = current_time + get_rto();
 	}
-	printf("Check timers failed at %lld\n", lowest_timer);
-	return -1;
+
+	///< timed out sequence number
+	oldest_frame = seqs[i];
+	TRACE(TRACE_TIMELINE, trace_timer_fire, trace_source, 0, oldest_frame, 0, NULL, 0);
+	return i;
 }
 
 
@@ -406,6 +948,8 @@ int Protocol::check_ack_timer(void) {
 
 	if (aux_timer > 0 && current_time >= aux_timer) {
 		aux_timer = 0;
+		link.count(link_ack_timeouts);
+		TRACE(TRACE_TIMELINE, trace_ack_timeout, trace_source, 0, 0, 0, NULL, 0);
 		return 1;
 	} else {
 		return 0;
@@ -413,44 +957,38 @@ int Protocol::check_ack_timer(void) {
 }
 
 
-/**
- * Find the lowest timer.
- */
-void Protocol::recalc_timers(void) {
-
-	unsigned long long t = 0xffffffffffffffff;
-
-	for (int i = 0; i < WINDOW_SIZE; i++) {
-		if (ack_timer[i] > 0 && ack_timer[i] < t)
-			t = ack_timer[i];
-	}
-	lowest_timer = t;
-
-}
-
-
-
 // ----------------------------------------------------------------------------
 // LAYER METHOD (from/to application and from/to pyshical)
 // ----------------------------------------------------------------------------
 
 /**
  * Fetch a packet from user for transmission on the channel
- * the user data is split into PKT_SIZE bytes data and send in a frame
+ * the user data is split into pkt_size bytes data and send in a frame,
+ * the tail of the message goes in a shorter one.
  */
-void Protocol::from_application_layer(unsigned char* data, packet* p) {
-	for (unsigned int i = 0; i < sizeof(p->data); i++)
-		p->data[i] = data[next_pkt_fetch++];
+void Protocol::from_application_layer(unsigned char* data, unsigned long long len, packet* p) {
+	unsigned long long n = (next_pkt_fetch < len) ? len - next_pkt_fetch : 0;
+	if (n > pkt_size)
+		n = pkt_size;
+
+	memcpy(p->data, data + next_pkt_fetch, n);
+	p->len = n;
+	next_pkt_fetch = next_pkt_fetch + n;
 }
 
 
 /**
  * Deliver information from an inbound frame to the user layer.
- * the user recv buffer is filled frame by frame.
+ * the user recv buffer is filled frame by frame, whatever the payload
+ * size of the sender; what does not fit in the buffer is dropped.
  */
-void Protocol::to_application_layer(unsigned char* data, packet* p) {
-	for (unsigned int i = 0; i < sizeof(p->data); i++)
-		data[last_pkt_given++] = p->data[i];
+void Protocol::to_application_layer(unsigned char* data, unsigned long long len, packet* p) {
+	unsigned long long n = (last_pkt_given < len) ? len - last_pkt_given : 0;
+	if (n > p->len)
+		n = p->len;
+
+	memcpy(data + last_pkt_given, p->data, n);
+	last_pkt_given = last_pkt_given + n;
 }
 
 
@@ -473,14 +1011,32 @@ void Protocol::to_physical_layer(frame *f) {
 
 	int written;
 
-	if (f->kind == DATA)
-		seqs[f->seq % WINDOW_SIZE] = f->seq;
+	if (f->kind == DATA) {
+		unsigned int i = f->seq % window;
+		///< the round trip time is measured from the first transmission
+		if (sent_at[i] > 0 && seqs[i] == f->seq) {
+			resent[i] = true;
+			link.count(link_retransmits);
+		} else {
+			sent_at[i] = physical_layer.get_tick();
+			resent[i] = false;
+		}
+		seqs[i] = f->seq;
+		link.count(link_data_sent);
+	} else if (f->kind == ACK) {
+		link.count(link_acks_sent);
+	} else if (f->kind == NAK) {
+		link.count(link_naks_sent);
+	} else if (f->kind == SACK) {
+		link.count(link_sacks_sent);
+	} else if (f->kind == PARITY) {
+		link.count(link_parity_sent);
+	}
+	link.count(link_frames_sent);
 
 	written = physical_layer.send(f, sizeof(frame));
 
-	if (written != sizeof(frame)) {
-		if (errno != EAGAIN)
-			printf("Error write(): written = %d, error = %d\n", written, errno);
-	}
+	if (written != sizeof(frame))
+		printf("Error write(): written = %d, error = %d\n", written, errno);
 
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "../include/PtyTransport.h"
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+PtyTransport::PtyTransport() {
+	peer_name[0] = '\0';
+	master = true;
+}
+
+
+PtyTransport::PtyTransport(const char* slave) {
+	strncpy(peer_name, slave, sizeof(peer_name) - 1);
+	peer_name[sizeof(peer_name) - 1] = '\0';
+	master = false;
+}
+
+
+/**
+ * The master allocates a new pty and unlocks the slave, the slave
+ * just opens the given path. In both cases the line discipline is set
+ * to raw mode, otherwise the pty would echo and translate bytes.
+ */
+int PtyTransport::open() {
+
+	if (master) {
+		file_desc = posix_openpt(O_RDWR | O_NOCTTY);
+		if (file_desc < 0) {
+			perror("posix_openpt() failed: ");
+			return -1;
+		}
+		if (grantpt(file_desc) < 0 || unlockpt(file_desc) < 0) {
+			perror("grantpt()/unlockpt() failed: ");
+			close();
+			return -1;
+		}
+		const char* name = ptsname(file_desc);
+		if (name == NULL) {
+			close();
+			return -1;
+		}
+		strncpy(peer_name, name, sizeof(peer_name) - 1);
+		peer_name[sizeof(peer_name) - 1] = '\0';
+	} else {
+		file_desc = ::open(peer_name, O_RDWR | O_NOCTTY);
+		if (file_desc < 0) {
+			printf("Open() failed: device = %s\n", peer_name);
+			return -1;
+		}
+	}
+
+	termios settings;
+
+	if (tcgetattr(file_desc, &settings) < 0) {
+		perror("tcgetattr() failed: ");
+		close();
+		return -1;
+	}
+
+	cfmakeraw(&settings);
+	settings.c_cc[VMIN] = 0;
+	settings.c_cc[VTIME] = 0;
+
+	if (tcsetattr(file_desc, TCSANOW, &settings) < 0) {
+		perror("tcsetattr() failed: ");
+		close();
+		return -1;
+	}
+
+	if (set_nonblocking() < 0) {
+		close();
+		return -1;
+	}
+
+	return file_desc;
+}
+
+
+const char* PtyTransport::get_name() {
+	return master ? "pty master" : "pty slave";
+}
+
+
+/**
+ * Return the slave path.
+ */
+const char* PtyTransport::get_peer_name() {
+	return peer_name;
+}
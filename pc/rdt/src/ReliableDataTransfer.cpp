@@ -2,76 +2,264 @@
 #include "../include/ReliableDataTransfer.h"
 
 // ------------------------------------------------------------------------- //
-// PRINT FUNCTIONS
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
 // ------------------------------------------------------------------------- //
 
 /**
- * Return a string for a given frame kind.
+ * Set up the high level of the trasmission. It reset the rdt member to allow
+ * a new send or receive, or both.
  */
-const char* kind_to_string(unsigned char fk) {
-	const char* str;
-	switch (fk) {
-		case DATA:
-			str = "data";
-			break;
-		case ACK:
-			str = "ack";
-			break;
-		case NAK:
-			str = "nak";
-			break;
-		default:
-			str = "unknown";
-			break;
-	}
-	return str;
+void ReliableDataTransfer::set_up(unsigned long long out_len, unsigned long long in_len) {
+	unsigned int pkt_size = protocol.get_payload_size();
+
+	out_length = out_len;
+	in_length = in_len;
+
+	///< the last frame carries the tail, an empty message one empty frame
+	out_frames = (out_length == 0) ? 1 : (out_length + pkt_size - 1) / pkt_size;
+	in_frames = (in_length == 0) ? 1 : (in_length + pkt_size - 1) / pkt_size;
+
+	last_frame_recv = 0;
+	last_frame_send = 0;
+	last_frame_acked = 0;
+
 }
 
 
 /**
- * Print all the info contained in one frame.
+ * Increment k circularly.
  */
-void print_info(unsigned char* buff, unsigned int len) {
-	if (len < 1) {
-		printf(", ");
-		return;
-	}
-	printf("%d", *buff);
-	print_info(buff + 1, len - 1);
+void ReliableDataTransfer::inc(seq_nr& k) {
+	if (k < max_seq)
+		k = k + 1;
+	else
+		k = 0;
 }
 
 
-// ------------------------------------------------------------------------- //
-// --------------------------- PRIVATE FUNCTIONS --------------------------- //
-// ------------------------------------------------------------------------- //
-
 /**
- * Set up the high level of the trasmission. It reset the rdt member to allow
- * a new send or receive.
+ * Move both windows back to sequence number 0, as the peer does after
+ * the connect. In a session this is done only for the first message.
  */
-void ReliableDataTransfer::set_up(int len) {
+void ReliableDataTransfer::reset_windows() {
 	no_nak = true;
-	end = false;
-	not_expected = false;
 
 	ack_expected = 0;			///< next ack expected on the inbound stream
 	next_frame_to_send = 0;		///< number of next outgoing frame
 	frame_expected = 0;			///< frame number expected
-	too_far = WINDOW_SIZE;		///<receiver's upper window + 1
+	too_far = window;			///<receiver's upper window + 1
 
 	nbuffered = 0;				///< initially no packets are buffered
+	dup_acks = 0;
+	gone_back = max_seq + 1;
+
+	fec_count = 0;
 
-	for (int i = 0; i < WINDOW_SIZE; i++)
+	for (unsigned int i = 0; i < window; i++) {
 		arrived[i] = false;
+		sacked[i] = false;
+		sack_resent[i] = false;
+		in_seq[i] = max_seq + 1;
+	}
+
+}
+
 
-	if (len < PKT_SIZE)
-		nframes = 1;
+/**
+ * Pass the buffered frames to the user in order, but not beyond the
+ * current message: in a session the frames of the next one may already
+ * be here, they wait in in_buf for the next recv().
+ */
+void ReliableDataTransfer::deliver() {
+	while (receiving && last_frame_recv < in_frames && arrived[frame_expected % window]) {
+		///< Pass frames and advance window. 
+		protocol.to_application_layer(in_data, in_length, &in_buf[frame_expected % window]);
+
+		no_nak = true;
+
+		arrived[frame_expected % window] = false;
+		///< advance lower edge of receiver's window
+		inc(frame_expected);
+		///< advance upper edge of receiver's window
+		inc(too_far);
+		///< count total received data frame
+		last_frame_recv = last_frame_recv + 1;
+		unacked = unacked + 1;
+	}
+
+	ack_in_order();
+}
+
+
+/**
+ * Every n frames and the last one of the message are acked at once, the
+ * others wait for the ack timer. The sack keeps the bitmap, if any. With
+ * a data frame about to go the other way, the ack rides on it.
+ */
+void ReliableDataTransfer::ack_in_order() {
+	if (unacked == 0)
+		return;
+
+	if (sending && nbuffered < window && last_frame_send < out_frames)
+		protocol.start_ack_timer();
+	else if (unacked >= ((ack_every > 0 && ack_every < window) ? ack_every : window) || last_frame_recv == in_frames)
+		send_frame(sack ? SACK : ACK, 0, frame_expected, out_buf);
 	else
-		nframes = len / PKT_SIZE;
+		protocol.start_ack_timer();
+}
 
-	last_frame_recv = 0;
-	last_frame_send = 0;
 
+/**
+ * Only the frames inside the receiver's window can be in the bitmap.
+ */
+void ReliableDataTransfer::sack_bitmap(packet* p) {
+	unsigned int nbits = window - 1;
+	unsigned int len = 0;
+	seq_nr seq = frame_expected;
+
+	if (nbits > MAX_PKT_SIZE * 8)
+		nbits = MAX_PKT_SIZE * 8;
+
+	memset(p->data, 0, (nbits + 7) / 8);
+	for (unsigned int i = 0; i < nbits; i++) {
+		inc(seq);
+		if (arrived[seq % window]) {
+			p->data[i / 8] |= 1 << (i % 8);
+			len = i / 8 + 1;
+		}
+	}
+	p->len = len;
+}
+
+
+/**
+ * A frame is sent again for a SACK only once, if that copy is lost too
+ * its timer sends it.
+ */
+void ReliableDataTransfer::selective_ack(frame* f) {
+	seq_nr seq = (f->ack + 1) % (max_seq + 1);
+	seq_nr last = ack_expected;
+	bool found = false;
+
+	for (unsigned int i = 0; i < f->info.len * 8U; i++) {
+		inc(seq);
+		if (!protocol.between(ack_expected, seq, next_frame_to_send))
+			break;
+		if ((f->info.data[i / 8] & (1 << (i % 8))) == 0)
+			continue;
+		if (!sacked[seq % window]) {
+			sacked[seq % window] = true;
+			protocol.stop_timer(seq);
+		}
+		last = seq;
+		found = true;
+	}
+
+	if (!found)
+		return;
+
+	for (seq = ack_expected; seq != last; inc(seq)) {
+		if (!sacked[seq % window] && !sack_resent[seq % window]) {
+			sack_resent[seq % window] = true;
+			send_frame(DATA, seq, frame_expected, out_buf);
+		}
+	}
+}
+
+
+/**
+ * The group of a frame is closed by the parity frame, so it never spans
+ * two messages. Frames sent again are not part of any group.
+ */
+void ReliableDataTransfer::fec_add(seq_nr seq, packet* p) {
+	if (fec_count == 0) {
+		fec_first = seq;
+		fec_len = 0;
+		fec_out.len = FEC_HEADER;
+		memset(fec_out.data, 0, FEC_HEADER + protocol.get_payload_size());
+	}
+
+	for (unsigned int i = 0; i < p->len; i++)
+		fec_out.data[FEC_HEADER + i] ^= p->data[i];
+	if (FEC_HEADER + p->len > fec_out.len)
+		fec_out.len = FEC_HEADER + p->len;
+	fec_len ^= p->len;
+	fec_count = fec_count + 1;
+
+	if (fec_count == fec || last_frame_send == out_frames) {
+		fec_out.data[0] = fec_count;
+		fec_out.data[1] = fec_len & 0xff;
+		fec_out.data[2] = fec_len >> 8;
+		send_frame(PARITY, fec_first, frame_expected, out_buf);
+		fec_count = 0;
+	}
+}
+
+
+/**
+ * The frames of the group already delivered are still in in_buf until
+ * the frame one window later arrives: in_seq tells which are there. The
+ * missing one is the parity XOR all the others.
+ */
+void ReliableDataTransfer::fec_rebuild(frame* f) {
+	unsigned int count = f->info.data[0];
+	unsigned short len = f->info.data[1] | (f->info.data[2] << 8);
+	seq_nr seq = f->seq;
+	seq_nr missing = 0;
+	unsigned int nmissing = 0;
+
+	fecs.received++;
+
+	if (f->info.len < FEC_HEADER || count == 0 || count > window)
+		return;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (in_seq[seq % window] == seq) {
+			len ^= in_buf[seq % window].len;
+		} else {
+			missing = seq;
+			nmissing++;
+		}
+		inc(seq);
+	}
+
+	///< nothing to do, or too much
+	if (nmissing != 1 || !protocol.between(frame_expected, missing, too_far) || len > f->info.len - FEC_HEADER)
+		return;
+
+	packet* p = &in_buf[missing % window];
+	memcpy(p->data, f->info.data + FEC_HEADER, len);
+	p->len = len;
+
+	seq = f->seq;
+	for (unsigned int i = 0; i < count; i++) {
+		packet* q = &in_buf[seq % window];
+		if (seq != missing) {
+			for (unsigned int j = 0; j < q->len && j < len; j++)
+				p->data[j] ^= q->data[j];
+		}
+		inc(seq);
+	}
+
+	arrived[missing % window] = true;
+	in_seq[missing % window] = missing;
+	fecs.rebuilt++;
+	TRACE(TRACE_EVENTS, trace_rebuilt, trace_source, DATA, missing, 0, p, 0);
+
+	deliver();
+}
+
+
+/**
+ * Choose the rdt implementation.
+ */
+void ReliableDataTransfer::set_protocol(const char* prot) {
+	if (strcmp(prot, "selective repeat") == 0) {
+		this->run = &ReliableDataTransfer::selective_repeat;
+	}
+	if (strcmp(prot, "go back n") == 0) {
+		this->run = &ReliableDataTransfer::go_back_n;
+	}
 }
 
 
@@ -86,23 +274,36 @@ int ReliableDataTransfer::connect(char type) {
 /**
  * Construct and send a data, ack, or nak frame.
  */
-void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr, unsigned char frame_expected, packet buffer[]) {
+void ReliableDataTransfer::send_frame(unsigned char fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[]) {
 	frame f;
 	///< kind == data, ack, or nak
 	f.kind = fk;
 
 	f.seq = frame_nr;
-	f.ack = (frame_expected + MAX_SEQ) % (MAX_SEQ + 1);
+	f.ack = (frame_expected + max_seq) % (max_seq + 1);
 	//if (f.kind == DATA) {
 	//	f.seq = frame_nr;
-	//	f.ack = MAX_SEQ + 1;
+	//	f.ack = max_seq + 1;
 	//} else if (f.kind == ACK || f.kind == NAK) {
-	//	f.seq = MAX_SEQ + 1;
-	//	f.ack = (frame_expected + MAX_SEQ) % (MAX_SEQ + 1);
+	//	f.seq = max_seq + 1;
+	//	f.ack = (frame_expected + max_seq) % (max_seq + 1);
 	//}
 
-	f.info = buffer[frame_nr % WINDOW_SIZE];
-	f.checksum = protocol.compute_checksum(f.info.data, sizeof(f.info.data));
+	///< only data frames carry a payload, and the sack its bitmap
+	if (fk == DATA) {
+		f.info = buffer[frame_nr % window];
+	} else if (fk == PARITY) {
+		f.info = fec_out;
+		fecs.parity++;
+	} else if (fk == SACK) {
+		sack_bitmap(&f.info);
+		///< nothing out of order, a plain ack says the same
+		if (f.info.len == 0)
+			f.kind = ACK;
+	} else {
+		f.info.len = 0;
+	}
+	f.checksum = protocol.compute_checksum(&f);
 
 	///< one nak per frame, please
 	if (fk == NAK)
@@ -110,18 +311,24 @@ void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr,
 	///< transmit the frame
 	protocol.to_physical_layer(&f);
 
-	if (fk == DATA)
+	if (f.kind == ACK)
+		acks.acks++;
+	else if (f.kind == NAK)
+		acks.naks++;
+	else if (f.kind == SACK)
+		acks.sacks++;
+
+	if (fk == DATA) {
 		protocol.start_timer(frame_nr);
+		if (unacked > 0)
+			acks.piggybacked++;
+	}
 
 	///< no need for separate ack frame
 	protocol.stop_ack_timer();
+	unacked = 0;
 
-	if (f.kind == DATA) {
-		printf("Send frame ==> seq = %d, ", f.seq);
-		print_info(f.info.data, sizeof(f.info.data));
-		printf("checksum = %d\n", f.checksum);
-	} else
-		printf("Send frame ==> %s, ack = %d\n", kind_to_string(f.kind), f.ack);
+	TRACE(TRACE_FRAMES, trace_send, trace_source, f.kind, f.seq, f.ack, &f.info, f.checksum);
 }
 
 
@@ -130,7 +337,7 @@ void ReliableDataTransfer::send_frame(unsigned char fk, unsigned char frame_nr,
  * using a sliding window protocol, having two windows (one for send and one for receive).
  * 
  */
-void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
+void ReliableDataTransfer::selective_repeat() {
 
 	protocol.wait_for_event(&event);
 
@@ -141,72 +348,69 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 			///< expand the window
 			nbuffered = nbuffered + 1;
 			///< fecth data from user (divide user data in 4 bytes frame)
-			protocol.from_application_layer(buff, &out_buf[next_frame_to_send % WINDOW_SIZE]);
+			protocol.from_application_layer(out_data, out_length, &out_buf[next_frame_to_send % window]);
+			sacked[next_frame_to_send % window] = false;
+			sack_resent[next_frame_to_send % window] = false;
 			///< transmit the frame
 			send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
+			last_frame_send = last_frame_send + 1;
+			///< and the parity of its group, when complete
+			if (fec > 0)
+				fec_add(next_frame_to_send, &out_buf[next_frame_to_send % window]);
 			///< advance upper window edge
 			inc(next_frame_to_send);
-
-			last_frame_send = last_frame_send + 1;
 			break;
 
 		///< a control frame has arrived (ack or nak)
 		case frame_arrival:
 			///< fetch incoming frame from physical layer (serial)
 			protocol.from_physical_layer(&r);
+			TRACE(TRACE_FRAMES, trace_recv, trace_source, r.kind, r.seq, r.ack, &r.info, r.checksum);
 
 			if (r.kind == DATA) {
 
-				printf("Received frame ==> seq = %d, ", r.seq);
-				print_info(r.info.data, sizeof(r.info.data));
-				printf("checksum = %d\n", r.checksum);
+				acks.data_frames++;
+
+				bool hole = false;
 
 				///< An undamaged frame has arrived
 				if (r.seq != frame_expected) {
-					if (no_nak) {
-						not_expected = true;
+					///< with sack, a new frame with a missing one before it shows a hole
+					if (sack && protocol.between(frame_expected, r.seq, too_far) && !arrived[r.seq % window]) {
+						hole = !arrived[((r.seq + max_seq) % (max_seq + 1)) % window];
+						protocol.start_ack_timer();
+					} else if (no_nak) {
 						send_frame(NAK, 0, frame_expected, out_buf);
+					} else {
+						///< a copy of a frame we have, our ack may be lost
+						protocol.start_ack_timer();
 					}
-				} else {
-					not_expected = false;
-					protocol.start_ack_timer();
 				}
 
 				///< Frames may be accepted in any order
-				if (protocol.between(frame_expected, r.seq, too_far) && (arrived[r.seq % WINDOW_SIZE] == false)) {
+				if (protocol.between(frame_expected, r.seq, too_far) && (arrived[r.seq % window] == false)) {
 					///< mark buffer as full
-					arrived[r.seq % WINDOW_SIZE] = true;
+					arrived[r.seq % window] = true;
 					///< insert data into buffer
-					in_buf[r.seq % WINDOW_SIZE] = r.info;
-
-					while (arrived[frame_expected % WINDOW_SIZE]) {
-						///< Pass frames and advance window. 
-						protocol.to_application_layer(buff, &in_buf[frame_expected % WINDOW_SIZE]);
-
-						no_nak = true;
-
-						arrived[frame_expected % WINDOW_SIZE] = false;
-						///< advance lower edge of receiver's window
-						inc(frame_expected);
-						///< advance upper edge of receiver's window
-						inc(too_far);
-						///< count total received data frame
-						last_frame_recv = last_frame_recv + 1;
-						///< to see if a separate ack is needed
-						protocol.start_ack_timer();
-					}
+					in_buf[r.seq % window] = r.info;
+					in_seq[r.seq % window] = r.seq;
+
+					deliver();
+				} else {
+					protocol.get_link_stats()->count(link_data_discarded);
 				}
 
-				//if (not_expected && last_frame_recv == nframes)
-					//end = true;
+				///< the bitmap includes this frame
+				if (hole)
+					send_frame(SACK, 0, frame_expected, out_buf);
 
 			}
 
-			if (r.kind == ACK || r.kind == NAK)
-				printf("Received frame ==> %s, ack = %d\n", kind_to_string(r.kind), r.ack);
+			if (r.kind == PARITY)
+				fec_rebuild(&r);
 
-			if ((r.kind == NAK) && protocol.between(ack_expected, (r.ack + 1) % (MAX_SEQ + 1), next_frame_to_send))
-				send_frame(DATA, (r.ack + 1) % (MAX_SEQ + 1), frame_expected, out_buf);
+			if ((r.kind == NAK) && protocol.between(ack_expected, (r.ack + 1) % (max_seq + 1), next_frame_to_send))
+				send_frame(DATA, (r.ack + 1) % (max_seq + 1), frame_expected, out_buf);
 
 			while (protocol.between(ack_expected, r.ack, next_frame_to_send)) {
 				///< handle piggybacked ack
@@ -216,16 +420,13 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 				///< advance lower edge of sender's window
 				inc(ack_expected);
 				///< count total received ack frame
-				last_frame_recv = last_frame_recv + 1;
+				last_frame_acked = last_frame_acked + 1;
 			}
 
-			if (r.kind == DATA && not_expected) {
-				if (last_frame_recv == nframes)
-					end = true;
-			} else if (r.kind == ACK || r.kind == NAK) {
-				if (last_frame_recv == nframes)
-					end = true;
-			}
+			if (r.kind == SACK)
+				selective_ack(&r);
+
+			protocol.ack_received();
 
 			break;
 
@@ -236,19 +437,15 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 
 		///< damaged frame
 		case cksum_err:
-			if (no_nak) {
-				printf("Checksum error\n");
+			TRACE(TRACE_EVENTS, trace_cksum_err, trace_source, 0, 0, 0, NULL, 0);
+			if (no_nak)
 				send_frame(NAK, 0, frame_expected, out_buf);
-				if (last_frame_recv == nframes)
-					end = true;
-			}
 			break;
 
-		///< ack timer expired; send ack
+		///< ack timer expired; send ack, with the bitmap if frames are out of order
 		case ack_timeout:
-			send_frame(ACK, 0, frame_expected, out_buf);
-			if (last_frame_recv == nframes)
-				end = true;
+			acks.delayed++;
+			send_frame(sack ? SACK : ACK, 0, frame_expected, out_buf);
 			break;
 
 		///< no event
@@ -258,11 +455,30 @@ void ReliableDataTransfer::selective_repeat(unsigned char* buff) {
 }
 
 
+/**
+ * The timeout and the fast retransmit both send the window again. The
+ * frames out of order that were already on the way come back as
+ * duplicate acks: one go back per position of the window is enough.
+ */
+void ReliableDataTransfer::go_back() {
+	///< start retransmitting here
+	next_frame_to_send = ack_expected;
+	for (unsigned int i = 0; i < nbuffered; i++) {
+		///< resend 1 frame
+		send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
+		///< prepare to send the next one
+		inc(next_frame_to_send);
+	}
+	gone_back = ack_expected;
+	dup_acks = 0;
+}
+
+
 /**
  * Go Back N implementations. Only one window, sender side is needed
  * to realize a reliable data transfer.
  */
-void ReliableDataTransfer::go_back_n(unsigned char* buff) { 
+void ReliableDataTransfer::go_back_n() {
 
 	protocol.wait_for_event(&event);
 
@@ -272,7 +488,7 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 			///< expand the sender's window
 			nbuffered = nbuffered + 1;
 			///< fecth data from user (divide user data in 4 bytes frame)
-			protocol.from_application_layer(buff, &out_buf[next_frame_to_send % WINDOW_SIZE]);
+			protocol.from_application_layer(out_data, out_length, &out_buf[next_frame_to_send % window]);
 			///< transmit the frame
 			send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
 			///< advance sender's upper window edge
@@ -285,32 +501,41 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 		case frame_arrival:
 			///< get incoming frame from physical layer
 			protocol.from_physical_layer(&r);
+			TRACE(TRACE_FRAMES, trace_recv, trace_source, r.kind, r.seq, r.ack, &r.info, r.checksum);
 
 			if (r.kind == DATA) {
-				printf("Received frame ==> seq = %d, ", r.seq);
-				print_info(r.info.data, sizeof(r.info.data));
-				printf("checksum = %d\n", r.checksum);
+				acks.data_frames++;
 			}
 
-			///< Frames are accepted only in order
-			if (r.seq == frame_expected) {
+			///< Frames are accepted only in order, and only by the receiver
+			if (receiving && last_frame_recv < in_frames && r.kind == DATA && r.seq == frame_expected) {
 				///< insert data into buffer
-				in_buf[r.seq % WINDOW_SIZE] = r.info;
+				in_buf[r.seq % window] = r.info;
 				///< Pass frames and advance window.
-				protocol.to_application_layer(buff, &in_buf[frame_expected % WINDOW_SIZE]);
+				protocol.to_application_layer(in_data, in_length, &in_buf[frame_expected % window]);
 				///< advance lower edge of receiver's window
 				inc(frame_expected);
 
+				no_nak = true;
 				last_frame_recv = last_frame_recv + 1;
-
-				if ((r.seq % WINDOW_SIZE) == WINDOW_SIZE - 1)
-					send_frame(ACK, 0, frame_expected, out_buf);
+				unacked = unacked + 1;
+
+				ack_in_order();
+			} else if (r.kind == DATA) {
+				protocol.get_link_stats()->count(link_data_discarded);
+				///< a gap or a copy: nak once, then repeat the ack
+				if (receiving && fast_retransmit)
+					send_frame(no_nak ? NAK : ACK, 0, frame_expected, out_buf);
 			}
 
-			if (r.kind == ACK)
-				printf("Received frame ==> %s, ack = %d\n", kind_to_string(r.kind), r.ack);
-
 			///< Ack n implies n - 1, n - 2, etc.  Check for this.
+			if (protocol.between(ack_expected, r.ack, next_frame_to_send)) {
+				dup_acks = 0;
+				gone_back = max_seq + 1;
+			} else if (r.kind == ACK && nbuffered > 0 && r.ack == (ack_expected + max_seq) % (max_seq + 1)) {
+				dup_acks = dup_acks + 1;
+			}
+
 			while (protocol.between(ack_expected, r.ack, next_frame_to_send)) {
 				///< Handle piggybacked ack (one frame fewer buffered)
 				nbuffered = nbuffered - 1;
@@ -319,26 +544,33 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 				///< contract sender's window
 				inc(ack_expected);
 
-				last_frame_recv = last_frame_recv + 1;
+				last_frame_acked = last_frame_acked + 1;
 			}
 
-			if (last_frame_recv == nframes)
-				end = true;
+			protocol.ack_received();
+
+			///< the receiver lost the frame at ack_expected, do not wait for its timer
+			if (fast_retransmit && nbuffered > 0 && gone_back != ack_expected
+					&& (r.kind == NAK || (r.kind == ACK && dup_acks >= DUP_ACKS)))
+				go_back();
 			break;
 
+		///< damaged frame, for the receiver it was data
 		case cksum_err:
+			TRACE(TRACE_EVENTS, trace_cksum_err, trace_source, 0, 0, 0, NULL, 0);
+			if (receiving && fast_retransmit && no_nak)
+				send_frame(NAK, 0, frame_expected, out_buf);
 			break;
 
 		///< trouble; retransmit all outstanding frames
 		case timeout:
-			///< start retransmitting here
-			next_frame_to_send = ack_expected;
-			for (unsigned int i = 0; i < nbuffered; i++) {
-				///< resend 1 frame
-				send_frame(DATA, next_frame_to_send, frame_expected, out_buf);
-				///< prepare to send the next one
-				inc(next_frame_to_send);
-			}
+			go_back();
+			break;
+
+		///< frames in order still without ack
+		case ack_timeout:
+			acks.delayed++;
+			send_frame(ACK, 0, frame_expected, out_buf);
 			break;
 
 		default:
@@ -352,40 +584,176 @@ void ReliableDataTransfer::go_back_n(unsigned char* buff) {
 // ---------------------------- PUBLIC FUNCTIONS --------------------------- //
 // ------------------------------------------------------------------------- //
 
+ReliableDataTransfer::ReliableDataTransfer() {
+	set_window(WINDOW_SIZE, MAX_SEQ);
+	protocol.set_trace_source(trace_source);
+}
+
+
+ReliableDataTransfer::~ReliableDataTransfer() {
+	delete[] out_buf;
+	delete[] in_buf;
+	delete[] arrived;
+	delete[] sacked;
+	delete[] sack_resent;
+	delete[] in_seq;
+}
+
+
+/**
+ * The buffers are indexed by seq % window, so the memory is linear
+ * in the window and independent of the sequence space.
+ */
+int ReliableDataTransfer::set_window(unsigned int window, unsigned int max_seq) {
+	if (max_seq == 0) {
+		max_seq = 1;
+		while (window > 0 && max_seq < 2 * window - 1)
+			max_seq = max_seq * 2 + 1;
+	}
+
+	if (protocol.set_window(window, max_seq) < 0)
+		return -1;
+
+	delete[] out_buf;
+	delete[] in_buf;
+	delete[] arrived;
+	delete[] sacked;
+	delete[] sack_resent;
+	delete[] in_seq;
+
+	this->window = window;
+	this->max_seq = max_seq;
+	out_buf = new packet[window];
+	in_buf = new packet[window];
+	arrived = new bool[window];
+	sacked = new bool[window];
+	sack_resent = new bool[window];
+	in_seq = new seq_nr[window];
+
+	reset_windows();
+	connected = false;
+	return 1;
+}
+
+/**
+ * Set the integrity check of the frames.
+ */
+void ReliableDataTransfer::set_check(check_type type) {
+	protocol.set_check(type);
+}
+
+
+/**
+ * Set the payload size of the data frames.
+ */
+int ReliableDataTransfer::set_payload_size(unsigned int size) {
+	if (fec > 0 && size + FEC_HEADER > MAX_PKT_SIZE) {
+		printf("Invalid payload size with fec: %u\n", size);
+		return -1;
+	}
+	return protocol.set_payload_size(size);
+}
+
+
 /**
  * Init the rdt. Second argument, the protocol, allow us to choose different implementations,
  * to satisfy a reliable trasìnsfer.
  */
 int ReliableDataTransfer::init(const char* device, const char* prot, int baudrate) {
-	if (strcmp(prot, "selective repeat") == 0) {
-		this->run = &ReliableDataTransfer::selective_repeat;
-	}
-	if (strcmp(prot, "go back n") == 0) {
-		this->run = &ReliableDataTransfer::go_back_n;
-	}
+	set_protocol(prot);
 	return protocol.init(device, baudrate);
 }
 
 
 /**
- * Send the user data. This function returns only when all the data have been
- * transmitted and successfully received.
+ * Same as above, but the bytes go through a transport chosen by the user,
+ * e.g. one end of a SocketPairTransport to run both peers in one process.
+ */
+int ReliableDataTransfer::init(Transport* transport, const char* prot) {
+	set_protocol(prot);
+	return protocol.init(transport);
+}
+
+
+/**
+ * The outbound message is done when all its frames are acked, the inbound
+ * one when all its frames are delivered and the last of them acked.
  */
-void ReliableDataTransfer::send(unsigned char* buffer, int len, unsigned long timeout) {
-	set_up(len);
-	protocol.set_up((MAX_SEQ + 1), timeout, 1);
+bool ReliableDataTransfer::done() {
+	if (sending && last_frame_acked < out_frames)
+		return false;
+	if (receiving && (last_frame_recv < in_frames || unacked > 0))
+		return false;
+	return true;
+}
 
-	while (connect('s') < 1);
 
-	while (end == false) {
-		(this->*run)(buffer);
+/**
+ * The event loop of send(), recv() and exchange(): the application layer
+ * may give a new frame while the window has room and the message is not over.
+ */
+void ReliableDataTransfer::transfer() {
+	unsigned long long stall_start = 0;
+
+	while (!done()) {
+		(this->*run)();
 
-		if (nbuffered < WINDOW_SIZE && last_frame_send < nframes)
+		if (sending && nbuffered < window && last_frame_send < out_frames)
 			protocol.enable_protocol();
 		else
 			protocol.disable_protocol();
+
+		///< waiting for acks with more to send
+		if (sending && nbuffered >= window && last_frame_send < out_frames) {
+			if (stall_start == 0) {
+				stall_start = protocol.get_tick();
+				acks.stalls++;
+			}
+		} else if (stall_start > 0) {
+			acks.stalled += protocol.get_tick() - stall_start;
+			stall_start = 0;
+		}
 	}
 
+	///< the last ack is still in the TX batch
+	protocol.flush_tx();
+}
+
+
+/**
+ * Send the user data. This function returns only when all the data have been
+ * transmitted and successfully received.
+ */
+void ReliableDataTransfer::send(unsigned char* buffer, unsigned long long len, unsigned long timeout) {
+	unsigned long long start = protocol.get_tick();
+
+	TRACE(TRACE_TIMELINE, trace_message_begin, trace_source, 's', 0, 0, NULL, len);
+	set_up(len, 0);
+	out_data = buffer;
+	sending = true;
+	receiving = false;
+
+	if (session && connected) {
+		protocol.next_message(timeout, 1);
+	} else {
+		reset_windows();
+		protocol.set_up(max_seq, timeout, 1);
+
+		TRACE(TRACE_TIMELINE, trace_connect_begin, trace_source, 0, 0, 0, NULL, 0);
+		while (connect('s') < 1)
+			protocol.idle();
+		TRACE(TRACE_TIMELINE, trace_connect_end, trace_source, 0, 0, 0, NULL, 0);
+
+		connected = session;
+	}
+
+	transfer();
+
+	LinkStats* link = protocol.get_link_stats();
+	link->latency.record(protocol.get_tick() - start);
+	link->count(link_messages_sent);
+	link->count(link_bytes_sent, len);
+	TRACE(TRACE_TIMELINE, trace_message_end, trace_source, 's', 0, 0, NULL, len);
 }
 
 
@@ -393,18 +761,300 @@ void ReliableDataTransfer::send(unsigned char* buffer, int len, unsigned long ti
  * Receive the user data. This function returns only when all the data have been
  * received.
  */
-void ReliableDataTransfer::recv(unsigned char* buffer, int len, unsigned long timeout) {
+void ReliableDataTransfer::recv(unsigned char* buffer, unsigned long long len, unsigned long timeout) {
+
+	TRACE(TRACE_TIMELINE, trace_message_begin, trace_source, 'r', 0, 0, NULL, len);
+	set_up(0, len);
+	in_data = buffer;
+	sending = false;
+	receiving = true;
+
+	if (session && connected) {
+		protocol.next_message(timeout, 0);
+		///< frames of this message that arrived during the previous one
+		deliver();
+	} else {
+		reset_windows();
+		protocol.set_up(max_seq, timeout, 0);
+
+		TRACE(TRACE_TIMELINE, trace_connect_begin, trace_source, 0, 0, 0, NULL, 0);
+		while (connect('r') < 1);
+		TRACE(TRACE_TIMELINE, trace_connect_end, trace_source, 0, 0, 0, NULL, 0);
+
+		connected = session;
+	}
+
+	transfer();
 
-	set_up(len);
-	protocol.set_up((MAX_SEQ + 1), timeout, 0);
+	protocol.get_link_stats()->count(link_messages_received);
+	protocol.get_link_stats()->count(link_bytes_received, len);
+	TRACE(TRACE_TIMELINE, trace_message_end, trace_source, 'r', 0, 0, NULL, len);
+
+	//protocol.flush();
+}
 
-	while (connect('r') < 1);
 
-	while (end == false) {
-		(this->*run)(buffer);
+/**
+ * Send and receive the user data. Both peers are receivers first, so the
+ * handshake does not depend on who starts: each one sends its connect,
+ * then waits for the one of the peer.
+ */
+void ReliableDataTransfer::exchange(unsigned char* out, unsigned long long out_len,
+		unsigned char* in, unsigned long long in_len, unsigned long timeout) {
+	unsigned long long start = protocol.get_tick();
+
+	TRACE(TRACE_TIMELINE, trace_message_begin, trace_source, 'x', 0, 0, NULL, out_len);
+	set_up(out_len, in_len);
+	out_data = out;
+	in_data = in;
+	sending = true;
+	receiving = true;
+
+	if (session && connected) {
+		protocol.next_message(timeout, 1);
+		///< frames of this message that arrived during the previous one
+		deliver();
+	} else {
+		reset_windows();
+		protocol.set_up(max_seq, timeout, 1);
+
+		TRACE(TRACE_TIMELINE, trace_connect_begin, trace_source, 0, 0, 0, NULL, 0);
+		while (connect('r') < 1);
+		while (connect('s') < 1)
+			protocol.idle();
+		TRACE(TRACE_TIMELINE, trace_connect_end, trace_source, 0, 0, 0, NULL, 0);
+
+		connected = session;
 	}
 
-	//protocol.flush();
+	transfer();
+
+	LinkStats* link = protocol.get_link_stats();
+	link->latency.record(protocol.get_tick() - start);
+	link->count(link_messages_sent);
+	link->count(link_bytes_sent, out_len);
+	link->count(link_messages_received);
+	link->count(link_bytes_received, in_len);
+	TRACE(TRACE_TIMELINE, trace_message_end, trace_source, 'x', 0, 0, NULL, out_len);
+}
+
+
+/**
+ * Enable or disable the session. The next transfer makes the handshake
+ * in both cases.
+ */
+void ReliableDataTransfer::set_session(bool enable) {
+	session = enable;
+	connected = false;
+}
+
+
+/**
+ * Set the protocol wait mode.
+ */
+void ReliableDataTransfer::set_wait_mode(wait_mode mode) {
+	protocol.set_wait_mode(mode);
+}
+
+
+/**
+ * Enable or disable the selective acks.
+ */
+void ReliableDataTransfer::set_sack(bool enable) {
+	sack = enable;
+}
+
+
+/**
+ * Enable or disable nak and fast retransmit in go back n.
+ */
+void ReliableDataTransfer::set_fast_retransmit(bool enable) {
+	fast_retransmit = enable;
+}
+
+
+/**
+ * The parity frame carries FEC_HEADER bytes more than a data frame.
+ */
+int ReliableDataTransfer::set_fec(unsigned int k) {
+	if (k > 0 && (k > window || k > 255 || protocol.get_payload_size() + FEC_HEADER > MAX_PKT_SIZE)) {
+		printf("Invalid fec group: %u\n", k);
+		return -1;
+	}
+	fec = k;
+	fec_count = 0;
+	return 1;
+}
+
+
+/**
+ * Return the forward error correction statistics.
+ */
+fec_stats ReliableDataTransfer::get_fec_stats() {
+	return fecs;
+}
+
+
+/**
+ * Set how many frames in order the receiver acks at once.
+ */
+void ReliableDataTransfer::set_ack_every(unsigned int n) {
+	ack_every = n;
+}
+
+
+/**
+ * Set how long the receiver may keep an ack back.
+ */
+void ReliableDataTransfer::set_ack_delay(unsigned long long delay) {
+	protocol.set_ack_delay(delay);
+}
+
+
+/**
+ * Return the ack statistics.
+ */
+ack_stats ReliableDataTransfer::get_ack_stats() {
+	return acks;
+}
+
+
+/**
+ * Set the loss rate of the incoming frames.
+ */
+void ReliableDataTransfer::set_loss(double rate, unsigned int seed) {
+	protocol.set_loss(rate, seed);
+}
+
+
+/**
+ * Return the number of frames dropped on purpose.
+ */
+unsigned long long ReliableDataTransfer::get_lost() {
+	return protocol.get_lost();
+}
+
+
+/**
+ * Set the simulated link of the incoming frames.
+ */
+void ReliableDataTransfer::set_impairment(const impairment_config* config, unsigned int seed) {
+	protocol.set_impairment(config, seed);
+}
+
+
+/**
+ * Return what the simulated link did.
+ */
+impairment_stats ReliableDataTransfer::get_impairment_stats() {
+	return protocol.get_impairment_stats();
+}
+
+
+/**
+ * Copy the link statistics.
+ */
+void ReliableDataTransfer::get_link_stats(link_snapshot* snapshot) {
+	protocol.get_link_stats()->snapshot(snapshot);
+}
+
+
+/**
+ * Write the link statistics in path.tmp, then rename it.
+ */
+int ReliableDataTransfer::export_link_stats(const char* path, export_format format) {
+	link_snapshot* snapshot = new link_snapshot;
+	char tmp[PATH_MAX];
+	int ret = -1;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	get_link_stats(snapshot);
+
+	FILE* file = fopen(tmp, "w");
+	if (file == NULL) {
+		printf("Open() failed: stats = %s\n", tmp);
+	} else {
+		ret = LinkStats::write(file, snapshot, format, trace_source);
+		if (fclose(file) != 0 || (ret == 0 && rename(tmp, path) != 0))
+			ret = -1;
+		if (ret < 0)
+			unlink(tmp);
+	}
+
+	delete snapshot;
+	return ret;
+}
+
+
+/**
+ * Return the protocol wait statistics.
+ */
+wait_stats ReliableDataTransfer::get_wait_stats() {
+	return protocol.get_wait_stats();
+}
+
+
+/**
+ * Return the round trip time statistics.
+ */
+rtt_stats ReliableDataTransfer::get_rtt_stats() {
+	return protocol.get_rtt_stats();
+}
+
+
+/**
+ * Return the TX batching statistics.
+ */
+tx_stats ReliableDataTransfer::get_tx_stats() {
+	return protocol.get_tx_stats();
+}
+
+
+/**
+ * Return the receive statistics.
+ */
+rx_stats ReliableDataTransfer::get_rx_stats() {
+	return protocol.get_rx_stats();
+}
+
+
+/**
+ * Return the startup times.
+ */
+startup_stats ReliableDataTransfer::get_startup_stats() {
+	return protocol.get_startup_stats();
+}
+
+
+/**
+ * Set the framing.
+ */
+void ReliableDataTransfer::set_framing(framing_type framing) {
+	protocol.set_framing(framing);
+}
+
+
+/**
+ * Start the RX thread.
+ */
+int ReliableDataTransfer::start_rx_thread(unsigned int capacity) {
+	return protocol.start_rx_thread(capacity);
+}
+
+
+/**
+ * Stop the RX thread.
+ */
+void ReliableDataTransfer::stop_rx_thread() {
+	protocol.stop_rx_thread();
+}
+
+
+/**
+ * Return the statistics of the incoming frame ring.
+ */
+ring_stats ReliableDataTransfer::get_ring_stats() {
+	return protocol.get_ring_stats();
 }
 
 
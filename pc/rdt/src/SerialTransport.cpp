@@ -0,0 +1,173 @@
+#include "../include/SerialTransport.h"
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Convert the user baudrate 9600 into a terios baudrate B9600
+ * using the conversion table
+ */
+int SerialTransport::get_baudrate(unsigned int rawrate) {
+
+	for (unsigned int i = 0; i < sizeof(conversiontable) / sizeof(conversiontable[0]); i++) {
+		if (conversiontable[i].rawrate == rawrate) {
+			return conversiontable[i].termiosrate;
+		}
+	}
+	return -1;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+SerialTransport::SerialTransport(const char* device, unsigned int baudrate, bool hold_dtr) {
+	this->device = strdup(device);
+	this->baudrate = baudrate;
+	this->actual_baudrate = 0;
+	this->hold_dtr = hold_dtr;
+}
+
+
+SerialTransport::~SerialTransport() {
+	free(device);
+}
+
+
+/**
+ * Open the serial connection using termios struct.
+ * Set the serial port parameters to raw mode and the baudrate given by user.
+ * Then flush the file descriptor with a timeout.
+ * This flush is needed for one reason:
+ * Having tcsetattr(), that flush the RX/TX buffer no timeout,
+ * being the serial transmission low, it could be possible
+ * that tcsetattr() flush empty buffer and data arrives soon after,
+ * leaving the buffer dirty.
+ * For this a flush with timeout is needed.
+ * There is no sleep for the boot of the board: the physical layer
+ * probes it (see needs_probe()).
+ * A missing device (e.g. still enumerating on USB) is retried with a
+ * doubling delay, 100 ms first, 1.5 seconds in total.
+ * A baudrate of 0 is an error, not B0 (hang up).
+ */
+int SerialTransport::open() {
+
+	int retry = 0;
+	useconds_t delay = 100000;
+
+	if (baudrate == 0) {
+		printf("Open() failed: device = %s, baudrate 0\n", device);
+		return -1;
+	}
+
+	while (retry <= 5) {
+		file_desc = ::open(device, O_RDWR | O_NOCTTY | O_NDELAY);
+
+		if (file_desc != -1)
+			break;
+		retry++;
+
+		printf("Open() failed: device = %s, attempt number %d of 5\n", device, retry);
+
+		if (retry == 5)
+			return -1;
+
+		usleep(delay);
+		delay = delay * 2;
+	}
+
+
+	termios serialPortSettings;
+
+	if (tcgetattr(file_desc, &serialPortSettings) < 0) {
+		perror("tcgetattr() failed: ");
+		close();
+		return -1;
+	}
+
+	// ----- CONTROL OPTIONS ----- //
+	// Setting parity checking, setting hardware flow control
+	serialPortSettings.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS);
+
+	// 8 data bits, enable receiver, local line - do not change "owner" of port
+	serialPortSettings.c_cflag |= (CS8 | CREAD | CLOCAL);
+
+	// Drop DTR on close (the board resets on next open) unless asked to hold it
+	if (hold_dtr)
+		serialPortSettings.c_cflag &= ~HUPCL;
+	else
+		serialPortSettings.c_cflag |= HUPCL;
+
+	// ----- INPUT OPTIONS ----- //
+	// Disable software flow control (ICRNL ignore carriage return on input)
+	serialPortSettings.c_iflag &= ~(IXON | IXOFF | IXANY | IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+
+	// ----- LINE OPTIONS ----- //
+	// Choosing Raw Input (Raw input is unprocessed)
+	serialPortSettings.c_lflag &= ~(ECHO | ECHOE | ECHONL | ICANON | ISIG | IEXTEN);
+
+	// ----- OUTPUT OPTIONS ----- //
+	// Choosing Raw Output
+	serialPortSettings.c_oflag &= ~OPOST;
+
+	// ----- CONTROL CHARACTERS ----- //
+	// Minimum number of characters to read
+	serialPortSettings.c_cc[VMIN]  = 0;
+	// Time to wait for data (tenths of seconds)
+	serialPortSettings.c_cc[VTIME] = 10;
+
+	// Setting the Baud Rate (a non standard one is set below)
+	int baud = get_baudrate(baudrate);
+
+	if (baud >= 0 && (cfsetispeed(&serialPortSettings, baud) < 0 || cfsetospeed(&serialPortSettings, baud) < 0)) {
+		perror("cfsetXspeed() failed: ");
+		close();
+		return -1;
+	}
+
+	// Flush input and output buffers and make the change
+	if (tcsetattr(file_desc, TCSAFLUSH, &serialPortSettings) < 0) {
+		perror("tcsetattr() failed: ");
+		close();
+		return -1;
+	}
+
+	if (baud < 0 && Termios2::set_baudrate(file_desc, baudrate) < 0) {
+		close();
+		return -1;
+	}
+
+	actual_baudrate = Termios2::get_baudrate(file_desc);
+	printf("Serial %s: requested %u baud, configured %u baud\n", device, baudrate, actual_baudrate);
+
+	// Flush with a timeout of 1 ms
+	usleep(1000);
+	tcflush(file_desc, TCIFLUSH);
+
+	return file_desc;
+
+}
+
+
+const char* SerialTransport::get_name() {
+	return "serial";
+}
+
+
+/**
+ * The board may be booting: it resets when DTR goes up.
+ */
+bool SerialTransport::needs_probe() {
+	return true;
+}
+
+
+/**
+ * Return the baudrate read back after the configuration.
+ */
+unsigned int SerialTransport::get_configured_baudrate() {
+	return actual_baudrate;
+}
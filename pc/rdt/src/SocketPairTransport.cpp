@@ -0,0 +1,40 @@
+#include "../include/SocketPairTransport.h"
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Create a connected unix stream socketpair, one end for each transport.
+ * A stream socket behaves like the serial line: no message boundaries.
+ */
+int SocketPairTransport::pair(SocketPairTransport* a, SocketPairTransport* b) {
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair() failed: ");
+		return -1;
+	}
+
+	a->file_desc = fds[0];
+	b->file_desc = fds[1];
+
+	if (a->set_nonblocking() < 0 || b->set_nonblocking() < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Nothing to open, the socket is created by pair().
+ */
+int SocketPairTransport::open() {
+	return file_desc;
+}
+
+
+const char* SocketPairTransport::get_name() {
+	return "socketpair";
+}
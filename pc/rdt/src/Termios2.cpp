@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+#include "../include/Termios2.h"
+
+
+/**
+ * With BOTHER in c_cflag the driver takes the rate from c_ispeed/c_ospeed
+ * instead of the Bxxx constant.
+ */
+int Termios2::set_baudrate(int file_desc, unsigned int rate) {
+	struct termios2 settings;
+
+	if (ioctl(file_desc, TCGETS2, &settings) < 0) {
+		perror("ioctl(TCGETS2) failed: ");
+		return -1;
+	}
+
+	settings.c_cflag &= ~CBAUD;
+	settings.c_cflag |= BOTHER;
+	settings.c_ispeed = rate;
+	settings.c_ospeed = rate;
+
+	if (ioctl(file_desc, TCSETS2, &settings) < 0) {
+		perror("ioctl(TCSETS2) failed: ");
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * termios2 reports the rate as a number also for standard rates.
+ */
+unsigned int Termios2::get_baudrate(int file_desc) {
+	struct termios2 settings;
+
+	if (ioctl(file_desc, TCGETS2, &settings) < 0)
+		return 0;
+	return settings.c_ospeed;
+}
@@ -0,0 +1,232 @@
+#include "../include/TimerWheel.h"
+
+
+/**
+ * List of the timers already expired, after the slots
+ */
+#define EXPIRED			(WHEEL_LEVELS * WHEEL_SLOTS)
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Deadlines not later than now are expired. The expired list keeps the
+ * order in which they expired, the slots are not ordered: in level 0
+ * all the timers of a slot have the same deadline.
+ *
+ * The levels cover the 64 bits of the time, so every deadline has one.
+ */
+void TimerWheel::place(int id) {
+	wheel_timer* t = &timers[id];
+
+	if (t->deadline <= now) {
+		t->list = EXPIRED;
+		t->prev = expired_tail;
+		t->next = -1;
+		if (expired_tail >= 0)
+			timers[expired_tail].next = id;
+		else
+			heads[EXPIRED] = id;
+		expired_tail = id;
+		return;
+	}
+
+	int level = (63 - __builtin_clzll(t->deadline ^ now)) / WHEEL_BITS;
+	int slot = (t->deadline >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+	int list = level * WHEEL_SLOTS + slot;
+
+	t->list = list;
+	t->prev = -1;
+	t->next = heads[list];
+	if (heads[list] >= 0)
+		timers[heads[list]].prev = id;
+	heads[list] = id;
+	occupied[level] |= 1ULL << slot;
+}
+
+
+void TimerWheel::unlink(int id) {
+	wheel_timer* t = &timers[id];
+
+	if (t->prev >= 0)
+		timers[t->prev].next = t->next;
+	else
+		heads[t->list] = t->next;
+
+	if (t->next >= 0)
+		timers[t->next].prev = t->prev;
+	else if (t->list == EXPIRED)
+		expired_tail = t->prev;
+
+	if (t->list != EXPIRED && heads[t->list] < 0)
+		occupied[t->list / WHEEL_SLOTS] &= ~(1ULL << (t->list % WHEEL_SLOTS));
+
+	t->list = -1;
+}
+
+
+/**
+ * A slot of level l is processed when the time reaches its first tick.
+ * The slots before the group of now in each level are empty, they would
+ * belong to the past: one bit scan per level is enough.
+ */
+unsigned long long TimerWheel::next_slot(int* list) {
+	unsigned long long first = 0;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		int shift = level * WHEEL_BITS;
+		int group = (now >> shift) & (WHEEL_SLOTS - 1);
+		uint64_t mask = occupied[level] & (~0ULL << group);
+
+		if (mask == 0)
+			continue;
+
+		int slot = __builtin_ctzll(mask);
+		unsigned long long base = (shift + WHEEL_BITS < 64) ? (now >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS) : 0;
+		unsigned long long time = base | ((unsigned long long)slot << shift);
+
+		if (time < now)
+			time = now;
+		if (first == 0 || time < first) {
+			first = time;
+			*list = level * WHEEL_SLOTS + slot;
+		}
+	}
+	return first;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+TimerWheel::TimerWheel() {
+	for (int i = 0; i <= EXPIRED; i++)
+		heads[i] = -1;
+	for (int i = 0; i < WHEEL_LEVELS; i++)
+		occupied[i] = 0;
+}
+
+
+TimerWheel::~TimerWheel() {
+	delete[] timers;
+}
+
+
+int TimerWheel::init(unsigned int capacity, unsigned long long now) {
+	delete[] timers;
+	timers = new wheel_timer[capacity];
+	this->capacity = capacity;
+
+	for (unsigned int i = 0; i < capacity; i++)
+		timers[i].list = -1;
+	clear(now);
+
+	return 0;
+}
+
+
+/**
+ * The lists are dropped as a whole, only the timers are marked.
+ */
+void TimerWheel::clear(unsigned long long now) {
+	for (unsigned int i = 0; i < capacity; i++) {
+		timers[i].deadline = 0;
+		timers[i].list = -1;
+	}
+	for (int i = 0; i <= EXPIRED; i++)
+		heads[i] = -1;
+	for (int i = 0; i < WHEEL_LEVELS; i++)
+		occupied[i] = 0;
+
+	expired_tail = -1;
+	armed = 0;
+	this->now = now;
+}
+
+
+void TimerWheel::arm(unsigned int id, unsigned long long deadline) {
+	if (id >= capacity)
+		return;
+
+	if (timers[id].list >= 0)
+		unlink(id);
+	else
+		armed++;
+
+	timers[id].deadline = deadline;
+	place(id);
+}
+
+
+void TimerWheel::cancel(unsigned int id) {
+	if (id >= capacity || timers[id].list < 0)
+		return;
+
+	unlink(id);
+	timers[id].deadline = 0;
+	armed--;
+}
+
+
+unsigned long long TimerWheel::deadline(unsigned int id) {
+	if (id >= capacity)
+		return 0;
+	return timers[id].deadline;
+}
+
+
+/**
+ * Move the wheel slot after slot up to the current time and stop at the
+ * first timer that expires. The time jumps over the empty slots, and the
+ * slots of the upper levels are moved down one level at a time.
+ */
+int TimerWheel::expire(unsigned long long current_time) {
+	int list;
+
+	while (heads[EXPIRED] < 0) {
+		unsigned long long time = next_slot(&list);
+
+		if (time == 0 || time > current_time) {
+			if (current_time > now)
+				now = current_time;
+			return -1;
+		}
+
+		now = time;
+		int id = heads[list];
+		heads[list] = -1;
+		occupied[list / WHEEL_SLOTS] &= ~(1ULL << (list % WHEEL_SLOTS));
+
+		while (id >= 0) {
+			int next = timers[id].next;
+			place(id);
+			id = next;
+		}
+	}
+
+	int id = heads[EXPIRED];
+	if (timers[id].deadline > current_time)
+		return -1;
+
+	unlink(id);
+	timers[id].deadline = 0;
+	armed--;
+	return id;
+}
+
+
+unsigned long long TimerWheel::next_deadline() {
+	int list;
+
+	if (heads[EXPIRED] >= 0)
+		return timers[heads[EXPIRED]].deadline;
+	return next_slot(&list);
+}
+
+
+unsigned int TimerWheel::size() {
+	return armed;
+}
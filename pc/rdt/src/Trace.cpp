@@ -0,0 +1,240 @@
+#include "../include/Trace.h"
+
+
+TraceLog rdt_trace;
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Drain every period, and once more when stopped.
+ */
+void* TraceLog::writer_loop(void* arg) {
+	TraceLog* t = (TraceLog*)arg;
+
+	while (t->writer_running.load(std::memory_order_acquire)) {
+		usleep(t->period);
+		t->drain(t->fd);
+	}
+	t->drain(t->fd);
+	return NULL;
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+TraceLog::TraceLog() : tail(0), enabled(false), sources(0), drops(0), writer_running(false) {
+	pthread_mutex_init(&drain_lock, NULL);
+}
+
+
+TraceLog::~TraceLog() {
+	stop();
+	pthread_mutex_destroy(&drain_lock);
+	delete[] slots;
+}
+
+
+/**
+ * Slot i waits for the record of position i: its turn is i, and
+ * becomes i + 1 once written, i + capacity once read.
+ */
+int TraceLog::init(unsigned int capacity) {
+	unsigned int size = 1;
+
+	while (size < capacity)
+		size = size * 2;
+
+	enabled = false;
+	delete[] slots;
+	slots = new trace_slot[size];
+	for (unsigned int i = 0; i < size; i++)
+		slots[i].turn.store(i, std::memory_order_relaxed);
+	mask = size - 1;
+	tail.store(0);
+	head = 0;
+	drops.store(0);
+	written = 0;
+	enabled = true;
+
+	return 0;
+}
+
+
+/**
+ * Open the file and start the writer thread.
+ */
+int TraceLog::start(const char* path, unsigned int capacity, unsigned long period) {
+	if (writer_running)
+		return -1;
+
+	if (slots == NULL && init(capacity) < 0)
+		return -1;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Open() failed: trace = %s\n", path);
+		return -1;
+	}
+
+	trace_header header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(trace_record);
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		printf("Error write(): error = %d\n", errno);
+		::close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	this->period = period;
+	enabled = true;
+	writer_running = true;
+
+	if (pthread_create(&writer, NULL, writer_loop, this) != 0) {
+		printf("Error pthread_create()\n");
+		writer_running = false;
+		::close(fd);
+		fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * The records of the calls still running may be lost.
+ */
+void TraceLog::stop() {
+	enabled = false;
+
+	if (!writer_running)
+		return;
+
+	writer_running = false;
+	pthread_join(writer, NULL);
+
+	::close(fd);
+	fd = -1;
+}
+
+
+/**
+ * Copy the ready records in order, stop at the first one
+ * still being written, and hand the slots back to the writers.
+ */
+int TraceLog::drain(int fd) {
+	trace_record batch[256];
+	int total = 0;
+
+	if (slots == NULL)
+		return 0;
+
+	pthread_mutex_lock(&drain_lock);
+	while (true) {
+		unsigned int n = 0;
+
+		while (n < sizeof(batch) / sizeof(batch[0])) {
+			trace_slot* s = &slots[head & mask];
+			if (s->turn.load(std::memory_order_acquire) != head + 1)
+				break;
+			batch[n++] = s->r;
+			s->turn.store(head + mask + 1, std::memory_order_release);
+			head++;
+		}
+
+		if (n == 0)
+			break;
+
+		if (write(fd, batch, n * sizeof(trace_record)) != (ssize_t)(n * sizeof(trace_record))) {
+			printf("Error write(): error = %d\n", errno);
+			total = -1;
+			break;
+		}
+		written = written + n;
+		total = total + n;
+	}
+	pthread_mutex_unlock(&drain_lock);
+
+	return total;
+}
+
+
+/**
+ * Source numbers start from 1.
+ */
+unsigned int TraceLog::next_source() {
+	return sources.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+
+/**
+ * A writer claims a position when its slot is free (turn == position),
+ * fills the record and publishes it with turn = position + 1 (release).
+ * The slot is not free if the drain is a whole ring behind: the record
+ * is dropped.
+ */
+void TraceLog::record(trace_event event, unsigned int source, unsigned char kind, seq_nr seq, seq_nr ack,
+		const packet* p, uint32_t checksum) {
+	if (!enabled.load(std::memory_order_relaxed))
+		return;
+
+	unsigned long long pos = tail.load(std::memory_order_relaxed);
+	trace_slot* s;
+
+	while (true) {
+		s = &slots[pos & mask];
+		long long diff = (long long)(s->turn.load(std::memory_order_acquire) - pos);
+
+		if (diff == 0) {
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			drops.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	trace_record* r = &s->r;
+	r->tick = (now.tv_sec * 1000000ULL) + (now.tv_nsec / 1000);
+	r->source = source;
+	r->checksum = checksum;
+	r->seq = seq;
+	r->ack = ack;
+	r->event = event;
+	r->kind = kind;
+	r->len = 0;
+	if (p != NULL) {
+		r->len = p->len;
+		memcpy(r->data, p->data, p->len < TRACE_BYTES ? p->len : TRACE_BYTES);
+	}
+
+	s->turn.store(pos + 1, std::memory_order_release);
+}
+
+
+/**
+ * Return the statistics.
+ */
+trace_stats TraceLog::get_stats() {
+	trace_stats stats;
+
+	stats.capacity = slots != NULL ? mask + 1 : 0;
+	stats.recorded = tail.load();
+	stats.drops = drops.load();
+	pthread_mutex_lock(&drain_lock);
+	stats.written = written;
+	pthread_mutex_unlock(&drain_lock);
+
+	return stats;
+}
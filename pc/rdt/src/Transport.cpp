@@ -0,0 +1,116 @@
+#include "../include/Transport.h"
+#include "../include/SerialTransport.h"
+#include "../include/PtyTransport.h"
+#include "../include/UdpTransport.h"
+
+
+// ------------------------------------------------------------------------- //
+// --------------------------- PRIVATE FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+/**
+ * Read and write must never block the protocol loop.
+ */
+int Transport::set_nonblocking() {
+	int flags = fcntl(file_desc, F_GETFL, 0);
+	if (flags < 0)
+		return -1;
+	return fcntl(file_desc, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+Transport::Transport() {
+	file_desc = -1;
+}
+
+
+Transport::~Transport() {
+}
+
+
+/**
+ * Only a peer on a real device may be still booting.
+ */
+bool Transport::needs_probe() {
+	return false;
+}
+
+
+/**
+ * Return the file descriptor, to be used by select/poll.
+ */
+int Transport::get_fd() {
+	return file_desc;
+}
+
+
+/**
+ * Ask the kernel how many bytes are waiting in the RX buffer.
+ */
+int Transport::available() {
+	int bytes = 0;
+	if (ioctl(file_desc, FIONREAD, &bytes) < 0)
+		return -1;
+	return bytes;
+}
+
+
+/**
+ * Read bytes
+ */
+int Transport::read(unsigned char* buff, unsigned int len) {
+	return ::read(file_desc, buff, len);
+}
+
+
+/**
+ * Write bytes
+ */
+int Transport::write(unsigned char* buff, unsigned int len) {
+	return ::write(file_desc, buff, len);
+}
+
+
+/**
+ * Close the file descriptor
+ */
+int Transport::close() {
+	int ret = ::close(file_desc);
+	file_desc = -1;
+	return ret;
+}
+
+
+/**
+ * Choose the transport implementation from the device string.
+ */
+Transport* Transport::create(const char* device, unsigned int baudrate) {
+	if (strcmp(device, "pty") == 0)
+		return new PtyTransport();
+
+	if (strncmp(device, "pty:", 4) == 0)
+		return new PtyTransport(device + 4);
+
+	if (strncmp(device, "udp:", 4) == 0) {
+		unsigned int local_port, remote_port;
+		if (sscanf(device + 4, "%u:%u", &local_port, &remote_port) != 2) {
+			printf("Invalid udp device: %s\n", device);
+			return NULL;
+		}
+		return new UdpTransport(local_port, remote_port);
+	}
+
+	const char* hold = strrchr(device, ':');
+	if (hold != NULL && strcmp(hold, ":hold") == 0) {
+		char* path = strndup(device, hold - device);
+		Transport* t = new SerialTransport(path, baudrate, true);
+		free(path);
+		return t;
+	}
+
+	return new SerialTransport(device, baudrate);
+}
@@ -0,0 +1,56 @@
+#include "../include/UdpTransport.h"
+
+
+// ------------------------------------------------------------------------- //
+// ---------------------------- PUBLIC FUNCTIONS --------------------------- //
+// ------------------------------------------------------------------------- //
+
+UdpTransport::UdpTransport(unsigned short local_port, unsigned short remote_port) {
+	this->local_port = local_port;
+	this->remote_port = remote_port;
+}
+
+
+/**
+ * Bind to the local port and connect to the remote one, so plain
+ * read()/write() can be used and datagrams from other ports are discarded.
+ */
+int UdpTransport::open() {
+	sockaddr_in addr;
+
+	file_desc = socket(AF_INET, SOCK_DGRAM, 0);
+	if (file_desc < 0) {
+		perror("socket() failed: ");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	addr.sin_port = htons(local_port);
+	if (bind(file_desc, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("bind() failed: ");
+		close();
+		return -1;
+	}
+
+	addr.sin_port = htons(remote_port);
+	if (::connect(file_desc, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("connect() failed: ");
+		close();
+		return -1;
+	}
+
+	if (set_nonblocking() < 0) {
+		close();
+		return -1;
+	}
+
+	return file_desc;
+}
+
+
+const char* UdpTransport::get_name() {
+	return "udp";
+}
@@ -20,8 +20,14 @@
 // Size of data in bytes that user want to send
 #define BUFFER_SIZE			4
 
+// Timeouts in microseconds: upper bound of the retransmission timeout of
+// the sender, which follows the round trip time, the receiver acks after
+// half of its timeout
+#define SEND_TIMEOUT		1000000
+#define RECV_TIMEOUT		2000
 
-void sender(ReliableDataTransfer rdt, unsigned char* buffer, unsigned char r, unsigned char g, unsigned char b) {
+
+void sender(ReliableDataTransfer& rdt, unsigned char* buffer, unsigned char r, unsigned char g, unsigned char b) {
 	struct timeval start_time, end_time;
 	unsigned long long start_tick, end_tick;
 
@@ -37,11 +43,11 @@ void sender(ReliableDataTransfer rdt, unsigned char* buffer, unsigned char r, un
 		start_tick = (start_time.tv_sec * 1000) + (start_time.tv_usec / 1000);
 
 		printf("|X| PC ----> ARDUINO |X|\n");
-		rdt.send(buffer, BUFFER_SIZE, 1000);
+		rdt.send(buffer, BUFFER_SIZE, SEND_TIMEOUT);
 
 		// Receive the command and send ack
 		printf("|X| ARDUINO ----> PC |X|\n");
-		rdt.recv(buffer, BUFFER_SIZE, 2);
+		rdt.recv(buffer, BUFFER_SIZE, RECV_TIMEOUT);
 
 		gettimeofday(&end_time, NULL);
 		end_tick = (end_time.tv_sec * 1000) + (end_time.tv_usec / 1000);
@@ -62,11 +68,11 @@ void sender(ReliableDataTransfer rdt, unsigned char* buffer, unsigned char r, un
 		start_tick = (start_time.tv_sec * 1000) + (start_time.tv_usec / 1000);
 
 		printf("|X| PC ----> ARDUINO |X|\n");
-		rdt.send(buffer, BUFFER_SIZE, 1000);
+		rdt.send(buffer, BUFFER_SIZE, SEND_TIMEOUT);
 
 		// Receive the command and send ack
 		printf("|X| ARDUINO ----> PC |X|\n");
-		rdt.recv(buffer, BUFFER_SIZE, 2);
+		rdt.recv(buffer, BUFFER_SIZE, RECV_TIMEOUT);
 
 		gettimeofday(&end_time, NULL);
 		end_tick = (end_time.tv_sec * 1000) + (end_time.tv_usec / 1000);
@@ -82,11 +88,22 @@ int main() {
 
 	ReliableDataTransfer rdt;
 	unsigned char buffer[BUFFER_SIZE];
+
+	// Frames sent and received, print them with: tools/tracedump rdt.trace
+	rdt_trace.start("rdt.trace");
 	
 	if (rdt.init(DEVICE, PROTOCOL, BAUDRATE) > 0) {
 		printf("%s\n", "Open rdt");
 
+		// One handshake for the whole test, the Arduino sketch does the same
+		rdt.set_session(true);
+
 		sender(rdt, buffer, 10, 0, 0);
+
+		startup_stats startup = rdt.get_startup_stats();
+		printf("Startup: open %llu us, ready %llu us, first frame %llu us\n",
+			startup.open, startup.ready, startup.first_frame);
+
 		sender(rdt, buffer, 0, 10, 0);
 		sender(rdt, buffer, 0, 0, 10);
 		sender(rdt, buffer, 10, 0, 0);
@@ -0,0 +1,391 @@
+
+// TRACE DECODER
+//
+// Prints the binary trace written by rdt_trace.start(), one line per
+// frame as the rdt used to print them:
+//
+//     ./tracedump rdt.trace
+//
+// Options:
+//     -s source        only the records of this rdt (see the first column)
+//     -r               times relative to the first record
+//     -c               Chrome trace JSON, for chrome://tracing or ui.perfetto.dev
+//
+// A line is the time in us, the source, then the frame:
+//
+//     1523 us  [1] Send frame ==> seq = 0, len = 4, 1, 2, 3, 4, checksum = 48879
+//     1561 us  [2] Received frame ==> ack, ack = 0
+//
+// With an rdt built with TRACE_LEVEL=3 the trace also has the waits,
+// the timers, the ring and the handshake, and -c draws them as a
+// timeline: a track per rdt, the messages, handshakes and waits as
+// spans, a span per data timer from armed to stopped or expired, and
+// the frames as instants.
+//
+//     cd rdt && TRACE_LEVEL=3 make && cd ../bench && make
+//     ./bench -l bench.trace
+//     ../tools/tracedump -c bench.trace > bench.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../rdt/include/Protocol.h"
+#include "../rdt/include/Trace.h"
+
+
+/**
+ * Sources and sequence numbers followed by the Chrome output
+ */
+#define MAX_SOURCES		256
+#define MAX_SEQS		65536
+
+
+/**
+ * Return a string for a given frame kind.
+ */
+const char* kind_to_string(unsigned char fk) {
+	const char* str;
+	switch (fk) {
+		case DATA:
+			str = "data";
+			break;
+		case ACK:
+			str = "ack";
+			break;
+		case NAK:
+			str = "nak";
+			break;
+		case SACK:
+			str = "sack";
+			break;
+		case PARITY:
+			str = "parity";
+			break;
+		default:
+			str = "unknown";
+			break;
+	}
+	return str;
+}
+
+
+/**
+ * Return the name of the call of a message event.
+ */
+const char* message_to_string(unsigned char kind) {
+	switch (kind) {
+		case 's': return "send";
+		case 'r': return "recv";
+		case 'x': return "exchange";
+		default: return "message";
+	}
+}
+
+
+/**
+ * Print the length and the first bytes of a payload.
+ */
+void print_payload(const trace_record* r) {
+	unsigned int n = r->len < TRACE_BYTES ? r->len : TRACE_BYTES;
+
+	printf("len = %u, ", r->len);
+	for (unsigned int i = 0; i < n; i++)
+		printf("%d, ", r->data[i]);
+	if (r->len > TRACE_BYTES)
+		printf("..., ");
+}
+
+
+/**
+ * Print one record.
+ */
+void print_record(const trace_record* r, unsigned long long origin) {
+	printf("%llu us  [%u] ", (unsigned long long)r->tick - origin, r->source);
+
+	switch (r->event) {
+		case trace_send:
+		case trace_recv:
+			printf("%s frame ==> ", r->event == trace_send ? "Send" : "Received");
+			if (r->kind == DATA) {
+				printf("seq = %u, ", r->seq);
+				print_payload(r);
+				printf("checksum = %u\n", r->checksum);
+			} else if (r->kind == PARITY) {
+				printf("parity, seq = %u, ack = %u, ", r->seq, r->ack);
+				print_payload(r);
+				printf("checksum = %u\n", r->checksum);
+			} else {
+				printf("%s, ack = %u\n", kind_to_string(r->kind), r->ack);
+			}
+			break;
+		case trace_cksum_err:
+			printf("Checksum error\n");
+			break;
+		case trace_rebuilt:
+			printf("Rebuilt frame ==> seq = %u, ", r->seq);
+			print_payload(r);
+			printf("\n");
+			break;
+		case trace_enqueue:
+			printf("Enqueue ==> frames = %u\n", r->seq);
+			break;
+		case trace_dequeue:
+			printf("Dequeue ==> %s, seq = %u, ack = %u\n", kind_to_string(r->kind), r->seq, r->ack);
+			break;
+		case trace_timer_arm:
+			printf("Start timer ==> seq = %u, timeout = %u us\n", r->seq, r->checksum);
+			break;
+		case trace_timer_stop:
+			printf("Stop timer ==> seq = %u\n", r->seq);
+			break;
+		case trace_timer_fire:
+			printf("Timeout ==> seq = %u\n", r->seq);
+			break;
+		case trace_ack_timer_arm:
+			printf("Start ack timer ==> delay = %u us\n", r->checksum);
+			break;
+		case trace_ack_timer_stop:
+			printf("Stop ack timer\n");
+			break;
+		case trace_ack_timeout:
+			printf("Ack timeout\n");
+			break;
+		case trace_wait_begin:
+			if ((int32_t)r->checksum < 0)
+				printf("Wait ==> no timeout\n");
+			else
+				printf("Wait ==> timeout = %u us\n", r->checksum);
+			break;
+		case trace_wait_end:
+			printf("Wake up ==> %s\n", r->checksum ? "bytes" : "timer");
+			break;
+		case trace_connect_begin:
+			printf("Connect\n");
+			break;
+		case trace_connect_end:
+			printf("Connected\n");
+			break;
+		case trace_message_begin:
+			printf("Begin %s ==> len = %u\n", message_to_string(r->kind), r->checksum);
+			break;
+		case trace_message_end:
+			printf("End %s ==> len = %u\n", message_to_string(r->kind), r->checksum);
+			break;
+		default:
+			printf("Unknown event %u\n", r->event);
+			break;
+	}
+}
+
+
+/**
+ * Print the common fields of a Chrome trace event, and the comma
+ * before it if it is not the first.
+ */
+void chrome_event(const trace_record* r, unsigned long long origin, const char* name, const char* ph, bool* first) {
+	printf("%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%llu,\"pid\":1,\"tid\":%u",
+		*first ? "" : ",", name, ph, (unsigned long long)r->tick - origin, r->source);
+	*first = false;
+}
+
+
+/**
+ * State of the Chrome output: the open timer spans
+ */
+typedef struct {
+	bool named[MAX_SOURCES];				///< thread_name written
+	bool ack_timer[MAX_SOURCES];			///< ack timer span open
+	unsigned char timer[MAX_SOURCES][MAX_SEQS / 8];	///< data timer span open, a bit per seq
+} chrome_state;
+
+
+/**
+ * Print one record as Chrome trace events. The instants have the
+ * thread scope, the timers are async spans keyed by source and seq,
+ * so that the timers of the window overlap on their own rows.
+ */
+void print_chrome(const trace_record* r, unsigned long long origin, chrome_state* state, bool* first) {
+	unsigned int s = r->source % MAX_SOURCES;
+	unsigned long long id = (unsigned long long)r->source * MAX_SEQS + r->seq;
+	unsigned char bit = 1 << (r->seq % 8);
+	unsigned char* timer = &state->timer[s][r->seq / 8];
+
+	if (!state->named[s]) {
+		printf("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"rdt %u\"}}",
+			*first ? "" : ",", r->source, r->source);
+		*first = false;
+		state->named[s] = true;
+	}
+
+	switch (r->event) {
+		case trace_send:
+		case trace_recv:
+			chrome_event(r, origin, r->event == trace_send ? "send frame" : "recv frame", "i", first);
+			printf(",\"s\":\"t\",\"args\":{\"kind\":\"%s\",\"seq\":%u,\"ack\":%u,\"len\":%u}}",
+				kind_to_string(r->kind), r->seq, r->ack, r->len);
+			break;
+		case trace_cksum_err:
+			chrome_event(r, origin, "checksum error", "i", first);
+			printf(",\"s\":\"t\"}");
+			break;
+		case trace_rebuilt:
+			chrome_event(r, origin, "rebuilt", "i", first);
+			printf(",\"s\":\"t\",\"args\":{\"seq\":%u,\"len\":%u}}", r->seq, r->len);
+			break;
+		case trace_enqueue:
+			chrome_event(r, origin, "enqueue", "i", first);
+			printf(",\"s\":\"t\",\"args\":{\"frames\":%u}}", r->seq);
+			break;
+		case trace_dequeue:
+			chrome_event(r, origin, "dequeue", "i", first);
+			printf(",\"s\":\"t\",\"args\":{\"kind\":\"%s\",\"seq\":%u,\"ack\":%u}}",
+				kind_to_string(r->kind), r->seq, r->ack);
+			break;
+		case trace_timer_arm:
+			if (*timer & bit) {
+				chrome_event(r, origin, "timer", "e", first);
+				printf(",\"cat\":\"timer\",\"id\":%llu}", id);
+			}
+			chrome_event(r, origin, "timer", "b", first);
+			printf(",\"cat\":\"timer\",\"id\":%llu,\"args\":{\"seq\":%u,\"timeout_us\":%u}}",
+				id, r->seq, r->checksum);
+			*timer |= bit;
+			break;
+		case trace_timer_stop:
+		case trace_timer_fire:
+			if (*timer & bit) {
+				chrome_event(r, origin, "timer", "e", first);
+				printf(",\"cat\":\"timer\",\"id\":%llu,\"args\":{\"%s\":true}}",
+					id, r->event == trace_timer_fire ? "expired" : "stopped");
+				*timer &= ~bit;
+			}
+			if (r->event == trace_timer_fire) {
+				chrome_event(r, origin, "timeout", "i", first);
+				printf(",\"s\":\"t\",\"args\":{\"seq\":%u}}", r->seq);
+			}
+			break;
+		case trace_ack_timer_arm:
+			if (!state->ack_timer[s]) {
+				chrome_event(r, origin, "ack timer", "b", first);
+				printf(",\"cat\":\"ack timer\",\"id\":%u,\"args\":{\"delay_us\":%u}}", r->source, r->checksum);
+				state->ack_timer[s] = true;
+			}
+			break;
+		case trace_ack_timer_stop:
+		case trace_ack_timeout:
+			if (state->ack_timer[s]) {
+				chrome_event(r, origin, "ack timer", "e", first);
+				printf(",\"cat\":\"ack timer\",\"id\":%u}", r->source);
+				state->ack_timer[s] = false;
+			}
+			if (r->event == trace_ack_timeout) {
+				chrome_event(r, origin, "ack timeout", "i", first);
+				printf(",\"s\":\"t\"}");
+			}
+			break;
+		case trace_wait_begin:
+			chrome_event(r, origin, "wait", "B", first);
+			printf(",\"args\":{\"timeout_us\":%d}}", (int32_t)r->checksum);
+			break;
+		case trace_wait_end:
+			chrome_event(r, origin, "wait", "E", first);
+			printf(",\"args\":{\"woken_by\":\"%s\"}}", r->checksum ? "bytes" : "timer");
+			break;
+		case trace_connect_begin:
+		case trace_connect_end:
+			chrome_event(r, origin, "connect", r->event == trace_connect_begin ? "B" : "E", first);
+			printf("}");
+			break;
+		case trace_message_begin:
+		case trace_message_end:
+			chrome_event(r, origin, message_to_string(r->kind), r->event == trace_message_begin ? "B" : "E", first);
+			printf(",\"args\":{\"len\":%u}}", r->checksum);
+			break;
+		default:
+			break;
+	}
+}
+
+
+int main(int argc, char** argv) {
+	bool relative = false;
+	bool chrome = false;
+	long source = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:rc")) != -1) {
+		switch (opt) {
+			case 's': source = atol(optarg); break;
+			case 'r': relative = true; break;
+			case 'c': chrome = true; break;
+			default:
+				fprintf(stderr, "Usage: %s [-s source] [-r] [-c] trace\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-s source] [-r] [-c] trace\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[optind], "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Open() failed: trace = %s\n", argv[optind]);
+		return 1;
+	}
+
+	trace_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "Not a trace: %s\n", argv[optind]);
+		fclose(file);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record)) {
+		fprintf(stderr, "Unsupported trace: version = %u, record size = %u\n", header.version, header.record_size);
+		fclose(file);
+		return 1;
+	}
+
+	trace_record r;
+	unsigned long long origin = 0;
+	unsigned long long records = 0;
+	chrome_state* state = NULL;
+	bool first = true;
+
+	if (chrome) {
+		///< the timeline starts at 0 in any case
+		relative = true;
+		state = (chrome_state*)calloc(1, sizeof(chrome_state));
+		if (state == NULL) {
+			fprintf(stderr, "Calloc() failed\n");
+			fclose(file);
+			return 1;
+		}
+		printf("{\"traceEvents\":[");
+	}
+
+	while (fread(&r, sizeof(r), 1, file) == 1) {
+		if (relative && records == 0)
+			origin = r.tick;
+		records++;
+		if (source >= 0 && r.source != source)
+			continue;
+		if (chrome)
+			print_chrome(&r, origin, state, &first);
+		else
+			print_record(&r, origin);
+	}
+
+	if (chrome) {
+		printf("\n],\"displayTimeUnit\":\"ms\"}\n");
+		free(state);
+	}
+
+	fclose(file);
+	fprintf(stderr, "%llu records\n", records);
+
+	return 0;
+}